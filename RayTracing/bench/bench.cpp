@@ -0,0 +1,667 @@
+/******************************************************************************
+Trevor's thoughts:
+"It feels faster" isn't a benchmark. This is the one place to get numbers that
+can be compared between runs, commits and machines:
+	- micro: the hot functions on their own (sphere::hit, hittable_list::hit,
+	sphere_set::hit and ::occluded, each material's scatter, camera::get_ray, ray_color), in ns per call. The
+	inputs are all made up front from a fixed seed, so only the function itself
+	is on the clock.
+	- frames: the whole renderer on the default scene at a few sizes (grid_extent
+	5, 11, 22 -> ~120, ~490, ~1900 spheres) and thread counts, run several times
+	each, reporting Mrays/s and percentile frame times.
+	- scene_builds: setting up a big scene (add_sphere_field, 250K and 4M spheres)
+	on one thread and on all of them: generation and BVH build times, how
+	many bytes each sphere ends up costing (spheres + tree + materials), and
+	what an animation frame (sequence.h) costs instead: moving the spheres and
+	refitting the tree, plus how much worse the refit tree's SAH cost is.
+	- meshes: a 1M triangle torus (16K with --quick), written out as an OBJ file
+	and loaded back in: parse and BVH build times, bytes per triangle,
+	triangle_mesh::hit and ::occluded in ns per call, and Mrays/s rendering it.
+	- instances: a 256 sphere group placed 4096 times (256 with --quick), against
+	the same spheres copied into one sphere_set: build times, bytes, hit and
+	occluded ns per call, and what moving every instance costs (the top level
+	refit, and how much worse its SAH cost gets).
+Everything comes out as JSON on stdout (progress goes to stderr), so results can
+be diffed or plotted. Timing is all wall clock (steady_clock).
+
+	rt_bench [--quick] [--frames N] [--width N] [--spp N] [--output FILE]
+******************************************************************************/
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "integrator.h"
+#include "material.h"
+#include "obj_file.h"
+#include "packet.h"
+#include "render.h"
+#include "scene.h"
+#include "sequence.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct bench_options {
+	bool quick = false; // smaller everything, for a quick before/after check
+	int frames = 5; // per scene/thread count
+	int width = 320;
+	int spp = 16;
+	std::string output_path; // empty -> stdout
+};
+
+// Keeps the compiler from throwing away results we never look at
+volatile double bench_sink;
+
+using bench_clock = std::chrono::steady_clock;
+
+inline double seconds_since(bench_clock::time_point start) {
+	return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Best of a few runs of fn(), which makes calls calls: the minimum is the run with the
+// least interference from everything else on the machine
+template <typename Fn>
+double ns_per_call(int64_t calls, Fn fn) {
+	fn(); // warm up the caches
+	double best = infinity;
+	for (int run = 0; run < 5; ++run) {
+		auto start = bench_clock::now();
+		fn();
+		best = std::min(best, seconds_since(start));
+	}
+	return 1e9 * best / double(calls);
+}
+
+// Nearest-rank percentile (p in 0..100) of an already sorted list
+inline double percentile(const std::vector<double>& sorted, double p) {
+	size_t rank = size_t(ceil(p / 100 * sorted.size()));
+	return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// Rays from all around the scene towards random points near its center, so a
+// realistic mix hit and miss
+inline std::vector<ray> make_bench_rays(size_t count, uint64_t seed) {
+	pcg32 gen(seed);
+	std::vector<ray> rays;
+	rays.reserve(count);
+	for (size_t k = 0; k < count; ++k) {
+		point3 origin(random_double(gen, -13, 13), random_double(gen, 0.5, 4), random_double(gen, -13, 13));
+		point3 target(random_double(gen, -4, 4), random_double(gen, 0, 1), random_double(gen, -4, 4));
+		rays.push_back(ray(origin, target - origin));
+	}
+	return rays;
+}
+
+// Same camera as Main.cpp
+inline camera bench_camera(double aspect_ratio) {
+	return camera(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, aspect_ratio, 0.1, 10);
+}
+
+struct json_writer {
+	std::ostringstream out;
+	bool first = true;
+
+	void key(const char* name) {
+		if (!first)
+			out << ", ";
+		first = false;
+		out << '"' << name << "\": ";
+	}
+	void field(const char* name, double v) { key(name); out << v; }
+	void field(const char* name, const std::string& v) { key(name); out << '"' << v << '"'; }
+	void begin(const char* name, char bracket) { key(name); out << bracket; first = true; }
+	void begin_item() { if (!first) out << ", "; out << "\n    {"; first = true; }
+	void end(char bracket) { out << bracket; first = false; }
+};
+
+inline void micro_benchmarks(const bench_options& options, json_writer& json) {
+	const size_t num_rays = options.quick ? 1 << 12 : 1 << 16;
+	const auto rays = make_bench_rays(num_rays, 1);
+	scene bench_scene = random_scene(0);
+	const hittable_list& world = bench_scene.objects;
+	json.begin("micro", '[');
+
+	auto report = [&](const char* name, double ns, int64_t calls) {
+		json.begin_item();
+		json.field("name", std::string(name));
+		json.field("ns_per_call", ns);
+		json.field("calls", double(calls));
+		json.end('}');
+		std::cerr << name << ": " << ns << " ns\n";
+	};
+
+	// One mid-sized sphere in the middle of where the rays aim (~40% hit it)
+	{
+		sphere s(point3(0, 1, 0), 1.0, 0);
+		double ns = ns_per_call(int64_t(rays.size()), [&] {
+			hit_record rec;
+			int hits = 0;
+			for (const auto& r : rays)
+				hits += s.hit(r, 0, infinity, rec);
+			bench_sink = hits;
+		});
+		report("sphere::hit", ns, int64_t(rays.size()));
+	}
+
+	// Every sphere, one at a time: the baseline the BVH and SIMD work is measured against
+	{
+		const size_t n = std::min<size_t>(rays.size(), options.quick ? 256 : 2048);
+		double ns = ns_per_call(int64_t(n), [&] {
+			hit_record rec;
+			int hits = 0;
+			for (size_t k = 0; k < n; ++k)
+				hits += world.hit(rays[k], 0, infinity, rec);
+			bench_sink = hits;
+		});
+		json.begin_item();
+		json.field("name", std::string("hittable_list::hit"));
+		json.field("ns_per_call", ns);
+		json.field("calls", double(n));
+		json.field("spheres", double(world.objects.size()));
+		json.field("ns_per_intersection", ns / world.objects.size());
+		json.end('}');
+		std::cerr << "hittable_list::hit: " << ns << " ns (" << ns / world.objects.size() << " ns per sphere)\n";
+	}
+
+	// What the renderer actually uses for the same spheres
+	{
+		sphere_set set(world);
+		double ns = ns_per_call(int64_t(rays.size()), [&] {
+			hit_record rec;
+			int hits = 0;
+			for (const auto& r : rays)
+				hits += set.hit(r, 0, infinity, rec);
+			bench_sink = hits;
+		});
+		report("sphere_set::hit", ns, int64_t(rays.size()));
+
+		// Same rays as a shadow query: no hit record, and it can stop at the first hit
+		ns = ns_per_call(int64_t(rays.size()), [&] {
+			int hits = 0;
+			for (const auto& r : rays)
+				hits += set.occluded(r, 0, infinity);
+			bench_sink = hits;
+		});
+		report("sphere_set::occluded", ns, int64_t(rays.size()));
+	}
+
+	// Scatter off of real hit points (the rays that hit something in the scene). Includes picking
+	// the sampler back up for the bounce, since shade() has to do that every time too.
+	{
+		std::vector<ray> hit_rays;
+		std::vector<hit_record> hits;
+		for (const auto& r : rays) {
+			hit_record rec;
+			if (world.hit(r, 0, infinity, rec)) {
+				hit_rays.push_back(r);
+				hits.push_back(rec);
+			}
+		}
+
+		auto gen = make_sampler(sampler_type::sobol, 0, 16, 1024, 50);
+		auto scatter_bench = [&](const char* name, const material& mat) {
+			double ns = ns_per_call(int64_t(hits.size()), [&] {
+				ray scattered;
+				color attenuation;
+				double sum = 0;
+				for (size_t k = 0; k < hits.size(); ++k) {
+					gen->start_path(k, 0);
+					gen->start_bounce(50);
+					if (mat.scatter(hit_rays[k], hits[k], attenuation, scattered, *gen))
+						sum += double(scattered.direction().x());
+				}
+				bench_sink = sum;
+			});
+			report(name, ns, int64_t(hits.size()));
+		};
+		scatter_bench("lambertian::scatter", lambertian(color(0.5, 0.5, 0.5)));
+		scatter_bench("metal::scatter", metal(color(0.7, 0.6, 0.5), 0.3));
+		scatter_bench("dielectric::scatter", dielectric(1.5));
+	}
+
+	{
+		camera cam = bench_camera(16.0 / 9.0);
+		auto gen = make_sampler(sampler_type::sobol, 0, 16, 1024, 50);
+		const int64_t calls = int64_t(num_rays);
+		double ns = ns_per_call(calls, [&] {
+			double sum = 0;
+			for (int64_t k = 0; k < calls; ++k) {
+				gen->start_path(uint64_t(k) >> 4, uint32_t(k & 15));
+				ray r = cam.get_ray((k & 1023) / 1023.0, ((k >> 10) & 1023) / 1023.0, *gen);
+				sum += double(r.direction().y());
+			}
+			bench_sink = sum;
+		});
+		report("camera::get_ray", ns, calls);
+	}
+
+	// Whole camera paths through the renderer's scene
+	{
+		sphere_set set(world);
+		const light_list no_lights; // (the random scene has none - the same work ray_color always did)
+		camera cam = bench_camera(16.0 / 9.0);
+		auto gen = make_sampler(sampler_type::sobol, 0, 16, 1024, 50);
+		const int64_t calls = options.quick ? 1 << 10 : 1 << 14;
+		double ns = ns_per_call(calls, [&] {
+			double sum = 0;
+			for (int64_t k = 0; k < calls; ++k) {
+				gen->start_path(uint64_t(k), 0);
+				ray r = cam.get_ray((k & 127) / 127.0, ((k >> 7) & 127) / 127.0, *gen);
+				sum += double(ray_color(r, set, bench_scene.materials, no_lights, 50, *gen).x());
+			}
+			bench_sink = sum;
+		});
+		report("ray_color", ns, calls);
+	}
+
+	json.end(']');
+}
+
+inline void frame_benchmarks(const bench_options& options, json_writer& json) {
+	const double aspect_ratio = 16.0 / 9.0;
+	const camera cam = bench_camera(aspect_ratio);
+
+	std::vector<int> extents = options.quick ? std::vector<int>{ 11 } : std::vector<int>{ 5, 11, 22 };
+	int hardware = std::max(1, int(std::thread::hardware_concurrency()));
+	std::vector<int> thread_counts = { 1 };
+	if (hardware >= 4)
+		thread_counts.push_back(hardware / 2);
+	if (hardware > 1)
+		thread_counts.push_back(hardware);
+
+	json.begin("frames", '[');
+	for (int extent : extents) {
+		scene bench_scene = random_scene(0, extent);
+		sphere_set world(bench_scene.objects);
+		const light_list no_lights;
+		for (int threads : thread_counts) {
+			render_settings settings;
+			settings.image_width = options.width;
+			settings.image_height = int(options.width / aspect_ratio);
+			settings.samples_per_pixel = options.spp;
+			settings.threads = threads;
+			settings.progress = false;
+
+			std::vector<double> times;
+			uint64_t rays = 0;
+			for (int frame = 0; frame < options.frames; ++frame) {
+				framebuffer image(settings.image_width, settings.image_height);
+				uint64_t rays_before = total_path_stats().rays();
+				auto start = bench_clock::now();
+				render(settings, [&](const tile& t) { render_tile_packets(t, cam, world, bench_scene.materials, no_lights, settings, shade, image); });
+				times.push_back(seconds_since(start));
+				rays = total_path_stats().rays() - rays_before; // the same every frame (same seed)
+			}
+			std::sort(times.begin(), times.end());
+
+			json.begin_item();
+			json.field("grid_extent", extent);
+			json.field("spheres", double(world.size()));
+			json.field("threads", threads);
+			json.field("width", settings.image_width);
+			json.field("height", settings.image_height);
+			json.field("spp", settings.samples_per_pixel);
+			json.field("rays_per_frame", double(rays));
+			json.field("mrays_per_sec", rays / percentile(times, 50) / 1e6);
+			json.begin("frame_ms", '{');
+			json.field("min", 1e3 * times.front());
+			json.field("p50", 1e3 * percentile(times, 50));
+			json.field("p90", 1e3 * percentile(times, 90));
+			json.field("p99", 1e3 * percentile(times, 99));
+			json.field("max", 1e3 * times.back());
+			json.end('}');
+			json.end('}');
+			std::cerr << "\rgrid " << extent << ", " << threads << " threads: "
+				<< rays / percentile(times, 50) / 1e6 << " Mrays/s, p50 " << 1e3 * percentile(times, 50) << " ms\n";
+		}
+	}
+	json.end(']');
+}
+
+inline void scene_build_benchmarks(const bench_options& options, json_writer& json) {
+	std::vector<int> extents = options.quick ? std::vector<int>{ 100 } : std::vector<int>{ 250, 1000 };
+	int hardware = std::max(1, int(std::thread::hardware_concurrency()));
+	std::vector<int> thread_counts = { 1 };
+	if (hardware > 1)
+		thread_counts.push_back(hardware);
+
+	json.begin("scene_builds", '[');
+	for (int extent : extents) {
+		for (int threads : thread_counts) {
+			auto start = bench_clock::now();
+			scene bench_scene;
+			add_sphere_field(bench_scene, 0, extent, threads);
+			double generate = seconds_since(start);
+
+			sphere_set world = std::move(bench_scene.spheres);
+			start = bench_clock::now();
+			world.build(threads);
+			double build = seconds_since(start);
+			double bytes = double(world.memory_bytes() + bench_scene.materials.size() * sizeof(material));
+
+			// Half a second of bouncing (one hop is 1 s), then one refit - the worst the tree gets
+			double built_cost = world.sah_cost();
+			start = bench_clock::now();
+			bounce_spheres(world, 0, 0.5, threads);
+			double move = seconds_since(start);
+			start = bench_clock::now();
+			world.refit(threads);
+			double refit = seconds_since(start);
+
+			json.begin_item();
+			json.field("grid_extent", extent);
+			json.field("spheres", double(world.size()));
+			json.field("threads", threads);
+			json.field("generate_ms", 1e3 * generate);
+			json.field("build_ms", 1e3 * build);
+			json.field("bvh_nodes", double(world.nodes.size()));
+			json.field("materials", double(bench_scene.materials.size()));
+			json.field("bytes_per_sphere", bytes / double(world.size()));
+			json.field("move_ms", 1e3 * move);
+			json.field("refit_ms", 1e3 * refit);
+			json.field("refit_sah_ratio", world.sah_cost() / built_cost);
+			json.end('}');
+			std::cerr << "\rsphere field " << extent << ", " << threads << " threads: " << world.size() << " spheres, generated in "
+				<< 1e3 * generate << " ms, BVH in " << 1e3 * build << " ms (refit in " << 1e3 * refit << " ms, SAH cost x"
+				<< world.sah_cost() / built_cost << "), " << bytes / double(world.size()) << " bytes per sphere\n";
+		}
+	}
+	json.end(']');
+}
+
+// A torus lying on y = 0, as OBJ text: rings x segments quads (2 triangles each), with vertex
+// normals, written the way exporters do (6 decimals, v//vn faces). Made up on the spot, rather
+// than keeping a big model in the repo.
+inline void write_torus_obj(std::ostream& out, int rings, int segments, double major, double minor) {
+	out << std::fixed << std::setprecision(6);
+	out << "# torus, " << 2 * rings * segments << " triangles\n";
+	for (int ring = 0; ring < rings; ++ring) {
+		double u = 2 * pi * ring / rings;
+		for (int segment = 0; segment < segments; ++segment) {
+			double v = 2 * pi * segment / segments;
+			double nx = cos(v) * cos(u), ny = sin(v), nz = cos(v) * sin(u);
+			out << "v " << major * cos(u) + minor * nx << " " << minor + minor * ny << " " << major * sin(u) + minor * nz << "\n";
+			out << "vn " << nx << " " << ny << " " << nz << "\n";
+		}
+	}
+	auto vertex = [&](int ring, int segment) { return (ring % rings) * segments + segment % segments + 1; };
+	for (int ring = 0; ring < rings; ++ring) {
+		for (int segment = 0; segment < segments; ++segment) {
+			int corners[4] = { vertex(ring, segment), vertex(ring, segment + 1), vertex(ring + 1, segment + 1), vertex(ring + 1, segment) };
+			out << "f";
+			for (int c : corners)
+				out << " " << c << "//" << c;
+			out << "\n";
+		}
+	}
+}
+
+inline void mesh_benchmarks(const bench_options& options, json_writer& json) {
+	const int rings = options.quick ? 128 : 1024, segments = options.quick ? 64 : 512;
+	const std::string path = "rt_bench_torus.obj";
+	{
+		std::ofstream file(path);
+		write_torus_obj(file, rings, segments, 2.5, 1);
+		if (!file) {
+			std::cerr << "Couldn't write " << path << ", skipping the mesh benchmarks\n";
+			return;
+		}
+	}
+	int hardware = std::max(1, int(std::thread::hardware_concurrency()));
+
+	scene bench_scene;
+	auto mesh = make_shared<triangle_mesh>();
+	auto start = bench_clock::now();
+	bool loaded = load_obj(path, *mesh);
+	double load = seconds_since(start);
+	double file_bytes = 0;
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		file_bytes = double(file.tellg());
+	}
+	std::remove(path.c_str());
+	if (!loaded)
+		return;
+	start = bench_clock::now();
+	mesh->build(hardware);
+	double build = seconds_since(start);
+	mesh->mat_id = bench_scene.add_material(lambertian(color(0.4, 0.2, 0.1)));
+	const double triangles = double(mesh->num_triangles());
+
+	json.begin("meshes", '[');
+	json.begin_item();
+	json.field("triangles", triangles);
+	json.field("vertices", double(mesh->num_vertices()));
+	json.field("file_mb", file_bytes / 1e6);
+	json.field("load_ms", 1e3 * load);
+	json.field("load_mb_per_sec", file_bytes / 1e6 / load);
+	json.field("build_ms", 1e3 * build);
+	json.field("build_threads", hardware);
+	json.field("bvh_nodes", double(mesh->nodes.size()));
+	json.field("bytes_per_triangle", double(mesh->memory_bytes()) / triangles);
+	std::cerr << "torus: " << triangles << " triangles, loaded in " << 1e3 * load << " ms (" << file_bytes / 1e6 / load
+		<< " MB/s), BVH in " << 1e3 * build << " ms, " << double(mesh->memory_bytes()) / triangles << " bytes per triangle\n";
+
+	// Same kind of rays as the micro benchmarks (the torus sits where their targets are)
+	const std::vector<ray> rays = make_bench_rays(options.quick ? 1 << 12 : 1 << 16, 2);
+	double ns = ns_per_call(int64_t(rays.size()), [&] {
+		hit_record rec;
+		int hits = 0;
+		for (const auto& r : rays)
+			hits += mesh->hit(r, 0, infinity, rec);
+		bench_sink = hits;
+	});
+	json.field("hit_ns", ns);
+	std::cerr << "triangle_mesh::hit: " << ns << " ns\n";
+	ns = ns_per_call(int64_t(rays.size()), [&] {
+		int hits = 0;
+		for (const auto& r : rays)
+			hits += mesh->occluded(r, 0, infinity);
+		bench_sink = hits;
+	});
+	json.field("occluded_ns", ns);
+	std::cerr << "triangle_mesh::occluded: " << ns << " ns\n";
+
+	// The torus on the usual ground sphere, rendered from the usual camera
+	auto ground = make_shared<sphere_set>();
+	ground->add(point3(0, -1000, 0), 1000, bench_scene.add_material(lambertian(color(0.5, 0.5, 0.5))));
+	ground->build(1);
+	hittable_list world(ground);
+	world.add(mesh);
+	const double aspect_ratio = 16.0 / 9.0;
+	const light_list no_lights;
+	const camera cam = bench_camera(aspect_ratio);
+	render_settings settings;
+	settings.image_width = options.width;
+	settings.image_height = int(options.width / aspect_ratio);
+	settings.samples_per_pixel = options.spp;
+	settings.threads = hardware;
+	settings.progress = false;
+	std::vector<double> times;
+	uint64_t rays_per_frame = 0;
+	for (int frame = 0; frame < options.frames; ++frame) {
+		framebuffer image(settings.image_width, settings.image_height);
+		uint64_t rays_before = total_path_stats().rays();
+		start = bench_clock::now();
+		render(settings, [&](const tile& t) { render_tile(t, cam, world, bench_scene.materials, no_lights, settings, ray_color, image); });
+		times.push_back(seconds_since(start));
+		rays_per_frame = total_path_stats().rays() - rays_before;
+	}
+	std::sort(times.begin(), times.end());
+	json.field("threads", hardware);
+	json.field("rays_per_frame", double(rays_per_frame));
+	json.field("mrays_per_sec", rays_per_frame / percentile(times, 50) / 1e6);
+	json.end('}');
+	json.end(']');
+	std::cerr << "torus, " << hardware << " threads: " << rays_per_frame / percentile(times, 50) / 1e6 << " Mrays/s\n";
+}
+
+inline void instance_benchmarks(const bench_options& options, json_writer& json) {
+	const int side = options.quick ? 16 : 64; // instances per side of the grid
+	const int group_spheres = 256;
+	const double spacing = 30.0 / side;       // (the whole grid covers about the same ground as the random scene)
+	int hardware = std::max(1, int(std::thread::hardware_concurrency()));
+
+	// The group: small spheres scattered through a unit box sitting on y = 0
+	scene bench_scene;
+	scene_group group;
+	pcg32 gen(3);
+	for (int k = 0; k < group_spheres; ++k) {
+		point3 center(random_double(gen, -0.45, 0.45), random_double(gen, 0.05, 0.95), random_double(gen, -0.45, 0.45));
+		group.spheres->add(center, real(0.05), bench_scene.add_material(lambertian(color::random(gen))));
+	}
+	bench_scene.groups.push_back(group);
+	for (int a = 0; a < side; ++a) {
+		for (int b = 0; b < side; ++b) {
+			double scale = spacing * random_double(gen, 0.7, 0.9);
+			vec3 offset(real((a - side / 2 + 0.5) * spacing), 0, real((b - side / 2 + 0.5) * spacing));
+			affine_transform to_world = affine_transform::rotate(vec3(0, 1, 0), random_double(gen, 0, 360))
+				.then(affine_transform::scale(vec3(real(scale), real(scale), real(scale))))
+				.then(affine_transform::translate(offset));
+			bench_scene.instances.push_back({ 0, to_world });
+		}
+	}
+
+	instance_bvh placed;
+	auto start = bench_clock::now();
+	build_instances(bench_scene, placed, 0, hardware);
+	double build = seconds_since(start);
+	const double instanced_bytes = double(bench_scene.groups[0].memory_bytes() + placed.memory_bytes());
+
+	// The same spheres, copied into place
+	sphere_set copies;
+	const sphere_set& spheres = *bench_scene.groups[0].spheres;
+	for (const auto& inst : placed.instances) {
+		const affine_transform& to_world = inst.placement();
+		real scale = std::sqrt(to_world.m[0][0] * to_world.m[0][0] + to_world.m[1][0] * to_world.m[1][0] + to_world.m[2][0] * to_world.m[2][0]);
+		for (size_t k = 0; k < spheres.size(); ++k)
+			copies.add(to_world.point(point3(spheres.cx[k], spheres.cy[k], spheres.cz[k])), spheres.radius[k] * scale, spheres.mat_id[k]);
+	}
+	start = bench_clock::now();
+	copies.build(hardware);
+	double copies_build = seconds_since(start);
+
+	const std::vector<ray> rays = make_bench_rays(options.quick ? 1 << 12 : 1 << 16, 4);
+	auto hit_ns = [&](const hittable& world) {
+		return ns_per_call(int64_t(rays.size()), [&] {
+			hit_record rec;
+			int hits = 0;
+			for (const auto& r : rays)
+				hits += world.hit(r, 0, infinity, rec);
+			bench_sink = hits;
+		});
+	};
+	auto occluded_ns = [&](const hittable& world) {
+		return ns_per_call(int64_t(rays.size()), [&] {
+			int hits = 0;
+			for (const auto& r : rays)
+				hits += world.occluded(r, 0, infinity);
+			bench_sink = hits;
+		});
+	};
+	double instanced_hit = hit_ns(placed), copies_hit = hit_ns(copies);
+	double instanced_occluded = occluded_ns(placed), copies_occluded = occluded_ns(copies);
+
+	// Move every instance (the same spin an animation frame gives them), then refit the top level
+	double built_cost = placed.sah_cost();
+	start = bench_clock::now();
+	spin_instances(placed, 10, hardware);
+	double move = seconds_since(start);
+	start = bench_clock::now();
+	placed.refit(hardware);
+	double refit = seconds_since(start);
+
+	json.begin("instances", '[');
+	json.begin_item();
+	json.field("instances", double(placed.size()));
+	json.field("group_spheres", group_spheres);
+	json.field("placed_spheres", double(copies.size()));
+	json.field("build_ms", 1e3 * build);
+	json.field("copies_build_ms", 1e3 * copies_build);
+	json.field("bytes", instanced_bytes);
+	json.field("copies_bytes", double(copies.memory_bytes()));
+	json.field("hit_ns", instanced_hit);
+	json.field("copies_hit_ns", copies_hit);
+	json.field("occluded_ns", instanced_occluded);
+	json.field("copies_occluded_ns", copies_occluded);
+	json.field("move_ms", 1e3 * move);
+	json.field("refit_ms", 1e3 * refit);
+	json.field("refit_sah_ratio", placed.sah_cost() / built_cost);
+	json.end('}');
+	json.end(']');
+	std::cerr << "instances: " << placed.size() << " x " << group_spheres << " spheres, built in " << 1e3 * build << " ms, "
+		<< instanced_bytes / 1e6 << " MB (copies: " << 1e3 * copies_build << " ms, " << double(copies.memory_bytes()) / 1e6
+		<< " MB), hit " << instanced_hit << " ns (copies " << copies_hit << "), occluded " << instanced_occluded
+		<< " ns (copies " << copies_occluded << "), moving them all: " << 1e3 * move << " ms + refit " << 1e3 * refit
+		<< " ms (SAH cost x" << placed.sah_cost() / built_cost << ")\n";
+}
+
+inline std::string build_description() {
+	std::string simd = sphere_lanes == 8 ? "avx512" : sphere_lanes == 4 ? "avx" : "scalar";
+#if defined(__clang__)
+	std::string compiler = "clang " __clang_version__;
+#elif defined(__GNUC__)
+	std::string compiler = "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+	std::string compiler = "msvc " + std::to_string(_MSC_VER);
+#else
+	std::string compiler = "unknown";
+#endif
+	return compiler + ", " + simd;
+}
+
+int main(int argc, char** argv) {
+	bench_options options;
+	for (int k = 1; k < argc; ++k) {
+		const char* value = k + 1 < argc ? argv[k + 1] : nullptr;
+		if (!std::strcmp(argv[k], "--quick")) { options.quick = true; options.frames = 2; options.width = 160; options.spp = 4; continue; }
+		if (!value) { std::cerr << "Usage: " << argv[0] << " [--quick] [--frames N] [--width N] [--spp N] [--output FILE]\n"; return 1; }
+		if (!std::strcmp(argv[k], "--frames")) options.frames = std::atoi(value);
+		else if (!std::strcmp(argv[k], "--width")) options.width = std::atoi(value);
+		else if (!std::strcmp(argv[k], "--spp")) options.spp = std::atoi(value);
+		else if (!std::strcmp(argv[k], "--output")) options.output_path = value;
+		else { std::cerr << "Unknown option " << argv[k] << "\n"; return 1; }
+		++k;
+	}
+	if (options.frames < 1 || options.width < 16 || options.spp < 1) {
+		std::cerr << "Frames, width (at least 16) and spp need to be positive.\n";
+		return 1;
+	}
+
+	json_writer json;
+	json.out << "{";
+	json.field("build", build_description());
+	micro_benchmarks(options, json);
+	frame_benchmarks(options, json);
+	scene_build_benchmarks(options, json);
+	mesh_benchmarks(options, json);
+	instance_benchmarks(options, json);
+	json.out << "\n}\n";
+
+	if (options.output_path.empty()) {
+		std::cout << json.out.str();
+	}
+	else {
+		std::ofstream file(options.output_path);
+		file << json.out.str();
+		if (!file) {
+			std::cerr << "Couldn't write " << options.output_path << "\n";
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -50,214 +50,278 @@ find the viewport value at each pixel index.
 #include "color.h"
 #include "hittable_list.h"
 #include "sphere.h"
+#include "bvh.h"
+#include "sphere_set.h"
+#include "triangle_mesh.h"
+#include "instance.h"
 #include "camera.h"
 #include "material.h"
+#include "render.h"
+#include "packet.h"
+#include "options.h"
+#include "integrator.h"
+#include "wavefront.h"
+#include "scene.h"
+#include "noise_report.h"
+#include "image_io.h"
+#include "progressive.h"
+#include "scene_cache.h"
+#include "scene_file.h"
+#include "sequence.h"
+#include "distributed.h"
+#include "denoise.h"
+#include "preview.h"
+
+int main(int argc, char** argv) {
 
-#include <time.h>
-
-/*
-As a physics major, I'm amazed how well this simple model is working, despite a lot of assumptions, and missing elemnents.
-This author's done a great job so far, so I'm sure we're getting to at least some of these, but here's a few
-thoughts for improvement, just in case:
-1) We have no light sources. This was confusing to me at first. Rather than light, we just return the background when we
-don't hit anything. I guess this is kind of like a foggy day, when looking any direction is just the same brightness, 
-with no apparent source/direction to the light. It's basically all secondary scattering...Kind of a cool work around.
-2) ray tracing is expensive: Why not turn down the sample count, record you first contact object, creating a
-	mask, and smoothing within that mask...
-	- OK, for a "perfect" render, this model is simpler, and more accurate, but the CPU time is getting a
-	bit crazy (maybe not too bad with shaders, but I imagine you would want to process as many objects as
-	possible, and some large/realistic scenes (I'm talking modern triangles, not just spheres) could have
-	many objects, and potentially high frame rates
-		- You could blur on secondary objects too, but I'm not sure that would really be needed
-		- Not sure if it's worth it, but you could also blur in a scaled space...I don't have my intuition,
-		so I'm just throwing ideas around, but converting to RMS / log / exp space and then blurring might be interesting.
-		The main effect would be how much you let anomalous pixels pull their surroundings, rather than getting 
-		pulled in.
-		- Also, why used random rays? Would sub-pixel rays for interpolated contributions make more sense?
-			- You could get more even distribution
-			- You could re-uses a weighted contribution of each ray on the 4 pixels whose centers it would be between
-3) I'm sure we'll get to more reflective surfaces...curious how we'll approach those
-	- If we got really deep, we might address the changes to light as reflections approach 90 degrees off of the normal
-		- The light becomes polarized (which probably doesn't matter in 99% of simulations, though lots of 
-		modern glass/windows will never look quite right)
-		- I'm pretty sure it also loses saturation. I understand why it wouldn't be in this tutorial, but 
-		a bright room, with direct sunlight should get hotspots, and change in color on reflective surfaces
-4) I peaked ahead, so I know we'll be dealing with transparent objects
-	- Will they be pure transparent models, or include translucent scattered (which could be done with pure ray
-	tracer, or more computationally efficient with a skin depth model)
-
-*/
-color ray_color(const ray& r, const hittable& world, int depth) {
-	if (depth <= 0)
-		return  color(0, 0, 0);
-
-	hit_record rec;
-
-	// limit lower end of range to avoid floating a reflected ray hitting the spot it reflected off of...
-	// This is a bug that can occur because of floating point precision. You start the ray where the last one collided,
-	// but that could be +/-0.0000000000000000001 (or however many 0's). Then the ray could technically be inside the sphere
-	// when it's created. This happens a lot, causing a speckling problem, called "shadow acne". This impact is way bigger than
-	// I expected. Without this fix, repeated reflection were slowing the render down a ton (I think most rays would reflect once or twice,
-	// but must have ended up reflecting max_depth times because of this). Also, the "acne" is very pronounced. It looked very noisy. 
-	// I'm very glad the tutorial pointed this out, because it would have taken me forever to find this one!
-	if (world.hit(r, 0.001, infinity, rec)) { 
-		ray scattered;
-		color attenuation;
-		if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-			return attenuation * ray_color(scattered, world, depth - 1);
-		return color(0, 0, 0);
-
-		//// Lambertian reflection off of diffuse surfaces (2 options with very similar effects...to my eye at least)
-		//// Option 1: using this for now...seems closest to my understanding after reading the wiki
-		//point3 target = rec.p + rec.normal + random_unit_vector(); // random ray coming off of target pointing towards random point in the unit sphere
-		//// Option 2: Very similar render (I can't tell the difference (look up Lambertian Diffuse)
-		////point3 target = rec.p + random_in_hemisphere(rec.normal);
-		//return GAMMA * ray_color(ray(rec.p, target - rec.p), world, depth - 1);
-
-		//vec3 N = unit_vector(r.at(hit) - vec3(0, 0, -1));
-		//return 0.5*color(N.x() + 1, N.y() + 1, N.z() + 1); // (x+1)*.5 shifts -1 -> 1 distribution to 0 -> 1 
-
-		//return 0.5 *  (rec.normal + color(1, 1, 1)); // still just a representation of the normal (not a real physics based reflection)
-		
-		//return color(1, 0, 0); // red sphere
+	///////////////// World /////////////////
+	// The scene comes first, since it can set the camera and its own render settings
+	// (which the command line then overrides). Without --scene, it's the random spheres.
+	auto tStart = std::chrono::steady_clock::now(); // clock() adds up CPU time across all of the threads, so use the wall clock instead
+	scene world_scene;
+	// Same spheres as the hittable_list, packed for SIMD and sorted into a BVH (~O(log N) to search)
+	// For scenes with more than spheres, bvh world(list) works with any hittable
+	auto spheres = make_shared<sphere_set>();
+	sphere_set& world = *spheres;
+	bool prebuilt = false; // a scene cache comes with its sphere_set already built
+	const char* scene_path = find_option(argc, argv, "--scene");
+	if (scene_path) {
+		if (is_scene_cache(scene_path)) {
+			if (!load_scene_cache(scene_path, world_scene, world))
+				return 1;
+			prebuilt = true;
+		}
+		else if (!load_scene_file(scene_path, world_scene)) {
+			return 1;
+		}
 	}
+	// (the spheres that used to be commented out here are scenes/three_spheres.txt now)
 
-	// Create background/horizon (blue to white fade)
-	vec3 unit_direction = unit_vector(r.direction());
-	// ensure 0-1, since direction magnitudes range: -1 to 1
-	auto hit = 0.5*(unit_direction.y() + 1.0);
-	// Linear Interpolation (LERP) between white(1,1,1), and blue(0.5,0.7,1.0)
-	return (1.0 - hit) * color(1.0, 1.0, 1.0) + hit * color(0.5, 0.7, 1.0);
-}
-
-hittable_list random_scene() {
-	hittable_list world;
-
-	auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-	// Add a bunch of smaller random spheres
-	unsigned int seed = (unsigned int)time(NULL); // for videos, make sure to set explicitly (for image from tutorial, remove seed)
-	srand(seed);
-	for (int a = -11; a < 11; a++) { // position in x + rand
-		for (int b = -11; b < 11; b++) { // position in z + rand
-			auto choose_mat = random_double();
-			point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-			if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-				shared_ptr<material> sphere_material;
-
-				if (choose_mat < 0.8) {
-					// diffuse / non-reflective
-					auto albedo = color::random() * color::random(); // TODO: why squared??? Maybe just to lower the ave values a bit?
-					sphere_material = make_shared<lambertian>(albedo);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material)); // TODO: consider randomizing the radiuses as well
-				}
-				else if (choose_mat < 0.95) { // TODO: more intuitive to use the prob of this category, rather than this minus .8 from prev
-					// metal / reflective
-					auto albedo = color::random(0.5, 1);
-					auto fuzz = random_double(0, 0.5);
-					sphere_material = make_shared<metal>(albedo, fuzz);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
-				else {
-					// dielectric / glass
-					sphere_material = make_shared<dielectric>(1.52); // 1.52 = index of refraction of glass
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
-			}
+	///////////////// Image /////////////////
+	const auto aspect_ratio = world_scene.view.aspect_ratio;
+	const int image_width = world_scene.image_width > 0 ? world_scene.image_width : 1200;
+	const int image_height = static_cast<int>(image_width / aspect_ratio);
+	const int samples_per_pixel = world_scene.samples_per_pixel > 0 ? world_scene.samples_per_pixel
+		: 512; // with the sobol sampler, about as clean as 1000 used to be (see --noise-report)
+	const int max_depth = world_scene.max_depth > 0 ? world_scene.max_depth : 50;
+
+	render_settings settings;
+	settings.image_width = image_width;
+	settings.image_height = image_height;
+	settings.samples_per_pixel = samples_per_pixel;
+	settings.max_depth = max_depth;
+	settings.seed = 0; // fixed, so every run renders the same image (pick another with --seed)
+	if (!parse_options(argc, argv, aspect_ratio, settings))
+		return 1;
+
+	if (!scene_path)
+		world_scene = random_scene(settings.seed);
+	std::chrono::duration<double> bvh_time(0);
+	if (!prebuilt) {
+		// The spheres that went straight into the scene's sphere_set, plus any in the objects list
+		world = std::move(world_scene.spheres);
+		world.add(world_scene.objects);
+		world_scene.objects.clear(); // (everything's in world now)
+		auto tBuild = std::chrono::steady_clock::now();
+		world.build(settings.threads);
+		bvh_time = std::chrono::steady_clock::now() - tBuild;
+	}
+	// Meshes (scene files only) have a BVH each. With any, rays go through a list of the spheres and the meshes.
+	size_t triangles = 0, vertices = 0, mesh_bytes = 0;
+	auto tMeshes = std::chrono::steady_clock::now();
+	for (size_t m = 0; m < world_scene.meshes.size(); ++m) {
+		const auto& mesh = world_scene.meshes[m];
+		mesh->object_id = uint32_t(world.size() + m); // (after the spheres, which are 0 .. size - 1)
+		mesh->build(settings.threads);
+		triangles += mesh->num_triangles();
+		vertices += mesh->num_vertices();
+		mesh_bytes += mesh->memory_bytes();
+	}
+	std::chrono::duration<double> mesh_time = std::chrono::steady_clock::now() - tMeshes;
+	// Groups get built once each, however many instances there are, and the instances get a tree of their own (instance.h)
+	auto instances = make_shared<instance_bvh>();
+	auto tInstances = std::chrono::steady_clock::now();
+	build_instances(world_scene, *instances, uint32_t(world.size() + world_scene.meshes.size()), settings.threads); // (after the meshes)
+	std::chrono::duration<double> instance_time = std::chrono::steady_clock::now() - tInstances;
+	hittable_list everything(spheres);
+	for (const auto& mesh : world_scene.meshes)
+		everything.add(mesh);
+	if (instances->size() > 0)
+		everything.add(instances);
+	const bool has_meshes = !world_scene.meshes.empty();
+	const bool has_instances = instances->size() > 0;
+	const hittable& traced = has_meshes || has_instances ? static_cast<const hittable&>(everything) : world;
+	const material_table& materials = world_scene.materials; // hits point into this by material_id
+	// Every sphere and mesh that glows (lights.h), for next event estimation
+	light_list lights = collect_lights(world, world_scene.meshes, materials, world_scene.sky);
+	if (settings.progress) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - tStart;
+		std::cerr << "Scene: " << world.size() << " spheres, " << materials.size() << " materials ("
+			<< (prebuilt ? "mapped" : "built") << " in " << 1000 * elapsed.count() << " ms";
+		if (!prebuilt)
+			std::cerr << ", " << 1000 * bvh_time.count() << " ms of that on the BVH";
+		// Spheres, tree and materials - everything the scene keeps in memory while rendering
+		double bytes = double(world.memory_bytes() + materials.size() * sizeof(material));
+		std::cerr << "), " << bytes / double(std::max<size_t>(world.size(), 1)) << " bytes per sphere\n";
+		if (has_meshes) {
+			std::cerr << "Meshes: " << triangles << " triangles, " << vertices << " vertices in " << world_scene.meshes.size()
+				<< " meshes (BVHs built in " << 1000 * mesh_time.count() << " ms), "
+				<< double(mesh_bytes) / double(std::max<size_t>(triangles, 1)) << " bytes per triangle\n";
+		}
+		if (has_instances) {
+			// What the groups would take as copies instead: each one's bytes, once per instance of it
+			size_t group_bytes = 0, copied_bytes = 0;
+			for (const auto& group : world_scene.groups)
+				group_bytes += group.memory_bytes();
+			for (const auto& placed : world_scene.instances)
+				copied_bytes += world_scene.groups[placed.group].memory_bytes();
+			std::cerr << "Instances: " << instances->size() << " of " << world_scene.groups.size() << " groups (built in "
+				<< 1000 * instance_time.count() << " ms), " << group_bytes + instances->memory_bytes() << " bytes ("
+				<< instances->memory_bytes() << " of that on the instances and their tree) - copies would take "
+				<< copied_bytes << "\n";
 		}
+		if (!lights.empty())
+			std::cerr << "Lights: " << lights.size() << " (next event estimation at every diffuse bounce)\n";
 	}
 
-	// A larger show piece for each material
-	auto material1 = make_shared<dielectric>(1.5);
-	world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-	auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-	world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-	auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-	world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-	return world;
-}
-
-int main() {
-	
-	///////////////// World /////////////////
-	auto world = random_scene();
-	//auto R = cos(pi / 4);
-	//hittable_list world; // all objects that rays can interact with in the scene (visible stuff)
+	if ((has_meshes || has_instances) && (!settings.save_scene_path.empty() || !settings.save_cache_path.empty())) {
+		std::cerr << "--save-scene and --save-cache only do spheres so far, and this scene has meshes or instances\n";
+		return 1;
+	}
+	if (!settings.save_scene_path.empty())
+		return save_scene_file(settings.save_scene_path, world_scene, world) ? 0 : 1;
+	if (!settings.save_cache_path.empty())
+		return save_scene_cache(settings.save_cache_path, world_scene, world) ? 0 : 1;
 
-	////auto material_left   = make_shared<lambertian>(color(1, 0, 0));
-	////auto material_right = make_shared<lambertian>(color(0, 0, 1));
-	////auto material_center = make_shared<lambertian>(color(0.7, 0.3, 0.3));
-	////auto material_left = make_shared<metal>(color(0.8, 0.8, 0.8), 0.3);
-	//auto material_left = make_shared<dielectric>(1.5);
-	//auto material_right = make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
-	//auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-	//auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
+	///////////////// Camera /////////////////
+	// (lookfrom, lookat, vup, fov, aperture and focus distance: see camera_setup in scene.h)
+	camera cam = world_scene.view.make_camera();
 
-	////world.add(make_shared<sphere>(point3(-R, 0, -1), R, material_left)); // R to the left, 1 unit away from camera (with rad=R, that should fill the whole screen vertically)
-	////world.add(make_shared<sphere>(point3(R, 0, -1), R, material_right));
-	//world.add(make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
-	//world.add(make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
-	//world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
-	//world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.4, material_left));
-	//world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
+	///////////////// Render /////////////////
+	auto trace_tile = [&](const tile& t, const render_settings& settings, framebuffer& image) {
+		if (settings.integrator == integrator_type::wavefront)
+			render_tile_wavefront(t, cam, traced, materials, lights, settings, image);
+		else if (settings.packets && !has_meshes && !has_instances) // (packets only know how to trace a sphere_set)
+			render_tile_packets(t, cam, world, materials, lights, settings, shade, image);
+		else
+			render_tile(t, cam, traced, materials, lights, settings, ray_color, image);
+	};
+
+	// Checkpoints (progressive.h) only resume the same scene and camera. Not the same spp, though:
+	// resuming with a bigger one adds samples to a finished image.
+	render_settings any_spp = settings;
+	any_spp.samples_per_pixel = 0;
+	settings.scene_fingerprint = render_fingerprint(any_spp, world_scene.view, world_scene.sky, traced, world.size() + triangles + instances->size(), materials.size());
+
+#if RT_HAS_SOCKETS
+	// Distributed (distributed.h): workers render tiles for a coordinator, which only puts the image together
+	uint64_t fingerprint = render_fingerprint(settings, world_scene.view, world_scene.sky, traced, world.size() + triangles + instances->size(), materials.size());
+	auto run_tile_worker = [&](const std::string& address, const render_settings& worker_settings) {
+		render_pool worker_pool(render_thread_count(worker_settings));
+		return run_worker(worker_pool, address, worker_settings, fingerprint,
+			[&](const tile& t, framebuffer& image) { trace_tile(t, worker_settings, image); });
+	};
+	if (!settings.worker_address.empty())
+		return run_tile_worker(settings.worker_address, settings) ? 0 : 1;
+	render_coordinator coordinator(settings, fingerprint);
+	if (!settings.listen_address.empty()) {
+		// (before any render threads exist - fork only copies the thread that calls it)
+		render_settings local = settings;
+		if (local.threads == 0)
+			local.threads = std::max(1, int(std::thread::hardware_concurrency()) / std::max(1, settings.spawn_workers));
+		if (!coordinator.listen(settings.listen_address)
+			|| !coordinator.spawn_workers(settings.spawn_workers, [&](const std::string& address) { return run_tile_worker(address, local); }))
+			return 1;
+	}
+#endif
 
-	///////////////// Image /////////////////
-	const auto aspect_ratio = 16.0 / 9.0;
-	const int image_width = 1200;
-	const int image_height = static_cast<int>(image_width / aspect_ratio);
-	const int samples_per_pixel = 1000;
-	const int max_depth = 50;
+	// The render threads get started once, and sit waiting between renders (progressive passes, sequence frames)
+	render_pool pool(settings.listen_address.empty() ? render_thread_count(settings) : 1); // (a coordinator doesn't render)
+	auto render_image = [&](const render_settings& settings, framebuffer& image) {
+		render(pool, settings, [&](const tile& t) { trace_tile(t, settings, image); });
+	};
 
-	///////////////// Camera /////////////////
-	point3 lookfrom(13, 2, 3);
-	point3 lookat(0, 0, 0);
-	vec3 vup = vec3(0, 1, 0); // (0,1,0) is world up
-	double fov_deg = 20;
-	auto dist_to_focus = 10; // (lookfrom - lookat).length(); // Move inside the function?
-	auto aperture = 0.1; // 1 would be perfect focus?
-	camera cam(lookfrom, lookat, vup, fov_deg, aspect_ratio, aperture, dist_to_focus);
+	if (settings.noise_report > 0) {
+		noise_report(settings, render_image, std::cout);
+		return 0;
+	}
 
-	///////////////// Render /////////////////
-	clock_t tStart = clock();
-	std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+	if (settings.sequence_frames > 0) {
+		std::chrono::duration<double> setup_time = std::chrono::steady_clock::now() - tStart;
+		// (spheres and instances move from frame to frame, and any lights among the spheres with them)
+		auto render_frame = [&](const render_settings& settings, framebuffer& image) {
+			lights = collect_lights(world, world_scene.meshes, materials, world_scene.sky);
+			render_image(settings, image);
+		};
+		return render_sequence(settings, world_scene.view, cam, world, *instances, setup_time.count(), render_frame) ? 0 : 1;
+	}
 
-	// Loop through all pixels in the image
-	for (int j = image_height - 1; j >= 0; --j) {
-		std::cerr << "\r (Time Taken: " << (double)(clock() - tStart) / CLOCKS_PER_SEC << ") Scanlines remaining: " << j  << " of " << image_height << " " << std::flush;
-		for (int i = 0; i < image_width; ++i) {
-			color pixel_color(0, 0, 0);
-			for (int s = 0; s < samples_per_pixel; ++s) {
-				// technically, adding the random_double is just a blur effect...
-				// It just happens to be a sub-pixel blur, which counter-acts aliasing
-				auto v = (j + random_double()) / (image_height - 1.);
-				auto u = (i + random_double()) / (image_width - 1.);
-				ray r = cam.get_ray(u, v);
-				pixel_color += ray_color(r, world, max_depth);
-			}
-			write_color(std::cout, pixel_color, samples_per_pixel); // disabling for profiling (something is slowing me down)
+	if (!settings.preview_path.empty()) {
+		// (a scene cache has no camera lines to follow)
+		std::string watched = scene_path && !is_scene_cache(scene_path) ? scene_path : "";
+		return run_preview(settings, world_scene.view, watched, cam, render_image) ? 0 : 1;
+	}
 
-			//// Alternate sampling approach - interpolated, rather than random...arguably yields
-			//// better results for lower samples_per_pixel...neglable difference really, but 
-			//// I kind of like removing randomness in this case - personal preference
-			//int sqrt_samples = (int)sqrt(samples_per_pixel);
-			//int samples_per_pixel_perfect_square = sqrt_samples * sqrt_samples;
-			//for (int s = 0; s < sqrt_samples; ++s) {
-			//	for (int t = 0; t < sqrt_samples; ++t) {
-			//		auto v = (j + s / sqrt(samples_per_pixel)) / (image_height - 1.);
-			//		auto u = (i + t / sqrt(samples_per_pixel)) / (image_width - 1.);
-			//		ray r = cam.get_ray(u, v);
-			//		pixel_color += ray_color(r, world, max_depth);
-			//	}
-			//}
-			//write_color(std::cout, pixel_color, samples_per_pixel_perfect_square);
-		}
+	tStart = std::chrono::steady_clock::now();
+	framebuffer image(settings.image_width, settings.image_height);
+	if (settings.denoise || !settings.aov_path.empty())
+		image.enable_aovs();
+	if (!settings.resume_path.empty() && !load_checkpoint(settings.resume_path, settings, image))
+		return 1;
+	if (settings.progressive) {
+		if (!render_progressive(settings, image, render_image))
+			return 1;
+	}
+#if RT_HAS_SOCKETS
+	else if (!settings.listen_address.empty()) {
+		if (!coordinator.render(image))
+			return 1;
+	}
+#endif
+	else {
+		render_image(settings, image);
+	}
+	if (!settings.aov_path.empty() && !write_aov_images(settings.aov_path, image))
+		return 1;
+	if (settings.denoise) {
+		auto tDenoise = std::chrono::steady_clock::now();
+		image = denoise(image, settings.threads);
+		std::chrono::duration<double> denoise_time = std::chrono::steady_clock::now() - tDenoise;
+		if (settings.progress)
+			std::cerr << "\nDenoised in " << 1000 * denoise_time.count() << " ms";
 	}
-	std::cerr << "\nRender Completed in: \n" << (double)(clock() - tStart) / CLOCKS_PER_SEC << "seconds.";
+	// same seed -> bit-identical image, regardless of thread count
+	image_format format;
+	choose_image_format(settings.output_path, settings.output_format, format); // already checked by parse_options
+	std::string bytes = encode_image(image, format);
+	if (settings.output_path.empty())
+		write_stdout(bytes);
+	else if (!write_file(settings.output_path, bytes))
+		return 1;
+
+	if (!settings.heatmap_path.empty()) {
+		image_format_from_path(settings.heatmap_path, format);
+		write_file(settings.heatmap_path, encode_image(sample_heatmap(image, settings.samples_per_pixel), format));
+	}
+	if (!settings.stats_path.empty())
+		write_file(settings.stats_path, stats_json(total_stats<render_stats>(), total_path_stats().totals()));
+	if (!settings.tile_heatmap_path.empty()) {
+		image_format_from_path(settings.tile_heatmap_path, format);
+		auto cost = tile_cost_per_pixel(total_stats<render_stats>(), settings.image_width, settings.image_height);
+		write_file(settings.tile_heatmap_path, encode_image(heatmap_image(cost, settings.image_width, settings.image_height), format));
+	}
+	if (settings.path_stats) {
+		std::cerr << "\n";
+		total_path_stats().print(std::cerr);
+	}
+	if (settings.adaptive) {
+		double average = double(image.total_samples()) / (double(settings.image_width) * settings.image_height);
+		std::cerr << "\nAdaptive sampling: " << average << " spp on average ("
+			<< 100 * average / settings.samples_per_pixel << "% of " << settings.samples_per_pixel << ")";
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - tStart;
+	std::cerr << "\nRender Completed in: \n" << elapsed.count() << "seconds.";
 }
 
 // Ctrl+shft+B to compile solution
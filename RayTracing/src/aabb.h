@@ -0,0 +1,94 @@
+#pragma once
+
+#include "rtweekend.h"
+#include "ray.h"
+
+#include <utility>
+
+// Axis-Aligned Bounding Box
+// The box is just 3 pairs of planes (slabs), one pair per axis. A ray is inside the box
+// wherever it's inside all 3 slabs at the same time, so we clip [t_min, t_max] against
+// each slab in turn. If the interval ever goes empty, we've missed.
+class aabb {
+public:
+	// Starts out "inside-out" (min = +inf, max = -inf), so that expanding it by anything just works
+	aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+	aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+	point3 min() const { return minimum; }
+	point3 max() const { return maximum; }
+	point3 centroid() const { return real(0.5) * (minimum + maximum); }
+
+	// Plain compares rather than std::fmin/fmax: those have to handle NaNs, which stops them
+	// compiling down to one min/max instruction, and the BVH builder does a LOT of these.
+	// (A NaN coming in still gets ignored, same as fmin - the compare is false, so we keep ours.)
+	void expand(const aabb& box) {
+		for (int a = 0; a < 3; ++a) {
+			minimum[a] = box.minimum[a] < minimum[a] ? box.minimum[a] : minimum[a];
+			maximum[a] = box.maximum[a] > maximum[a] ? box.maximum[a] : maximum[a];
+		}
+	}
+
+	void expand(const point3& p) {
+		for (int a = 0; a < 3; ++a) {
+			minimum[a] = p[a] < minimum[a] ? p[a] : minimum[a];
+			maximum[a] = p[a] > maximum[a] ? p[a] : maximum[a];
+		}
+	}
+
+	// Used by the surface area heuristic - the odds of a random ray hitting a convex
+	// object are proportional to its surface area
+	// (in double whatever real is, since the builder adds up a lot of these)
+	double surface_area() const {
+		double dx = double(maximum.x()) - double(minimum.x());
+		double dy = double(maximum.y()) - double(minimum.y());
+		double dz = double(maximum.z()) - double(minimum.z());
+		if (dx < 0) // empty box
+			return 0;
+		return 2 * (dx * dy + dy * dz + dz * dx);
+	}
+
+	int longest_axis() const {
+		vec3 d = maximum - minimum;
+		if (d.x() > d.y() && d.x() > d.z()) return 0;
+		return d.y() > d.z() ? 1 : 2;
+	}
+
+	// inv_dir is 1/direction, precomputed once per ray (division is slow, and we test a LOT of boxes)
+	// Division by 0 gives +/-infinity, which the min/max logic handles correctly.
+	// t_enter is where the ray enters the box, which lets traversal visit the nearer box first
+	// The exit gets pushed out by a few ulps (Ize, "Robust BVH Ray Traversal", JCGT 2013): each
+	// slab's t is rounded, so a ray that only just grazes the box - like one through a triangle's
+	// vertex, which sits right on its leaf's box - could miss it, and go through a closed mesh.
+	bool hit(const point3& origin, const vec3& inv_dir, real t_min, real t_max, real& t_enter) const {
+		const real exit_slack = 1 + 4 * std::numeric_limits<real>::epsilon();
+		for (int a = 0; a < 3; ++a) {
+			auto t0 = (minimum[a] - origin[a]) * inv_dir[a];
+			auto t1 = (maximum[a] - origin[a]) * inv_dir[a];
+			if (inv_dir[a] < 0)
+				std::swap(t0, t1);
+			t1 *= exit_slack;
+			t_min = t0 > t_min ? t0 : t_min;
+			t_max = t1 < t_max ? t1 : t_max;
+			if (t_max < t_min)
+				return false;
+		}
+		t_enter = t_min;
+		return true;
+	}
+
+	bool hit(const ray& r, real t_min, real t_max) const {
+		vec3 d = r.direction();
+		real t_enter;
+		return hit(r.origin(), vec3(1 / d.x(), 1 / d.y(), 1 / d.z()), t_min, t_max, t_enter);
+	}
+
+public:
+	point3 minimum;
+	point3 maximum;
+};
+
+inline aabb surrounding_box(aabb box0, const aabb& box1) {
+	box0.expand(box1);
+	return box0;
+}
@@ -0,0 +1,487 @@
+/******************************************************************************
+Trevor's thoughts:
+hittable_list::hit tests every object for every ray, so each bounce is O(N).
+A Bounding Volume Hierarchy (BVH) wraps groups of objects in boxes, and boxes
+in bigger boxes. If a ray misses a box, we get to skip everything inside it,
+which gets us to ~O(log N) tests per ray.
+
+How we split each group matters a lot. The Surface Area Heuristic (SAH) says the
+chance of a ray hitting a box is proportional to its surface area, so the expected
+cost of a split is:
+	cost = C_traversal + (SA(left)*N_left + SA(right)*N_right) / SA(parent)
+We drop the centroids into a handful of bins along each axis, and try every
+boundary between bins (binned SAH - nearly as good as trying every object, and way cheaper).
+
+The tree is flattened into one array of nodes (depth-first order):
+	- The first child of an interior node is always the very next node
+	- `offset` holds the index of the second child (interior) or first primitive (leaf)
+Traversal uses a small fixed stack instead of recursion, always visits the nearer
+child first, and skips any node that starts beyond the closest hit found so far.
+Shadow rays only need to know if there's anything in the way at all, so they get
+their own walk (any_hit_bvh) that doesn't bother ordering the children, and quits
+at the first leaf that reports a hit.
+
+The builder/traversal pieces are generic (they just see boxes and index ranges),
+so anything that can hand over a list of boxes can sit on top of them.
+Big builds (millions of primitives) can use several threads: the two halves of a
+node don't share anything, so near the top of the tree each half gets its own
+thread and its own node array, and the arrays get stitched back together in the
+usual depth-first order afterwards.
+
+When the primitives move a little (eg: an animation frame), the tree doesn't have
+to be rebuilt: refit_bvh keeps every node's primitives and just recomputes the
+boxes, leaves first and then each parent from its two children. That's way
+cheaper than a build, but the splits were picked for where things *were*, so the
+tree slowly gets worse. bvh_sah_cost puts a number on how much worse, so the
+caller can decide when it's time for a real rebuild.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "parallel.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+struct bvh_node {
+	aabb box;
+	uint32_t offset; // interior: index of the second child; leaf: index of the first primitive
+	uint16_t count;  // number of primitives in a leaf (0 -> interior node)
+	uint16_t axis;   // axis we split on
+};
+
+// What the builder needs from the primitives: how many there are, and each one's box.
+// This one is for a plain list of boxes; sphere_set hands over its spheres directly (sphere_bounds),
+// so building over millions of them doesn't need a copy of every box.
+struct box_list {
+	box_list(const std::vector<aabb>& boxes) : boxes(&boxes) {}
+
+	size_t size() const { return boxes->size(); }
+	const aabb& box(uint32_t k) const { return (*boxes)[k]; }
+
+	const std::vector<aabb>* boxes;
+};
+
+template <typename Primitives>
+class basic_bvh_builder {
+public:
+	// primitives: one bounding box per primitive (see box_list)
+	// order (output): primitive indices, rearranged so each leaf covers the range [offset, offset+count)
+	// primitive_cost: cost of one intersection test relative to one traversal step. Leaves that get
+	// tested several primitives at a time with SIMD are cheaper per primitive, so they pass in less.
+	basic_bvh_builder(const Primitives& primitives, int max_leaf_size = 4, double primitive_cost = 1.0)
+		: primitives(primitives), max_leaf_size(max_leaf_size), primitive_cost(primitive_cost) {}
+
+	// threads > 1 builds the top of the tree in parallel. The tree comes out exactly the same either way.
+	void build(std::vector<bvh_node>& nodes, std::vector<uint32_t>& order, int threads = 1) {
+		nodes.clear();
+		order.resize(primitives.size());
+		for (size_t k = 0; k < order.size(); ++k)
+			order[k] = uint32_t(k);
+
+		if (!order.empty()) {
+			scratch.resize(order.size());
+			nodes.reserve(2 * order.size() / std::max(1, max_leaf_size) + 1);
+			build_parallel(nodes, order, 0, uint32_t(order.size()), 0, threads);
+			std::vector<uint32_t>().swap(scratch);
+		}
+	}
+
+private:
+	static const int num_bins = 16;
+	// Past this depth we stop trusting SAH and just split in half, so the tree
+	// can never get deeper than the traversal stack (see max_bvh_depth)
+	static const int max_sah_depth = 32;
+	// Smaller than this, a subtree isn't worth starting a thread for
+	static const uint32_t min_parallel_primitives = 1 << 14;
+
+	uint32_t build_recursive(
+		std::vector<bvh_node>& nodes, std::vector<uint32_t>& order, uint32_t begin, uint32_t end, int depth
+	) {
+		uint32_t index = uint32_t(nodes.size());
+		nodes.push_back(bvh_node());
+		uint32_t mid;
+		if (!split(nodes[index], order, begin, end, depth, mid))
+			return index;
+
+		build_recursive(nodes, order, begin, mid, depth + 1); // first child lands at index + 1
+		uint32_t second = build_recursive(nodes, order, mid, end, depth + 1);
+		nodes[index].offset = second; // (don't hold a reference to nodes[index] - push_back may move it)
+		return index;
+	}
+
+	// Same tree as build_recursive, but the two halves of a node get built at the same time (each
+	// with half of the threads), into arrays of their own. Then they're copied in one after the
+	// other, which puts every node exactly where build_recursive would have.
+	void build_parallel(
+		std::vector<bvh_node>& nodes, std::vector<uint32_t>& order, uint32_t begin, uint32_t end, int depth, int threads
+	) {
+		if (threads <= 1 || end - begin < min_parallel_primitives) {
+			build_recursive(nodes, order, begin, end, depth);
+			return;
+		}
+
+		uint32_t index = uint32_t(nodes.size());
+		nodes.push_back(bvh_node());
+		uint32_t mid;
+		if (!split(nodes[index], order, begin, end, depth, mid))
+			return;
+
+		// The halves only touch their own ranges of order, so they can't get in each other's way
+		std::vector<bvh_node> left, right;
+		std::thread left_builder([&] { build_parallel(left, order, begin, mid, depth + 1, threads / 2); });
+		build_parallel(right, order, mid, end, depth + 1, threads - threads / 2);
+		left_builder.join();
+
+		append_subtree(nodes, left);
+		nodes[index].offset = uint32_t(nodes.size());
+		append_subtree(nodes, right);
+	}
+
+	// A subtree's child indices count from the start of its own array, so they move along with it
+	static void append_subtree(std::vector<bvh_node>& nodes, std::vector<bvh_node>& subtree) {
+		uint32_t base = uint32_t(nodes.size());
+		for (bvh_node& node : subtree) {
+			if (node.count == 0)
+				node.offset += base;
+		}
+		nodes.insert(nodes.end(), subtree.begin(), subtree.end());
+		std::vector<bvh_node>().swap(subtree); // done with it
+	}
+
+	// Fills in node's box, then either makes it a leaf for [begin, end) (returns false), or picks its
+	// split and partitions order so the children are [begin, mid) and [mid, end) (returns true)
+	bool split(bvh_node& node, std::vector<uint32_t>& order, uint32_t begin, uint32_t end, int depth, uint32_t& mid) {
+		aabb bounds, centroid_bounds;
+		for (uint32_t k = begin; k < end; ++k) {
+			aabb box = primitives.box(order[k]);
+			bounds.expand(box);
+			centroid_bounds.expand(box.centroid());
+		}
+		node.box = bounds;
+
+		uint32_t count = end - begin;
+		int axis = centroid_bounds.longest_axis();
+		mid = begin + count / 2;
+
+		if (count == 1)
+			return make_leaf(node, begin, count);
+
+		auto by_centroid = [&](uint32_t a, uint32_t b) {
+			return primitives.box(a).centroid()[axis] < primitives.box(b).centroid()[axis];
+		};
+		real extent = centroid_bounds.max()[axis] - centroid_bounds.min()[axis];
+		if (extent <= 0 || depth >= max_sah_depth) {
+			// Every centroid is in the same spot (so nothing to split on), or we're too deep
+			if (count <= uint32_t(max_leaf_size))
+				return make_leaf(node, begin, count);
+			std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, by_centroid);
+		}
+		else {
+			int split_bin;
+			double split_cost = best_split(order, begin, end, axis, centroid_bounds, split_bin);
+
+			// Normalized so that one traversal step costs 1
+			double leaf_cost = primitive_cost * count;
+			split_cost = 1 + primitive_cost * split_cost / bounds.surface_area();
+			if (count <= uint32_t(max_leaf_size) && leaf_cost <= split_cost)
+				return make_leaf(node, begin, count);
+
+			// A stable partition: each child keeps its primitives in the order they were in, so every
+			// pass over them (all the way down) reads through the primitives front to back, rather
+			// than jumping around. With millions of primitives, that's most of the build time.
+			// The right side waits in scratch, over the same range.
+			real lo = centroid_bounds.min()[axis];
+			mid = begin;
+			uint32_t right = begin;
+			for (uint32_t k = begin; k < end; ++k) {
+				uint32_t p = order[k];
+				if (bin_of(primitives.box(p).centroid()[axis], lo, extent) <= split_bin)
+					order[mid++] = p;
+				else
+					scratch[right++] = p;
+			}
+			std::copy(scratch.begin() + begin, scratch.begin() + right, order.begin() + mid);
+
+			if (mid == begin || mid == end) { // Binning couldn't separate them
+				mid = begin + count / 2;
+				std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, by_centroid);
+			}
+		}
+
+		node.axis = uint16_t(axis);
+		node.count = 0;
+		return true;
+	}
+
+	static bool make_leaf(bvh_node& node, uint32_t begin, uint32_t count) {
+		node.offset = begin;
+		node.count = uint16_t(count);
+		node.axis = 0;
+		return false;
+	}
+
+	static int bin_of(real c, real lo, real extent) {
+		int b = int(num_bins * (c - lo) / extent);
+		return b < num_bins ? b : num_bins - 1;
+	}
+
+	// Returns the un-normalized SAH cost (SA(left)*N_left + SA(right)*N_right) of the best
+	// split along `axis`. Objects in bins [0, split_bin] go left.
+	double best_split(
+		const std::vector<uint32_t>& order, uint32_t begin, uint32_t end, int axis,
+		const aabb& centroid_bounds, int& split_bin
+	) const {
+		aabb bin_boxes[num_bins];
+		uint32_t bin_counts[num_bins] = {};
+		real lo = centroid_bounds.min()[axis];
+		real extent = centroid_bounds.max()[axis] - lo;
+		for (uint32_t k = begin; k < end; ++k) {
+			aabb box = primitives.box(order[k]);
+			int b = bin_of(box.centroid()[axis], lo, extent);
+			bin_boxes[b].expand(box);
+			++bin_counts[b];
+		}
+
+		// Sweep from the right, storing the cost of everything right of each boundary,
+		// then sweep from the left and combine
+		double right_cost[num_bins];
+		aabb right_box;
+		uint32_t right_count = 0;
+		for (int b = num_bins - 1; b > 0; --b) {
+			right_box.expand(bin_boxes[b]);
+			right_count += bin_counts[b];
+			right_cost[b - 1] = right_box.surface_area() * right_count;
+		}
+
+		double best = std::numeric_limits<double>::infinity();
+		split_bin = 0;
+		aabb left_box;
+		uint32_t left_count = 0;
+		for (int b = 0; b < num_bins - 1; ++b) {
+			left_box.expand(bin_boxes[b]);
+			left_count += bin_counts[b];
+			double cost = left_box.surface_area() * left_count + right_cost[b];
+			if (left_count > 0 && left_count < end - begin && cost < best) {
+				best = cost;
+				split_bin = b;
+			}
+		}
+		return best;
+	}
+
+private:
+	Primitives primitives;
+	std::vector<uint32_t> scratch; // for partitioning (threads each use their own range of it)
+	int max_leaf_size;
+	double primitive_cost;
+};
+
+using bvh_builder = basic_bvh_builder<box_list>;
+
+// Fixed traversal stack size - the builder switches to median splits deep in the tree,
+// so we can't get anywhere near this
+const int max_bvh_depth = 64;
+
+// Walks the tree, calling leaf(first, count, t_max) for each leaf the ray reaches.
+// The leaf callback returns true if it found a hit, and is expected to shrink t_max to the
+// closest hit (which lets us skip every node further away than that).
+template <typename Leaf>
+inline bool traverse_bvh(const bvh_node* nodes, const ray& r, real t_min, real& t_max, Leaf&& leaf) {
+	point3 origin = r.origin();
+	vec3 d = r.direction();
+	vec3 inv_dir(1 / d.x(), 1 / d.y(), 1 / d.z());
+
+	struct entry {
+		uint32_t index;
+		real t_enter;
+	};
+	entry stack[max_bvh_depth];
+	int sp = 0;
+
+	real t_enter;
+	if (!nodes[0].box.hit(origin, inv_dir, t_min, t_max, t_enter))
+		return false;
+
+	bool hit_anything = false;
+	uint32_t index = 0;
+	while (true) {
+		const bvh_node& node = nodes[index];
+		RT_COUNT(bvh_nodes);
+		if (node.count > 0) {
+			if (leaf(node.offset, uint32_t(node.count), t_max))
+				hit_anything = true;
+		}
+		else {
+			uint32_t near_child = index + 1;
+			uint32_t far_child = node.offset;
+			real t_near, t_far;
+			bool hit_near = nodes[near_child].box.hit(origin, inv_dir, t_min, t_max, t_near);
+			bool hit_far = nodes[far_child].box.hit(origin, inv_dir, t_min, t_max, t_far);
+			if (hit_near && hit_far) {
+				if (t_far < t_near) {
+					std::swap(near_child, far_child);
+					std::swap(t_near, t_far);
+				}
+				stack[sp++] = { far_child, t_far };
+				index = near_child;
+				continue;
+			}
+			if (hit_near || hit_far) {
+				index = hit_near ? near_child : far_child;
+				continue;
+			}
+		}
+
+		// Pop the next node, skipping any that start beyond the closest hit we've found since pushing it
+		do {
+			if (sp == 0)
+				return hit_anything;
+			--sp;
+		} while (stack[sp].t_enter > t_max);
+		index = stack[sp].index;
+	}
+}
+
+// Walks the tree until leaf(first, count) returns true (= something in that leaf is in [t_min, t_max]).
+// Any hit will do, so children are visited in stored order, and nothing shrinks t_max.
+template <typename Leaf>
+inline bool any_hit_bvh(const bvh_node* nodes, const ray& r, real t_min, real t_max, Leaf&& leaf) {
+	point3 origin = r.origin();
+	vec3 d = r.direction();
+	vec3 inv_dir(1 / d.x(), 1 / d.y(), 1 / d.z());
+
+	uint32_t stack[max_bvh_depth];
+	int sp = 0;
+	stack[sp++] = 0;
+	while (sp > 0) {
+		const bvh_node& node = nodes[stack[--sp]];
+		RT_COUNT(bvh_nodes);
+		real t_enter;
+		if (!node.box.hit(origin, inv_dir, t_min, t_max, t_enter))
+			continue;
+		if (node.count > 0) {
+			if (leaf(node.offset, uint32_t(node.count)))
+				return true;
+		}
+		else {
+			stack[sp++] = node.offset;
+			stack[sp++] = uint32_t(&node - nodes) + 1;
+		}
+	}
+	return false;
+}
+
+// Recomputes every box in the tree for primitives that have moved, without changing its shape.
+// primitives.box(k) has to be in leaf order, ie: what was order[k] at build time (sphere_set
+// sorts its arrays that way, so it can just pass them in). threads: for the leaves.
+template <typename Primitives>
+inline void refit_bvh(bvh_node* nodes, size_t num_nodes, const Primitives& primitives, int threads = 1) {
+	parallel_for(num_nodes, threads, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; ++k) {
+			bvh_node& node = nodes[k];
+			if (node.count == 0)
+				continue;
+			aabb box;
+			for (uint32_t p = node.offset; p < node.offset + node.count; ++p)
+				box.expand(primitives.box(p));
+			node.box = box;
+		}
+	});
+
+	// Children always come after their parent, so walking backwards sees them first
+	for (size_t k = num_nodes; k-- > 0; ) {
+		bvh_node& node = nodes[k];
+		if (node.count == 0)
+			node.box = surrounding_box(nodes[k + 1].box, nodes[node.offset].box);
+	}
+}
+
+// The SAH cost of the whole tree (same units as the builder's: one traversal step = 1): how many
+// steps and primitive tests an average ray that hits the root box would cost. Comparing it to the
+// cost right after a build shows how much a refit tree has degraded.
+inline double bvh_sah_cost(const bvh_node* nodes, size_t num_nodes, double primitive_cost = 1.0) {
+	if (num_nodes == 0 || nodes[0].box.surface_area() <= 0)
+		return 0;
+	double cost = 0;
+	for (size_t k = 0; k < num_nodes; ++k) {
+		const bvh_node& node = nodes[k];
+		cost += node.box.surface_area() * (node.count > 0 ? primitive_cost * node.count : 1.0);
+	}
+	return cost / nodes[0].box.surface_area();
+}
+
+// Drop-in replacement for a hittable_list: bvh world(random_scene(seed).objects);
+class bvh : public hittable {
+public:
+	bvh() {}
+	bvh(const hittable_list& list, int max_leaf_size = 4) {
+		std::vector<aabb> boxes(list.objects.size());
+		for (size_t k = 0; k < boxes.size(); ++k) {
+			if (!list.objects[k]->bounding_box(boxes[k]))
+				std::cerr << "No bounding box in bvh constructor.\n";
+		}
+
+		std::vector<uint32_t> order;
+		bvh_builder(boxes, max_leaf_size).build(nodes, order);
+
+		// Store the objects in leaf order, so each leaf is a contiguous run
+		objects.reserve(order.size());
+		for (auto k : order)
+			objects.push_back(list.objects[k]);
+	}
+
+	virtual bool intersect(const ray& r, real t_min, ray_hit& hit) const override;
+
+	virtual void fill_hit_record(const ray& r, const ray_hit& hit, hit_record& rec) const override {
+		hit.object->fill_hit_record(r, hit, rec); // (hit.object is the leaf that found it)
+	}
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		if (nodes.empty())
+			return false;
+		output_box = nodes[0].box;
+		return true;
+	}
+
+public:
+	std::vector<bvh_node> nodes;
+	std::vector<shared_ptr<hittable>> objects;
+};
+
+bool bvh::intersect(const ray& r, real t_min, ray_hit& hit) const {
+	if (nodes.empty())
+		return false;
+
+	// closest_so_far is hit.t itself, so every closer hit a leaf finds shrinks the traversal too
+	return traverse_bvh(nodes.data(), r, t_min, hit.t, [&](uint32_t first, uint32_t count, real&) {
+		bool hit_anything = false;
+		for (uint32_t k = first; k < first + count; ++k) {
+			if (objects[k]->intersect(r, t_min, hit))
+				hit_anything = true;
+		}
+		return hit_anything;
+	});
+}
+
+bool bvh::occluded(const ray& r, real t_min, real t_max) const {
+	if (nodes.empty())
+		return false;
+
+	return any_hit_bvh(nodes.data(), r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+		for (uint32_t k = first; k < first + count; ++k) {
+			if (objects[k]->occluded(r, t_min, t_max))
+				return true;
+		}
+		return false;
+	});
+}
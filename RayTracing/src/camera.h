@@ -1,6 +1,8 @@
 #pragma once
 
 #include "rtweekend.h"
+#include "ray.h"
+#include "sampler.h"
 
 class camera {
 public:
@@ -38,8 +40,8 @@ public:
 		lens_radius = aperture / 2;
 	}
 
-	ray get_ray(double i, double j) const {
-		vec3 rd = lens_radius * random_in_unit_disk();
+	ray get_ray(real i, real j, sampler& gen) const {
+		vec3 rd = lens_radius * sample_unit_disk(gen.get_2d());
 		vec3 offset = u * rd.x() + v * rd.y();
 
 		return ray(
@@ -53,5 +55,5 @@ private:
 	vec3 horizontal;
 	vec3 vertical;
 	vec3 u, v, w;
-	double lens_radius;
+	real lens_radius;
 };
\ No newline at end of file
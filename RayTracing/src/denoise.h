@@ -0,0 +1,263 @@
+/******************************************************************************
+Trevor's thoughts:
+Way back in integrator.h I wondered why we don't take fewer samples, record
+what each pixel hit first as a mask, and smooth within it. This is that idea,
+done properly. The tracer records what every camera ray hit first (AOVs: the
+material's albedo, the normal, the distance, and which object it was - see
+aov_sample in framebuffer.h), in the same pass as the colors. Then, once the
+render is done, an edge-avoiding a-trous filter (Dammertz et al. 2010, with the
+weights from SVGF - Schied et al. 2017) blurs the noise away without blurring
+across edges:
+	- Each pass is a 5x5 blur, but the taps are spread 1, 2, 4, ... pixels
+	  apart ("a trous" = with holes), so 3 passes cover 29x29 pixels for the
+	  price of 75 taps per pixel.
+	- A tap only counts if it's the same object, faces the same way (normals),
+	  is at about the same depth (allowing for how fast the depth changes
+	  there), has the same albedo, and isn't too far off in brightness. "Too
+	  far" is measured in standard deviations of the pixel's own noise (from the
+	  luminance^2 AOV), so noisy pixels get smoothed a lot and clean ones hardly
+	  at all. The variance gets filtered right along with the colors, so each
+	  pass is less forgiving than the last.
+	- The filter works on the lighting, not the colors: the pixel's color is
+	  divided by its albedo first, and multiplied back afterwards. So the
+	  surface colors (and their edges) stay as sharp as the AOVs are, and only
+	  the lighting gets smoothed.
+Every pixel only reads the previous pass's buffers, so the rows can be split
+across threads, and the result doesn't depend on how many there are.
+
+The defaults are tuned on the random scene (300 wide, against a 1024 spp
+render): RMS error goes 0.050 -> 0.035 at 4 spp, 0.032 -> 0.024 at 8, and
+0.021 -> 0.017 at 16. So about what 1.5-2x the samples would get you. By 64
+spp the sobol sampler leaves so little noise that it's a wash: what's left is
+mostly the fuzzy reflections in the metal spheres, and to the filter those
+look like lighting. (More passes, or a bigger sigma_luminance, start blurring
+them - SVGF's 5 passes and 4 are for 1 spp.)
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "framebuffer.h"
+#include "image_io.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct denoise_settings {
+	int passes = 3;             // tap spacing doubles every pass: 1, 2, 4, ...
+	float sigma_luminance = 2;  // standard deviations of noise a tap's brightness can be off by
+	float sigma_depth = 1;      // depth differences, relative to how fast the depth changes there
+	float normal_power = 128;   // (n_p . n_q)^this
+	float sigma_albedo = 0.1f;  // albedo differences
+};
+
+class denoiser {
+public:
+	denoiser(const framebuffer& image, const denoise_settings& settings)
+		: settings(settings), width(image.width), height(image.height) {
+		size_t pixels = size_t(width) * height;
+		albedo.resize(3 * pixels);
+		normal.resize(3 * pixels);
+		depth.resize(pixels);
+		depth_slope.resize(pixels);
+		object.assign(image.object_ids.begin(), image.object_ids.end());
+		lighting.resize(3 * pixels);
+		variance.resize(pixels);
+
+		// Averages, and the lighting = color / albedo
+		for (size_t k = 0; k < pixels; ++k) {
+			int n = image.sample_counts[k];
+			float inv_n = n > 0 ? 1.0f / float(n) : 0.0f;
+			float length_sq = 0;
+			for (int c = 0; c < 3; ++c) {
+				albedo[3 * k + c] = std::max(image.albedo_sum[3 * k + c] * inv_n, min_albedo);
+				normal[3 * k + c] = image.normal_sum[3 * k + c] * inv_n;
+				length_sq += normal[3 * k + c] * normal[3 * k + c];
+				lighting[3 * k + c] = image.accum[3 * k + c] * inv_n / albedo[3 * k + c];
+			}
+			if (length_sq > 0) {
+				float inv_length = 1 / std::sqrt(length_sq);
+				for (int c = 0; c < 3; ++c)
+					normal[3 * k + c] *= inv_length;
+			}
+			depth[k] = image.depth_sum[k] * inv_n;
+
+			// The variance of the pixel's mean: (E[l^2] - E[l]^2) / n, then scaled the way dividing by
+			// the albedo scales the lighting
+			float mean = luminance(&image.accum[3 * k]) * inv_n;
+			float sample_variance = std::max(image.luminance_sq_sum[k] * inv_n - mean * mean, 0.0f);
+			float a = luminance(&albedo[3 * k]);
+			variance[k] = n > 0 ? sample_variance * inv_n / (a * a) : 0.0f;
+		}
+
+		// How fast the depth changes around each pixel (within the same object)
+		for (int j = 0; j < height; ++j) {
+			for (int i = 0; i < width; ++i) {
+				size_t k = index(i, j);
+				float slope = 0;
+				const int neighbors[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+				for (const auto& d : neighbors) {
+					int x = i + d[0], y = j + d[1];
+					if (x >= 0 && x < width && y >= 0 && y < height && object[index(x, y)] == object[k])
+						slope = std::max(slope, std::abs(depth[index(x, y)] - depth[k]));
+				}
+				depth_slope[k] = slope;
+			}
+		}
+	}
+
+	// Runs the passes, and returns the image with the denoised colors (same sample counts, no AOVs)
+	framebuffer run(const framebuffer& image, int threads) {
+		std::vector<float> next_lighting(lighting.size()), next_variance(variance.size());
+		for (int pass = 0; pass < settings.passes; ++pass) {
+			blur_variance(threads);
+			int step = 1 << pass;
+			parallel_for(size_t(height), threads, [&](size_t begin, size_t end) {
+				for (int j = int(begin); j < int(end); ++j) {
+					for (int i = 0; i < width; ++i)
+						filter_pixel(i, j, step, next_lighting, next_variance);
+				}
+			});
+			lighting.swap(next_lighting);
+			variance.swap(next_variance);
+		}
+
+		framebuffer out(width, height);
+		out.sample_counts = image.sample_counts;
+		for (size_t k = 0; k < out.sample_counts.size(); ++k) {
+			float n = float(out.sample_counts[k]);
+			for (int c = 0; c < 3; ++c)
+				out.accum[3 * k + c] = lighting[3 * k + c] * albedo[3 * k + c] * n;
+		}
+		return out;
+	}
+
+private:
+	// Keeps black surfaces from dividing by 0 (and the same clamp gets multiplied back, so nothing's lost)
+	static constexpr float min_albedo = 0.01f;
+
+	size_t index(int i, int j) const { return size_t(j) * width + i; }
+
+	static float luminance(const float* c) {
+		return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+	}
+
+	// The variance gets a 3x3 blur before each pass, so one unlucky estimate doesn't decide everything
+	void blur_variance(int threads) {
+		blurred_variance.resize(variance.size());
+		const float kernel[3] = { 0.25f, 0.5f, 0.25f };
+		parallel_for(size_t(height), threads, [&](size_t begin, size_t end) {
+			for (int j = int(begin); j < int(end); ++j) {
+				for (int i = 0; i < width; ++i) {
+					float sum = 0, weight = 0;
+					for (int dy = -1; dy <= 1; ++dy) {
+						for (int dx = -1; dx <= 1; ++dx) {
+							int x = i + dx, y = j + dy;
+							if (x < 0 || x >= width || y < 0 || y >= height)
+								continue;
+							float w = kernel[dx + 1] * kernel[dy + 1];
+							sum += w * variance[index(x, y)];
+							weight += w;
+						}
+					}
+					blurred_variance[index(i, j)] = sum / weight;
+				}
+			}
+		});
+	}
+
+	void filter_pixel(int i, int j, int step, std::vector<float>& out_lighting, std::vector<float>& out_variance) const {
+		const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+		const size_t p = index(i, j);
+		const bool sky = object[p] == no_object;
+		const float l_p = luminance(&lighting[3 * p]);
+		const float luminance_scale = 1 / (settings.sigma_luminance * std::sqrt(blurred_variance[p]) + 1e-6f);
+
+		float sum[3] = { 0, 0, 0 }, weight = 0, variance_sum = 0;
+		for (int dy = -2; dy <= 2; ++dy) {
+			for (int dx = -2; dx <= 2; ++dx) {
+				int x = i + dx * step, y = j + dy * step;
+				if (x < 0 || x >= width || y < 0 || y >= height)
+					continue;
+				const size_t q = index(x, y);
+				if (object[q] != object[p])
+					continue;
+
+				float exponent = std::abs(l_p - luminance(&lighting[3 * q])) * luminance_scale;
+				float w_normal = 1;
+				if (!sky) {
+					float offset = float(step) * std::sqrt(float(dx * dx + dy * dy));
+					exponent += std::abs(depth[p] - depth[q]) / (settings.sigma_depth * depth_slope[p] * offset + 1e-6f);
+					float cosine = normal[3 * p] * normal[3 * q] + normal[3 * p + 1] * normal[3 * q + 1] + normal[3 * p + 2] * normal[3 * q + 2];
+					w_normal = std::pow(std::max(cosine, 0.0f), settings.normal_power);
+				}
+				float albedo_difference = 0;
+				for (int c = 0; c < 3; ++c) {
+					float d = albedo[3 * p + c] - albedo[3 * q + c];
+					albedo_difference += d * d;
+				}
+				exponent += albedo_difference / (settings.sigma_albedo * settings.sigma_albedo);
+
+				float w = kernel[dx + 2] * kernel[dy + 2] * w_normal * std::exp(-exponent);
+				for (int c = 0; c < 3; ++c)
+					sum[c] += w * lighting[3 * q + c];
+				weight += w;
+				variance_sum += w * w * variance[q];
+			}
+		}
+		// (the pixel itself always counts, unless its own normal is degenerate - then keep it as is)
+		if (weight <= 0) {
+			for (int c = 0; c < 3; ++c)
+				out_lighting[3 * p + c] = lighting[3 * p + c];
+			out_variance[p] = variance[p];
+			return;
+		}
+		for (int c = 0; c < 3; ++c)
+			out_lighting[3 * p + c] = sum[c] / weight;
+		out_variance[p] = variance_sum / (weight * weight);
+	}
+
+	denoise_settings settings;
+	int width, height;
+	std::vector<float> albedo, normal, depth, depth_slope; // per pixel averages (albedo clamped to min_albedo)
+	std::vector<uint32_t> object;
+	std::vector<float> lighting, variance, blurred_variance; // what gets filtered
+};
+
+// The denoised version of image, which has to have kept its AOVs (framebuffer::enable_aovs).
+// threads: 0 -> one per hardware thread. The result is the same for any number of them.
+inline framebuffer denoise(const framebuffer& image, int threads = 0, const denoise_settings& settings = denoise_settings()) {
+	return denoiser(image, settings).run(image, threads);
+}
+
+// The AOVs as images, to see what the denoiser sees: path_albedo.ext, path_normal.ext (-1..1 -> 0..1)
+// and path_depth.ext (white = nearest, black = the farthest hit, or nothing)
+inline bool write_aov_images(const std::string& path, const framebuffer& image) {
+	image_format format;
+	image_format_from_path(path, format);
+	framebuffer albedo(image.width, image.height), normal(image.width, image.height), depth(image.width, image.height);
+	float max_depth = 0;
+	for (size_t k = 0; k < image.sample_counts.size(); ++k) {
+		if (image.sample_counts[k] > 0)
+			max_depth = std::max(max_depth, image.depth_sum[k] / float(image.sample_counts[k]));
+	}
+	for (size_t k = 0; k < image.sample_counts.size(); ++k) {
+		float n = float(image.sample_counts[k]);
+		float length_sq = 0;
+		for (int c = 0; c < 3; ++c)
+			length_sq += image.normal_sum[3 * k + c] * image.normal_sum[3 * k + c];
+		float inv_length = length_sq > 0 ? 1 / std::sqrt(length_sq) : 0.0f;
+		float nearness = image.depth_sum[k] > 0 && max_depth > 0 ? 1 - image.depth_sum[k] / (n * max_depth) : 0.0f;
+		for (int c = 0; c < 3; ++c) {
+			albedo.accum[3 * k + c] = image.albedo_sum[3 * k + c];
+			normal.accum[3 * k + c] = (0.5f + 0.5f * image.normal_sum[3 * k + c] * inv_length) * n;
+			depth.accum[3 * k + c] = nearness * n;
+		}
+	}
+	albedo.sample_counts = normal.sample_counts = depth.sample_counts = image.sample_counts;
+	return write_file(insert_before_extension(path, "_albedo"), encode_image(albedo, format))
+		&& write_file(insert_before_extension(path, "_normal"), encode_image(normal, format))
+		&& write_file(insert_before_extension(path, "_depth"), encode_image(depth, format));
+}
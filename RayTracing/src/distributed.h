@@ -0,0 +1,626 @@
+/******************************************************************************
+Trevor's thoughts:
+Sometimes one frame is more than one machine should carry. So a render can be
+split across processes - on this machine or others - over sockets:
+	- The coordinator (--listen ADDR) sets up the scene like always, cuts the
+	  frame into tiles, and hands them out to whoever connects. It doesn't
+	  render anything itself; it just collects the tiles and writes the image.
+	- A worker (--worker ADDR) is the same program with the same scene and
+	  options. It sets the scene up on its own (so files have to be at the same
+	  path on every host), then every one of its render threads opens its own
+	  connection and asks for tiles one at a time.
+	- --spawn-workers N starts N workers on this machine (forked from the
+	  coordinator once the scene is ready, so they don't even redo the setup).
+ADDR is host:port (or :port for every interface on the coordinator), or the
+path of a Unix socket (anything with a / in it). --listen :0 picks a free port.
+
+Everything a pixel's random numbers depend on is (seed, pixel, sample, bounce)
+(sampler.h), so a tile comes out the same no matter which process renders it.
+A worker sends back each pixel's float sums and sample count, exactly what the
+framebuffer holds, and those get copied in as is - so the merged image is
+bit-identical to rendering it in one process. Splitting a pixel's samples
+across workers would lose that (float sums depend on the order they're added
+in), which is why the unit of work is a whole tile.
+
+Workers can die, or get stuck. A tile whose connection drops goes back in the
+queue. Once the queue is empty, idle connections get a second copy of a tile
+somebody else is still working on, and whichever copy comes back first wins
+(they're identical, so it doesn't matter which). So one slow or hung worker
+can't hold the frame up.
+
+To catch a worker that was started with a different scene or settings, each
+side works out a fingerprint of everything that changes the image, and the
+coordinator turns away any worker whose fingerprint doesn't match its own.
+
+Protocol (all little endian u32s, like the checkpoint files):
+	worker -> coordinator: "RTWORK01", then the fingerprint's low and high halves
+	coordinator -> worker: a command, then a tile's x0 y0 x1 y1
+	                       (command: 1 = render this tile, 0 = all done, 2 = rejected)
+	worker -> coordinator: the tile's x0 y0 x1 y1, then for every pixel (rows
+	                       from y0 up, left to right): sample count, r, g, b sums (float bits)
+This is POSIX only for now (sockets and fork).
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "framebuffer.h"
+#include "progressive.h"
+#include "random.h"
+#include "render.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define RT_HAS_SOCKETS 0
+#else
+#define RT_HAS_SOCKETS 1
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+const char worker_magic[8] = { 'R', 'T', 'W', 'O', 'R', 'K', '0', '1' };
+
+enum class worker_command : uint32_t {
+	done = 0,
+	render_tile = 1,
+	rejected = 2
+};
+
+inline uint64_t mix_fingerprint(uint64_t h, uint64_t value) {
+	return hash_seed(h ^ value);
+}
+
+inline uint64_t mix_fingerprint(uint64_t h, double value) {
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return mix_fingerprint(h, bits);
+}
+
+// Everything that changes the image: the render settings that matter, the camera and sky, and a summary
+// of the scene (how much of everything there is, and where it all is). Not the integrator,
+// packets, threads or tile size - those give the same image either way.
+inline uint64_t render_fingerprint(
+	const render_settings& settings, const camera_setup& view, const color& sky, const hittable& world,
+	size_t num_primitives, size_t num_materials
+) {
+	uint64_t h = mix_fingerprint(0, uint64_t(sizeof(real)));
+	h = mix_fingerprint(h, uint64_t(settings.image_width));
+	h = mix_fingerprint(h, uint64_t(settings.image_height));
+	h = mix_fingerprint(h, uint64_t(settings.samples_per_pixel));
+	h = mix_fingerprint(h, uint64_t(settings.max_depth));
+	h = mix_fingerprint(h, settings.seed);
+	h = mix_fingerprint(h, uint64_t(settings.sampler));
+	h = mix_fingerprint(h, uint64_t(settings.adaptive));
+	if (settings.adaptive) {
+		h = mix_fingerprint(h, uint64_t(settings.min_spp));
+		h = mix_fingerprint(h, settings.adaptive_threshold);
+	}
+	const point3* points[] = { &view.lookfrom, &view.lookat, &view.vup };
+	for (const point3* p : points) {
+		for (int c = 0; c < 3; ++c)
+			h = mix_fingerprint(h, double((*p)[c]));
+	}
+	h = mix_fingerprint(h, view.vfov);
+	h = mix_fingerprint(h, view.aspect_ratio);
+	h = mix_fingerprint(h, view.aperture);
+	h = mix_fingerprint(h, view.focus_dist);
+	for (int c = 0; c < 3; ++c)
+		h = mix_fingerprint(h, double(sky[c]));
+	h = mix_fingerprint(h, uint64_t(num_primitives));
+	h = mix_fingerprint(h, uint64_t(num_materials));
+	aabb box;
+	if (world.bounding_box(box)) {
+		for (int c = 0; c < 3; ++c) {
+			h = mix_fingerprint(h, double(box.min()[c]));
+			h = mix_fingerprint(h, double(box.max()[c]));
+		}
+	}
+	return h;
+}
+
+#if RT_HAS_SOCKETS
+
+///////////////// Sockets /////////////////
+
+struct socket_address {
+	sockaddr_storage addr;
+	socklen_t length;
+};
+
+// ADDR -> the socket addresses it could mean (eg: localhost can be IPv4 or IPv6). host:port, :port
+// (any interface, for listening), [v6 host]:port, or a Unix socket path (anything with a / in it).
+inline std::vector<socket_address> resolve_address(const std::string& address, bool listening) {
+	std::vector<socket_address> out;
+	socket_address a;
+	std::memset(&a, 0, sizeof(a));
+	if (address.find('/') != std::string::npos) {
+		sockaddr_un& un = reinterpret_cast<sockaddr_un&>(a.addr);
+		if (address.size() >= sizeof(un.sun_path))
+			return out;
+		un.sun_family = AF_UNIX;
+		std::memcpy(un.sun_path, address.c_str(), address.size() + 1);
+		a.length = socklen_t(sizeof(sockaddr_un));
+		out.push_back(a);
+		return out;
+	}
+
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos)
+		return out;
+	std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+	if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+		host = host.substr(1, host.size() - 2);
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	addrinfo* found = nullptr;
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0)
+		return out;
+	for (addrinfo* p = found; p; p = p->ai_next) {
+		std::memcpy(&a.addr, p->ai_addr, p->ai_addrlen);
+		a.length = p->ai_addrlen;
+		out.push_back(a);
+	}
+	freeaddrinfo(found);
+	return out;
+}
+
+// Sends all of bytes (no SIGPIPE if the other end is gone - just false)
+inline bool send_all(int fd, const std::string& bytes) {
+	size_t sent = 0;
+	while (sent < bytes.size()) {
+		ssize_t n = ::send(fd, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		sent += size_t(n);
+	}
+	return true;
+}
+
+// Blocks until size bytes have arrived. false if the connection closes first.
+inline bool receive_all(int fd, char* out, size_t size) {
+	size_t received = 0;
+	while (received < size) {
+		ssize_t n = ::recv(fd, out + received, size - received, 0);
+		if (n <= 0)
+			return false;
+		received += size_t(n);
+	}
+	return true;
+}
+
+// A connected socket, or -1. Keeps trying for a while, so workers can start before the coordinator.
+inline int connect_to(const std::string& address, double timeout_seconds = 10) {
+	std::vector<socket_address> candidates = resolve_address(address, false);
+	if (candidates.empty()) {
+		std::cerr << "Can't make sense of address " << address << " (host:port, or a socket path with a / in it)\n";
+		return -1;
+	}
+	auto start = std::chrono::steady_clock::now();
+	while (true) {
+		for (const socket_address& a : candidates) {
+			int fd = ::socket(a.addr.ss_family, SOCK_STREAM, 0);
+			if (fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr*>(&a.addr), a.length) == 0) {
+				if (a.addr.ss_family != AF_UNIX) {
+					int on = 1; // results are one big write each, and commands are tiny - don't wait around to batch them
+					setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+				}
+				return fd;
+			}
+			if (fd >= 0)
+				::close(fd);
+		}
+		std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+		if (waited.count() > timeout_seconds) {
+			std::cerr << "Couldn't connect to " << address << "\n";
+			return -1;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
+
+inline uint32_t decode_u32(const char* p) {
+	uint32_t v = 0;
+	for (int b = 0; b < 4; ++b)
+		v |= uint32_t(uint8_t(p[b])) << (8 * b);
+	return v;
+}
+
+inline size_t tile_pixels(const tile& t) {
+	return size_t(t.x1 - t.x0) * size_t(t.y1 - t.y0);
+}
+
+// Bytes in a worker's reply for tile t: the tile, then count + r, g, b per pixel
+inline size_t tile_result_size(const tile& t) {
+	return 16 + 16 * tile_pixels(t);
+}
+
+inline std::string encode_tile_command(worker_command command, const tile& t) {
+	std::string out;
+	append_u32_little_endian(out, uint32_t(command));
+	append_u32_little_endian(out, uint32_t(t.x0));
+	append_u32_little_endian(out, uint32_t(t.y0));
+	append_u32_little_endian(out, uint32_t(t.x1));
+	append_u32_little_endian(out, uint32_t(t.y1));
+	return out;
+}
+
+///////////////// Worker /////////////////
+
+// Renders tiles for the coordinator at address until it says it's done, on every one of the pool's
+// threads (each with a connection of its own). trace_tile: void(const tile& t, framebuffer& image)
+template <typename TraceTile>
+bool run_worker(
+	render_pool& pool, const std::string& address, const render_settings& settings, uint64_t fingerprint, TraceTile trace_tile
+) {
+	std::atomic<int> tiles_done(0), failed(0);
+	pool.run([&](int) {
+		int fd = connect_to(address);
+		if (fd < 0) {
+			++failed;
+			return;
+		}
+		std::string hello(worker_magic, sizeof(worker_magic));
+		append_u32_little_endian(hello, uint32_t(fingerprint));
+		append_u32_little_endian(hello, uint32_t(fingerprint >> 32));
+
+		// Every thread gets an image of its own: a tile can be handed out twice (see above), and the
+		// two copies could both land in this process.
+		framebuffer image(settings.image_width, settings.image_height);
+		char command[20];
+		bool ok = send_all(fd, hello);
+		std::string reply;
+		while (ok && receive_all(fd, command, sizeof(command))) {
+			worker_command what = worker_command(decode_u32(command));
+			if (what == worker_command::rejected) {
+				std::cerr << "The coordinator at " << address << " has a different scene or settings - start this worker with the same ones\n";
+				++failed;
+				break;
+			}
+			if (what != worker_command::render_tile)
+				break;
+			tile t = { int(decode_u32(command + 4)), int(decode_u32(command + 8)), int(decode_u32(command + 12)), int(decode_u32(command + 16)) };
+			if (t.x0 < 0 || t.y0 < 0 || t.x1 > image.width || t.y1 > image.height || t.x0 >= t.x1 || t.y0 >= t.y1) {
+				std::cerr << "Got a tile that's not in the image - is the coordinator rendering a different size?\n";
+				++failed;
+				break;
+			}
+
+			trace_tile(t, image);
+			reply.clear();
+			reply.reserve(tile_result_size(t));
+			for (int v : { t.x0, t.y0, t.x1, t.y1 })
+				append_u32_little_endian(reply, uint32_t(v));
+			for (int j = t.y0; j < t.y1; ++j) {
+				for (int i = t.x0; i < t.x1; ++i) {
+					size_t k = image.index(i, j);
+					append_u32_little_endian(reply, uint32_t(image.sample_counts[k]));
+					for (int c = 0; c < 3; ++c) {
+						uint32_t bits;
+						std::memcpy(&bits, &image.accum[3 * k + c], sizeof(bits));
+						append_u32_little_endian(reply, bits);
+					}
+					image.sample_counts[k] = 0; // ready for the next time this tile comes around
+					std::fill(&image.accum[3 * k], &image.accum[3 * k] + 3, 0.0f);
+				}
+			}
+			ok = send_all(fd, reply);
+			if (ok)
+				++tiles_done;
+		}
+		::close(fd);
+	});
+	if (settings.progress)
+		std::cerr << "Worker: rendered " << tiles_done << " tiles for " << address << "\n";
+	return failed == 0;
+}
+
+///////////////// Coordinator /////////////////
+
+class render_coordinator {
+public:
+	render_coordinator(const render_settings& settings, uint64_t fingerprint)
+		: settings(settings), fingerprint(fingerprint) {}
+
+	render_coordinator(const render_coordinator&) = delete;
+	render_coordinator& operator=(const render_coordinator&) = delete;
+
+	~render_coordinator() {
+		for (const auto& c : connections)
+			::close(c.fd);
+		if (listener >= 0)
+			::close(listener);
+		if (!unix_path.empty())
+			::unlink(unix_path.c_str());
+		for (pid_t pid : spawned) {
+			if (pid > 0)
+				waitpid(pid, nullptr, 0);
+		}
+	}
+
+	// Starts listening on address. False (after saying why) if it can't.
+	bool listen(const std::string& address) {
+		std::vector<socket_address> candidates = resolve_address(address, true);
+		if (candidates.empty()) {
+			std::cerr << "Can't make sense of address " << address << " (host:port, :port, or a socket path with a / in it)\n";
+			return false;
+		}
+		const sockaddr_storage& addr = candidates[0].addr;
+		socklen_t length = candidates[0].length;
+		listener = ::socket(addr.ss_family, SOCK_STREAM, 0);
+		if (addr.ss_family == AF_UNIX) {
+			unix_path = address;
+			::unlink(unix_path.c_str()); // a leftover from a coordinator that didn't get to clean up
+		}
+		else {
+			int on = 1;
+			setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		}
+		if (listener < 0 || ::bind(listener, reinterpret_cast<const sockaddr*>(&addr), length) != 0 || ::listen(listener, 64) != 0) {
+			std::cerr << "Couldn't listen on " << address << "\n";
+			return false;
+		}
+
+		// Where local workers should connect: the same socket, or this machine and the port we really got (for :0)
+		local_address = address;
+		if (addr.ss_family != AF_UNIX) {
+			sockaddr_storage bound;
+			socklen_t bound_length = sizeof(bound);
+			getsockname(listener, reinterpret_cast<sockaddr*>(&bound), &bound_length);
+			int port = bound.ss_family == AF_INET6 ? ntohs(reinterpret_cast<sockaddr_in6&>(bound).sin6_port)
+				: ntohs(reinterpret_cast<sockaddr_in&>(bound).sin_port);
+			local_address = std::string(bound.ss_family == AF_INET6 ? "[::1]" : "127.0.0.1") + ":" + std::to_string(port);
+		}
+		if (settings.progress)
+			std::cerr << "Coordinator: waiting for workers on " << local_address << "\n";
+		return true;
+	}
+
+	// Forks count workers, each running worker(local_address()) and exiting with its result.
+	// Only returns in the coordinator.
+	template <typename Worker>
+	bool spawn_workers(int count, Worker worker) {
+		std::cerr << std::flush;
+		for (int k = 0; k < count; ++k) {
+			pid_t pid = fork();
+			if (pid < 0) {
+				std::cerr << "Couldn't start a worker process\n";
+				return false;
+			}
+			if (pid == 0) {
+				::close(listener);
+				listener = -1;
+				unix_path.clear(); // (the coordinator's to clean up)
+				bool ok = worker(local_address);
+				std::cerr << std::flush;
+				_exit(ok ? 0 : 1);
+			}
+			spawned.push_back(pid);
+		}
+		return true;
+	}
+
+	const std::string& local_address_for_workers() const { return local_address; }
+
+	// Hands out every tile, and copies the results into image. Returns once they're all in.
+	bool render(framebuffer& image) {
+		tiles = make_tiles(settings.image_width, settings.image_height, settings.tile_size);
+		finished.assign(tiles.size(), false);
+		copies.assign(tiles.size(), 0);
+		pending.clear();
+		for (size_t k = 0; k < tiles.size(); ++k)
+			pending.push_back(int(k));
+		remaining = tiles.size();
+		start = std::chrono::steady_clock::now();
+
+		std::vector<pollfd> fds;
+		std::vector<char> buffer(1 << 16);
+		while (remaining > 0) {
+			fds.clear();
+			fds.push_back({ listener, POLLIN, 0 });
+			for (const auto& c : connections)
+				fds.push_back({ c.fd, POLLIN, 0 });
+			if (poll(fds.data(), nfds_t(fds.size()), 1000) < 0)
+				continue; // (interrupted)
+
+			if (fds[0].revents & POLLIN) {
+				int fd = accept(listener, nullptr, nullptr);
+				if (fd >= 0) {
+					int on = 1;
+					setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // (fails harmlessly on a Unix socket)
+					connections.push_back(connection(fd));
+				}
+			}
+			// (fds[k + 1] is connections[k] - any accepted just now are past the end, and get polled next time)
+			for (size_t k = 0; k + 1 < fds.size(); ++k) {
+				// (skip any dropped since the poll - a failed dispatch in drop() can take an idle one with it)
+				if (connections[k].fd < 0 || !(fds[k + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+					continue;
+				ssize_t n = ::recv(connections[k].fd, buffer.data(), buffer.size(), 0);
+				if (n <= 0 || !receive(connections[k], buffer.data(), size_t(n), image))
+					drop(connections[k]);
+			}
+			connections.erase(std::remove_if(connections.begin(), connections.end(),
+				[](const connection& c) { return c.fd < 0; }), connections.end());
+
+			if (remaining > 0 && connections.empty() && !spawned.empty() && all_spawned_exited()) {
+				std::cerr << "\nAll of the worker processes quit before the image was done\n";
+				return false;
+			}
+		}
+
+		for (auto& c : connections) {
+			if (c.tile < 0)
+				send_all(c.fd, encode_tile_command(worker_command::done, tile{ 0, 0, 0, 0 }));
+			::close(c.fd); // (busy ones have a copy of a tile that's already in - they'll notice the hang up)
+		}
+		connections.clear();
+		if (settings.progress) {
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			std::cerr << "\r (Time Taken: " << elapsed.count() << ") " << tiles.size() << " tiles from "
+				<< workers_seen << " worker connections (" << redispatched << " tiles re-sent) \n";
+		}
+		return true;
+	}
+
+private:
+	struct connection {
+		int fd;
+		bool greeted = false; // has sent a hello with the right fingerprint
+		int tile = -1;        // the tile it's working on (-1 -> idle)
+		std::string in;       // bytes received, but not used yet
+
+		connection(int fd) : fd(fd) {}
+	};
+
+	// Takes in what came over the connection. False -> the connection should be dropped.
+	bool receive(connection& c, const char* bytes, size_t size, framebuffer& image) {
+		c.in.append(bytes, size);
+		if (!c.greeted) {
+			const size_t hello_size = sizeof(worker_magic) + 8;
+			if (c.in.size() < hello_size)
+				return true;
+			size_t pos = sizeof(worker_magic);
+			uint64_t theirs = read_u32_little_endian(c.in, pos);
+			theirs |= uint64_t(read_u32_little_endian(c.in, pos)) << 32;
+			if (std::memcmp(c.in.data(), worker_magic, sizeof(worker_magic)) != 0)
+				return false;
+			if (theirs != fingerprint) {
+				std::cerr << "\nTurned away a worker with a different scene or settings\n";
+				send_all(c.fd, encode_tile_command(worker_command::rejected, tile{ 0, 0, 0, 0 }));
+				return false;
+			}
+			c.greeted = true;
+			c.in.erase(0, hello_size);
+			++workers_seen;
+			return dispatch(c);
+		}
+
+		if (c.tile < 0)
+			return c.in.empty(); // nothing was asked for
+		const tile& t = tiles[size_t(c.tile)];
+		if (c.in.size() < tile_result_size(t))
+			return true;
+		size_t pos = 0;
+		for (int v : { t.x0, t.y0, t.x1, t.y1 }) {
+			if (read_u32_little_endian(c.in, pos) != uint32_t(v))
+				return false;
+		}
+		int k = c.tile;
+		--copies[size_t(k)];
+		c.tile = -1;
+		if (!finished[size_t(k)]) {
+			for (int j = t.y0; j < t.y1; ++j) {
+				for (int i = t.x0; i < t.x1; ++i) {
+					size_t p = image.index(i, j);
+					image.sample_counts[p] = int(read_u32_little_endian(c.in, pos));
+					for (int ch = 0; ch < 3; ++ch) {
+						uint32_t bits = read_u32_little_endian(c.in, pos);
+						std::memcpy(&image.accum[3 * p + ch], &bits, sizeof(bits));
+					}
+				}
+			}
+			finished[size_t(k)] = true;
+			--remaining;
+			if (settings.progress) {
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				std::cerr << "\r (Time Taken: " << elapsed.count() << ") Tiles remaining: " << remaining
+					<< " of " << tiles.size() << " " << std::flush;
+			}
+		}
+		c.in.erase(0, tile_result_size(t));
+		return c.in.empty() && dispatch(c);
+	}
+
+	// Gives an idle connection its next tile: the next one in the queue, or once that's empty, a
+	// second copy of one that only one worker has
+	bool dispatch(connection& c) {
+		if (remaining == 0)
+			return true;
+		int k = -1;
+		while (!pending.empty() && k < 0) {
+			k = pending.front();
+			pending.pop_front();
+			if (finished[size_t(k)])
+				k = -1;
+		}
+		if (k < 0) {
+			for (size_t n = 0; n < tiles.size() && k < 0; ++n) {
+				if (!finished[n] && copies[n] == 1)
+					k = int(n);
+			}
+			if (k < 0)
+				return true; // everything left already has two workers on it - sit this one out
+			++redispatched;
+		}
+		c.tile = k;
+		++copies[size_t(k)];
+		return send_all(c.fd, encode_tile_command(worker_command::render_tile, tiles[size_t(k)]));
+	}
+
+	// A worker went away (or sent garbage): whatever it was working on goes back in the queue
+	void drop(connection& c) {
+		if (c.tile >= 0) {
+			size_t k = size_t(c.tile);
+			if (--copies[k] == 0 && !finished[k]) {
+				pending.push_front(c.tile);
+				++redispatched;
+				std::cerr << "\nLost a worker - its tile goes back in the queue\n";
+			}
+			c.tile = -1; // (so its copy never gets counted off twice)
+		}
+		::close(c.fd);
+		c.fd = -1;
+
+		// Anyone sitting idle (everything was taken) can pick the tile up
+		for (auto& other : connections) {
+			if (other.fd >= 0 && other.greeted && other.tile < 0 && !dispatch(other))
+				drop(other);
+		}
+	}
+
+	bool all_spawned_exited() {
+		for (pid_t& pid : spawned) {
+			if (pid > 0 && waitpid(pid, nullptr, WNOHANG) == pid)
+				pid = -pid; // (reaped - don't wait for it again)
+		}
+		return std::all_of(spawned.begin(), spawned.end(), [](pid_t pid) { return pid < 0; });
+	}
+
+	const render_settings& settings;
+	uint64_t fingerprint;
+	int listener = -1;
+	std::string unix_path; // to remove when we're done
+	std::string local_address;
+	std::vector<pid_t> spawned;
+	std::vector<connection> connections;
+
+	std::vector<tile> tiles;
+	std::vector<bool> finished;
+	std::vector<int> copies; // connections working on each tile right now
+	std::deque<int> pending;
+	size_t remaining = 0;
+	int workers_seen = 0, redispatched = 0;
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif
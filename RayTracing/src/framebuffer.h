@@ -0,0 +1,114 @@
+#pragma once
+
+#include "rtweekend.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <vector>
+
+const uint32_t no_object = 0xffffffff; // aov_sample::object for a ray that didn't hit anything
+
+// What a camera ray hit first (AOVs - "arbitrary output variables"): the denoiser (denoise.h)
+// uses these to tell edges from noise. Also works as the sum over a pixel's samples.
+struct aov_sample {
+	color albedo = color(0, 0, 0); // the material's color (the sky's color for a miss)
+	vec3 normal = vec3(0, 0, 0);   // facing the camera (0 for a miss)
+	real depth = 0;                // distance to the hit (0 for a miss)
+	real luminance_sq = 0;         // the sample's luminance, squared (for the pixel's variance)
+	uint32_t object = no_object;   // hit_record::object_id
+
+	// Sums everything up, except object: that stays with the first sample that hit anything
+	aov_sample& operator+=(const aov_sample& s) {
+		albedo += s.albedo;
+		normal += s.normal;
+		depth += s.depth;
+		luminance_sq += s.luminance_sq;
+		object = object != no_object ? object : s.object;
+		return *this;
+	}
+};
+
+// Shared HDR output image: the linear sum of every sample, per pixel, in floats. Nothing
+// gets rounded, gamma corrected, or clamped until an image is written out (image_io.h).
+// Each tile only ever touches its own pixels, so threads can write into it without any locking.
+class framebuffer {
+public:
+	framebuffer(int w, int h) : width(w), height(h), accum(size_t(w) * h * 3, 0.0f), sample_counts(size_t(w) * h, 0) {}
+
+	// (i, j) uses the same convention as the render loop: i -> right, j -> up
+	size_t index(int i, int j) const { return size_t(j) * width + i; }
+
+	// sum: this many more of the pixel's samples, added up (not divided by the count yet).
+	// A fresh framebuffer is all zeros, so a one-shot render just adds everything once;
+	// progressive passes (progressive.h) keep adding to what's already there.
+	void add(int i, int j, const color& sum, int samples) {
+		float* p = &accum[3 * index(i, j)];
+		p[0] += float(sum.x());
+		p[1] += float(sum.y());
+		p[2] += float(sum.z());
+		sample_counts[index(i, j)] += samples;
+	}
+
+	// Back to all zeros, keeping the memory (eg: for the next frame of a sequence)
+	void clear() {
+		std::fill(accum.begin(), accum.end(), 0.0f);
+		std::fill(sample_counts.begin(), sample_counts.end(), 0);
+		if (has_aovs())
+			enable_aovs();
+	}
+
+	color sum(int i, int j) const {
+		const float* p = &accum[3 * index(i, j)];
+		return color(p[0], p[1], p[2]);
+	}
+
+	color average(int i, int j) const {
+		int n = samples(i, j);
+		return n > 0 ? sum(i, j) / n : color(0, 0, 0);
+	}
+
+	int samples(int i, int j) const { return sample_counts[index(i, j)]; }
+
+	// Keeps the AOVs from here on. Same deal as the colors: sums over the pixel's samples, so the
+	// average divides by the same sample count.
+	void enable_aovs() {
+		size_t pixels = size_t(width) * height;
+		albedo_sum.assign(3 * pixels, 0.0f);
+		normal_sum.assign(3 * pixels, 0.0f);
+		depth_sum.assign(pixels, 0.0f);
+		luminance_sq_sum.assign(pixels, 0.0f);
+		object_ids.assign(pixels, no_object);
+	}
+
+	bool has_aovs() const { return !depth_sum.empty(); }
+
+	void add_aovs(int i, int j, const aov_sample& sum) {
+		size_t k = index(i, j);
+		for (int c = 0; c < 3; ++c) {
+			albedo_sum[3 * k + c] += float(sum.albedo[c]);
+			normal_sum[3 * k + c] += float(sum.normal[c]);
+		}
+		depth_sum[k] += float(sum.depth);
+		luminance_sq_sum[k] += float(sum.luminance_sq);
+		if (object_ids[k] == no_object)
+			object_ids[k] = sum.object;
+	}
+
+	int64_t total_samples() const {
+		int64_t total = 0;
+		for (int n : sample_counts)
+			total += n;
+		return total;
+	}
+
+public:
+	int width;
+	int height;
+	std::vector<float> accum; // r, g, b per pixel, bottom row first
+	std::vector<int> sample_counts; // samples taken by each pixel
+
+	// AOVs (empty unless enable_aovs()): sums over each pixel's samples, like accum
+	std::vector<float> albedo_sum, normal_sum; // 3 per pixel
+	std::vector<float> depth_sum, luminance_sq_sum;
+	std::vector<uint32_t> object_ids; // the first sample that hit something's
+};
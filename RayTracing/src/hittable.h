@@ -2,8 +2,10 @@
 
 #include "rtweekend.h"
 #include "ray.h"
+#include "aabb.h"
 
-class material;
+// Index into the scene's material_table (material.h)
+using material_id = uint32_t;
 
 // We can choose a convention to use to define our normal (there are multiple valid options)
 // This is important any time a surface has different behavior for rays hitting from different
@@ -26,21 +28,74 @@ class material;
 struct hit_record {
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> mat_ptr;
-	double t;
+	material_id mat_id;
+	uint32_t object_id; // which object got hit (sphere k of a sphere_set, or a whole mesh) - for the denoiser (denoise.h)
+	real t;
+	real spawn_offset; // how far off of the surface a new ray has to start, to be sure it can't hit it again (see spawn_ray)
 	bool front_face;
 
 	// The general concept here is setting which side a surface is being hit...
-	// However, the concept of 'outward' is specific to a sphere.
-	// I'm not sure if that makes this correct where it is, or more of a 
-	// sphere-specific method...I'll leave it until I add triangles
+	// 'Outward' sounded sphere-specific, but it works for triangles too: there it's the
+	// winding normal (counter-clockwise vertices = the front, see triangle_mesh.h), so a
+	// closed mesh's "outside" is outward, same as a sphere's, and glass meshes refract right.
 	inline void set_face_normal(const ray& r, const vec3& outward_normal) {
 		front_face = dot(r.direction(), outward_normal) < 0;
 		normal = front_face ? outward_normal : -outward_normal;
 	}
 };
 
+// Self-intersection: a hit point is only as exact as the numbers around it, so a new ray
+// starting right at p can find the surface again at t = 0.0000001 ("shadow acne"). The old
+// fix was ignoring every hit closer than t = 0.001, which is way too much for small objects,
+// and not enough in float for the radius 1000 ground sphere (floats near 1000 are ~0.00006
+// apart). Instead, each hit says how far off the surface is safe - a few dozen units in the
+// last place of the biggest number involved (the center or radius) - and new rays start that
+// far off of it, on the side they're heading to. Then t_min can just be 0.
+const real surface_error_scale = 16 * std::numeric_limits<real>::epsilon();
+
+inline real surface_error(const point3& center, real radius) {
+	return surface_error_scale * std::max(max_abs_component(center), std::abs(radius));
+}
+
+// A new ray leaving the hit point (eg: scattered or refracted)
+inline ray spawn_ray(const hit_record& rec, const vec3& direction) {
+	vec3 offset = rec.spawn_offset * rec.normal;
+	return ray(dot(direction, rec.normal) > 0 ? rec.p + offset : rec.p - offset, direction);
+}
+
+class hittable;
+
+// What closest-hit traversal keeps track of: just the nearest t, and which primitive it
+// was. Everything else (point, normal, material) only gets worked out for the final winner.
+struct ray_hit {
+	real t;                 // nearest hit so far (starts at t_max)
+	uint32_t primitive;     // which primitive of `object` (eg: sphere k of a sphere_set)
+	const hittable* object; // the leaf object that was hit - never a list/bvh
+	const hittable* inner = nullptr; // when object is an instance (instance.h): the leaf inside it that was hit
+};
+
 class hittable {
 public:
-	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
-};
\ No newline at end of file
+	// Closest hit in [t_min, hit.t]. Only writes to hit if it finds one, so callers can keep
+	// passing the same hit in, and it ends up holding the closest one (hit.t shrinking as it goes).
+	virtual bool intersect(const ray& r, real t_min, ray_hit& hit) const = 0;
+
+	// The shading data for a hit that intersect() found
+	virtual void fill_hit_record(const ray& r, const ray_hit& hit, hit_record& rec) const = 0;
+
+	// Is there anything at all in [t_min, t_max]? Stops at the first hit it finds (shadow rays
+	// don't care which one is closest).
+	virtual bool occluded(const ray& r, real t_min, real t_max) const = 0;
+
+	// Returns false for anything that can't be bounded (eg: an infinite plane)
+	virtual bool bounding_box(aabb& output_box) const = 0;
+
+	// Closest hit, with the full hit_record. Only writes to rec if it finds a hit.
+	bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+		ray_hit h = { t_max, 0, nullptr };
+		if (!intersect(r, t_min, h))
+			return false;
+		h.object->fill_hit_record(r, h, rec);
+		return true;
+	}
+};
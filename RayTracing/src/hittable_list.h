@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hittable.h"
+#include "stats.h"
 
 #include <memory>
 #include <vector>
@@ -16,25 +17,53 @@ public:
 	void clear() { objects.clear(); }
 	void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-	virtual bool hit(
-		const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool intersect(const ray& r, real t_min, ray_hit& hit) const override;
+
+	virtual void fill_hit_record(const ray& r, const ray_hit& hit, hit_record& rec) const override {
+		hit.object->fill_hit_record(r, hit, rec); // (hit.object is the leaf that found it)
+	}
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override;
 
 public:
 	std::vector<shared_ptr<hittable>> objects;
 };
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    hit_record temp_rec;
+bool hittable_list::intersect(const ray& r, real t_min, ray_hit& hit) const {
+    RT_COUNT(list_hits);
     bool hit_anything = false;
-    auto closest_so_far = t_max;
 
+    // Each object only writes to hit (and shrinks hit.t) when it finds something closer,
+    // so nothing but a t and a pointer gets overwritten along the way
     for (const auto& object : objects) {
-        if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+        if (object->intersect(r, t_min, hit))
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
-        }
     }
 
     return hit_anything;
+}
+
+bool hittable_list::occluded(const ray& r, real t_min, real t_max) const {
+    for (const auto& object : objects) {
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    }
+    return false;
+}
+
+bool hittable_list::bounding_box(aabb& output_box) const {
+	if (objects.empty())
+		return false;
+
+	output_box = aabb();
+	for (const auto& object : objects) {
+		aabb temp_box;
+		if (!object->bounding_box(temp_box))
+			return false;
+		output_box.expand(temp_box);
+	}
+
+	return true;
 }
\ No newline at end of file
@@ -0,0 +1,514 @@
+/******************************************************************************
+Trevor's thoughts:
+write_color used to push 3 ints per pixel through std::ostream as text, straight to
+std::cout. For a big frame that's millions of tiny formatted writes, and a file
+that's ~4x bigger than it needs to be. Now writing an image is 3 steps:
+	1) resolve: one pass over the float framebuffer -> 8 bit pixels (divide by the
+	sample count, gamma, clamp). It's a straight loop over contiguous floats with
+	no branches, done 4 at a time with SSE2 (compilers won't vectorize sqrt on their
+	own, since the scalar version has to be able to set errno).
+	2) encode the whole file into memory: P3 (the old text ppm), P6 (binary ppm),
+	PNG, or PFM (linear floats, for when we want the HDR values, eg: to tone map
+	or denoise later)
+	3) write it out in one go
+The PNG encoder is a small one: each row gets whichever of the standard filters
+makes it smallest, then it's compressed with deflate using the fixed Huffman
+codes (no dynamic tables), which still gets most of the win on smooth renders.
+******************************************************************************/
+
+#pragma once
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+enum class image_format { p3, p6, png, pfm };
+
+inline bool parse_image_format(const std::string& name, image_format& format) {
+	if (name == "p3") format = image_format::p3;
+	else if (name == "p6" || name == "ppm") format = image_format::p6;
+	else if (name == "png") format = image_format::png;
+	else if (name == "pfm") format = image_format::pfm;
+	else return false;
+	return true;
+}
+
+// From the file extension (.ppm -> binary P6; ask for p3 explicitly to get text)
+inline bool image_format_from_path(const std::string& path, image_format& format) {
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string extension = path.substr(dot + 1);
+	for (auto& c : extension)
+		c = char(tolower(c));
+	return extension != "p3" && parse_image_format(extension, format);
+}
+
+// --format wins, then the output file's extension. stdout gets the old text ppm by default.
+inline bool choose_image_format(const std::string& path, const std::string& name, image_format& format) {
+	if (!name.empty())
+		return parse_image_format(name, format);
+	if (!path.empty())
+		return image_format_from_path(path, format);
+	format = image_format::p3;
+	return true;
+}
+
+// 8 bit RGB, top row first (the order every format except PFM wants)
+struct image8 {
+	int width = 0;
+	int height = 0;
+	std::vector<uint8_t> rgb;
+};
+
+// Sample sums -> displayable pixels: divide by the sample count, gamma 2 (see correct_gamma), clamp
+inline image8 resolve(const framebuffer& image) {
+	image8 out;
+	out.width = image.width;
+	out.height = image.height;
+	out.rgb.resize(size_t(image.width) * image.height * 3);
+
+	const int row_values = 3 * image.width;
+	std::vector<float> scale(row_values);
+	for (int y = 0; y < image.height; ++y) {
+		const int j = image.height - 1 - y; // the framebuffer's rows go bottom -> top
+		const int* counts = &image.sample_counts[image.index(0, j)];
+		for (int i = 0; i < image.width; ++i) {
+			float s = counts[i] > 0 ? 1.0f / counts[i] : 0.0f;
+			scale[3 * i] = scale[3 * i + 1] = scale[3 * i + 2] = s;
+		}
+
+		const float* src = &image.accum[3 * image.index(0, j)];
+		uint8_t* dst = &out.rgb[size_t(y) * row_values];
+		int k = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), to_byte = _mm_set1_ps(255.999f);
+		for (; k + 4 <= row_values; k += 4) {
+			__m128 v = _mm_mul_ps(_mm_loadu_ps(src + k), _mm_loadu_ps(&scale[k]));
+			v = _mm_sqrt_ps(_mm_max_ps(v, zero)); // _mm_max_ps(NaN, 0) -> 0
+			__m128i bytes = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(v, one), to_byte));
+			bytes = _mm_packus_epi16(_mm_packs_epi32(bytes, bytes), bytes);
+			int packed = _mm_cvtsi128_si32(bytes);
+			std::memcpy(dst + k, &packed, 4);
+		}
+#endif
+		for (; k < row_values; ++k) {
+			// max/min in this order also turn NaNs into 0
+			float v = std::sqrt(std::max(0.0f, src[k] * scale[k]));
+			dst[k] = uint8_t(255.999f * std::min(v, 1.0f));
+		}
+	}
+	return out;
+}
+
+// Linear (HDR) averages, bottom row first - exactly the PFM layout
+inline std::vector<float> resolve_linear(const framebuffer& image) {
+	std::vector<float> out(image.accum.size());
+	for (size_t p = 0; p < image.sample_counts.size(); ++p) {
+		float s = image.sample_counts[p] > 0 ? 1.0f / image.sample_counts[p] : 0.0f;
+		out[3 * p] = image.accum[3 * p] * s;
+		out[3 * p + 1] = image.accum[3 * p + 1] * s;
+		out[3 * p + 2] = image.accum[3 * p + 2] * s;
+	}
+	return out;
+}
+
+// False color for heatmaps: f = 0 -> black -> purple -> orange -> white <- f = 1
+inline color heat_color(double f) {
+	const color ramp[] = { color(0, 0, 0), color(0.4, 0.05, 0.55), color(0.95, 0.45, 0.1), color(1, 1, 1) };
+	const int stops = sizeof(ramp) / sizeof(ramp[0]);
+	f = clamp(f, 0.0, 1.0);
+	int k = std::min(int(f * (stops - 1)), stops - 2);
+	double t = f * (stops - 1) - k;
+	return (1 - t) * ramp[k] + t * ramp[k + 1];
+}
+
+// values: one per pixel, bottom row first (like the framebuffer), shown relative to the biggest one
+inline image8 heatmap_image(const std::vector<double>& values, int width, int height) {
+	double max_value = 0;
+	for (double v : values)
+		max_value = std::max(max_value, v);
+	image8 out;
+	out.width = width;
+	out.height = height;
+	out.rgb.reserve(size_t(width) * height * 3);
+	for (int j = height - 1; j >= 0; --j) {
+		for (int i = 0; i < width; ++i) {
+			color c = heat_color(max_value > 0 ? values[size_t(j) * width + i] / max_value : 0.0);
+			for (int channel = 0; channel < 3; ++channel)
+				out.rgb.push_back(uint8_t(255.999 * double(c[channel])));
+		}
+	}
+	return out;
+}
+
+// Samples per pixel as a false color image: black (few) -> purple -> orange -> white (max_spp).
+// Log scale, since adaptive sampling doubles the counts every round.
+inline image8 sample_heatmap(const framebuffer& image, int max_spp) {
+	image8 out;
+	out.width = image.width;
+	out.height = image.height;
+	out.rgb.reserve(size_t(image.width) * image.height * 3);
+	for (int j = image.height - 1; j >= 0; --j) {
+		for (int i = 0; i < image.width; ++i) {
+			double f = max_spp > 1 ? log2(std::max(image.samples(i, j), 1)) / log2(max_spp) : 1.0;
+			color c = heat_color(f);
+			for (int channel = 0; channel < 3; ++channel)
+				out.rgb.push_back(uint8_t(255.999 * double(c[channel])));
+		}
+	}
+	return out;
+}
+
+///////////////// Encoders (each returns the whole file) /////////////////
+
+inline std::string ppm_header(const char* magic, int width, int height) {
+	return std::string(magic) + "\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+}
+
+// Text ppm, same layout write_color produced (one "r g b" line per pixel)
+inline std::string encode_p3(const image8& image) {
+	std::string out = ppm_header("P3", image.width, image.height);
+	out.reserve(out.size() + image.rgb.size() * 4);
+	char text[4];
+	for (size_t k = 0; k < image.rgb.size(); ++k) {
+		int v = image.rgb[k], n = 0;
+		if (v >= 100) text[n++] = char('0' + v / 100);
+		if (v >= 10) text[n++] = char('0' + v / 10 % 10);
+		text[n++] = char('0' + v % 10);
+		text[n++] = k % 3 == 2 ? '\n' : ' ';
+		out.append(text, n);
+	}
+	return out;
+}
+
+inline std::string encode_p6(const image8& image) {
+	std::string out = ppm_header("P6", image.width, image.height);
+	out.append(reinterpret_cast<const char*>(image.rgb.data()), image.rgb.size());
+	return out;
+}
+
+// Portable float map: little endian (hence the -1 scale), bottom row first
+inline std::string encode_pfm(int width, int height, const std::vector<float>& rgb) {
+	std::string out = "PF\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n-1.0\n";
+	size_t header = out.size();
+	out.resize(header + rgb.size() * sizeof(float));
+	for (size_t k = 0; k < rgb.size(); ++k) {
+		uint32_t bits;
+		std::memcpy(&bits, &rgb[k], sizeof(bits));
+		for (int b = 0; b < 4; ++b)
+			out[header + 4 * k + b] = char(bits >> (8 * b)); // little endian, whatever the machine is
+	}
+	return out;
+}
+
+// Deflate bits go in least significant bit first
+class bit_writer {
+public:
+	explicit bit_writer(std::string& out) : out(out) {}
+
+	void put(uint32_t bits, int count) {
+		buffer |= uint64_t(bits) << used;
+		used += count;
+		while (used >= 8) {
+			out.push_back(char(buffer & 0xFF));
+			buffer >>= 8;
+			used -= 8;
+		}
+	}
+
+	// ...except Huffman codes, which go in most significant bit first
+	void put_code(uint32_t code, int length) {
+		uint32_t reversed = 0;
+		for (int b = 0; b < length; ++b)
+			reversed |= ((code >> b) & 1) << (length - 1 - b);
+		put(reversed, length);
+	}
+
+	void flush() {
+		if (used > 0)
+			out.push_back(char(buffer & 0xFF));
+		buffer = 0;
+		used = 0;
+	}
+
+private:
+	std::string& out;
+	uint64_t buffer = 0;
+	int used = 0;
+};
+
+// One deflate block with the fixed Huffman codes (RFC 1951, 3.2.6). Matches are found with
+// a hash of the next 3 bytes, following a short chain of earlier spots with the same hash.
+inline void deflate_fixed(const uint8_t* data, size_t n, std::string& out) {
+	static const int length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const int length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const int distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const int distance_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	const int window = 32768, max_match = 258, max_chain = 16;
+	const int hash_bits = 15;
+
+	bit_writer bits(out);
+	auto put_symbol = [&](int symbol) {
+		if (symbol <= 143) bits.put_code(0x30 + symbol, 8);
+		else if (symbol <= 255) bits.put_code(0x190 + symbol - 144, 9);
+		else if (symbol <= 279) bits.put_code(symbol - 256, 7);
+		else bits.put_code(0xC0 + symbol - 280, 8);
+	};
+
+	std::vector<int32_t> head(size_t(1) << hash_bits, -1);
+	std::vector<int32_t> prev(window, -1);
+	auto hash = [&](size_t pos) {
+		uint32_t v = uint32_t(data[pos]) | uint32_t(data[pos + 1]) << 8 | uint32_t(data[pos + 2]) << 16;
+		return (v * 2654435761u) >> (32 - hash_bits);
+	};
+	auto insert = [&](size_t pos) {
+		if (pos + 3 > n)
+			return;
+		uint32_t h = hash(pos);
+		prev[pos & (window - 1)] = head[h];
+		head[h] = int32_t(pos);
+	};
+
+	bits.put(1, 1); // last block
+	bits.put(1, 2); // fixed Huffman codes
+	size_t pos = 0;
+	while (pos < n) {
+		int best_length = 0, best_distance = 0;
+		if (pos + 3 <= n) {
+			const int limit = int(std::min<size_t>(max_match, n - pos));
+			int32_t candidate = head[hash(pos)];
+			for (int chain = 0; candidate >= 0 && pos - candidate <= size_t(window) && chain < max_chain; ++chain) {
+				int length = 0;
+				while (length < limit && data[candidate + length] == data[pos + length])
+					++length;
+				if (length > best_length) {
+					best_length = length;
+					best_distance = int(pos - candidate);
+					if (length == limit)
+						break;
+				}
+				candidate = prev[candidate & (window - 1)];
+			}
+		}
+
+		if (best_length >= 3) {
+			int l = 28;
+			while (length_base[l] > best_length)
+				--l;
+			put_symbol(257 + l);
+			bits.put(best_length - length_base[l], length_extra[l]);
+			int d = 29;
+			while (distance_base[d] > best_distance)
+				--d;
+			bits.put_code(d, 5);
+			bits.put(best_distance - distance_base[d], distance_extra[d]);
+			for (int k = 0; k < best_length; ++k)
+				insert(pos + k);
+			pos += best_length;
+		}
+		else {
+			put_symbol(data[pos]);
+			insert(pos);
+			++pos;
+		}
+	}
+	put_symbol(256); // end of block
+	bits.flush();
+}
+
+inline uint32_t crc32(const uint8_t* data, size_t n, uint32_t crc = 0) {
+	static const std::vector<uint32_t> table = [] {
+		std::vector<uint32_t> t(256);
+		for (uint32_t k = 0; k < 256; ++k) {
+			uint32_t c = k;
+			for (int b = 0; b < 8; ++b)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			t[k] = c;
+		}
+		return t;
+	}();
+	crc = ~crc;
+	for (size_t k = 0; k < n; ++k)
+		crc = table[(crc ^ data[k]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+inline uint32_t adler32(const uint8_t* data, size_t n) {
+	uint32_t a = 1, b = 0;
+	while (n > 0) {
+		size_t block = std::min<size_t>(n, 5552); // the most we can add up before b could overflow
+		for (size_t k = 0; k < block; ++k) {
+			a += data[k];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		data += block;
+		n -= block;
+	}
+	return (b << 16) | a;
+}
+
+inline void append_u32_big_endian(std::string& out, uint32_t v) {
+	out.push_back(char(v >> 24));
+	out.push_back(char(v >> 16));
+	out.push_back(char(v >> 8));
+	out.push_back(char(v));
+}
+
+inline void append_png_chunk(std::string& out, const char* type, const std::string& data) {
+	append_u32_big_endian(out, uint32_t(data.size()));
+	std::string body = type + data;
+	out += body;
+	append_u32_big_endian(out, crc32(reinterpret_cast<const uint8_t*>(body.data()), body.size()));
+}
+
+inline int paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+}
+
+inline std::string encode_png(const image8& image) {
+	const size_t stride = size_t(image.width) * 3;
+
+	// Filter each row with whichever predictor leaves the smallest residuals
+	// (the usual "minimum sum of absolute differences" guess)
+	std::vector<uint8_t> filtered;
+	filtered.reserve((stride + 1) * image.height);
+	std::vector<uint8_t> candidate(stride), best(stride);
+	const std::vector<uint8_t> zero_row(stride, 0);
+	for (int y = 0; y < image.height; ++y) {
+		const uint8_t* row = &image.rgb[y * stride];
+		const uint8_t* up = y > 0 ? row - stride : zero_row.data();
+		long best_cost = -1;
+		int best_filter = 0;
+		for (int filter = 0; filter < 5; ++filter) {
+			long cost = 0;
+			for (size_t k = 0; k < stride; ++k) {
+				int left = k >= 3 ? row[k - 3] : 0;
+				int up_left = k >= 3 ? up[k - 3] : 0;
+				int predicted = 0;
+				switch (filter) {
+				case 1: predicted = left; break;
+				case 2: predicted = up[k]; break;
+				case 3: predicted = (left + up[k]) / 2; break;
+				case 4: predicted = paeth(left, up[k], up_left); break;
+				}
+				candidate[k] = uint8_t(row[k] - predicted);
+				cost += abs(int(int8_t(candidate[k])));
+			}
+			if (best_cost < 0 || cost < best_cost) {
+				best_cost = cost;
+				best_filter = filter;
+				best.swap(candidate);
+			}
+		}
+		filtered.push_back(uint8_t(best_filter));
+		filtered.insert(filtered.end(), best.begin(), best.end());
+	}
+
+	std::string zlib = { char(0x78), char(0x01) }; // deflate, 32K window, no dictionary
+	deflate_fixed(filtered.data(), filtered.size(), zlib);
+	append_u32_big_endian(zlib, adler32(filtered.data(), filtered.size()));
+
+	std::string header;
+	append_u32_big_endian(header, uint32_t(image.width));
+	append_u32_big_endian(header, uint32_t(image.height));
+	header += { char(8), char(2), char(0), char(0), char(0) }; // 8 bits per channel, RGB, no interlacing
+
+	std::string out = "\x89PNG\r\n\x1a\n";
+	append_png_chunk(out, "IHDR", header);
+	append_png_chunk(out, "IDAT", zlib);
+	append_png_chunk(out, "IEND", "");
+	return out;
+}
+
+inline std::string encode_image(const image8& image, image_format format) {
+	switch (format) {
+	case image_format::p3: return encode_p3(image);
+	case image_format::p6: return encode_p6(image);
+	case image_format::png: return encode_png(image);
+	case image_format::pfm: {
+		std::vector<float> rgb(image.rgb.size());
+		const size_t stride = size_t(image.width) * 3;
+		for (int y = 0; y < image.height; ++y) // back to bottom row first
+			for (size_t k = 0; k < stride; ++k)
+				rgb[(image.height - 1 - y) * stride + k] = image.rgb[y * stride + k] / 255.0f;
+		return encode_pfm(image.width, image.height, rgb);
+	}
+	}
+	return std::string();
+}
+
+inline std::string encode_image(const framebuffer& image, image_format format) {
+	if (format == image_format::pfm)
+		return encode_pfm(image.width, image.height, resolve_linear(image));
+	return encode_image(resolve(image), format);
+}
+
+///////////////// Output /////////////////
+
+// out.png + "_albedo" -> out_albedo.png (the suffix goes before the extension, if there is one)
+inline std::string insert_before_extension(const std::string& path, const std::string& suffix) {
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + suffix;
+	return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+inline bool write_file(const std::string& path, const std::string& bytes) {
+	std::ofstream out(path, std::ios::binary);
+	out.write(bytes.data(), std::streamsize(bytes.size()));
+	if (!out) {
+		std::cerr << "Couldn't write " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+// Writes a temporary file first and then renames it over the old one, so getting killed (or
+// something reading the file) halfway through never sees a half written one
+inline bool replace_file(const std::string& path, const std::string& bytes) {
+	std::string temp = path + ".tmp";
+	if (!write_file(temp, bytes))
+		return false;
+#ifdef _WIN32
+	std::remove(path.c_str()); // windows won't rename over an existing file
+#endif
+	if (std::rename(temp.c_str(), path.c_str()) != 0) {
+		std::cerr << "Couldn't replace " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+inline void write_stdout(const std::string& bytes) {
+#ifdef _WIN32
+	// Otherwise windows turns every \n byte into \r\n, which breaks the binary formats
+	std::cout.flush();
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	std::cout.write(bytes.data(), std::streamsize(bytes.size()));
+	std::cout.flush();
+}
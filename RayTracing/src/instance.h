@@ -0,0 +1,345 @@
+/******************************************************************************
+Trevor's thoughts:
+Scenes tend to repeat themselves: the same tree, chair or rock, placed a
+thousand times. Copying its spheres and triangles for every copy means a
+thousand times the memory, and a BVH build over all of it. Instead, a group
+(scene.h) gets built once - its own sphere_set and meshes, each with its own
+BVH (the "bottom level") - and every copy is an instance: a pointer to that
+shared group, plus where to put it (an affine transform: scale, rotate,
+translate). An instance costs the same couple hundred bytes whatever's in it.
+
+A ray doesn't need the group moved to meet it - the instance moves the ray
+instead. The inverse transform takes the ray into the group's own space, the
+group's BVH finds the hit there, and the point and normal get taken back out.
+The direction doesn't get normalized along the way, so t means the same thing
+in both spaces, and hits from different instances (and whatever else is in the
+scene) can be compared as is.
+
+The instances themselves go in a BVH of their own (instance_bvh, the "top
+level"), over each one's box in world space. Moving an instance only changes
+its transform and its box - the group's tree doesn't care where it is - so
+after moving some, the top level gets refit (bvh.h) and that's it. (Same deal
+as the spheres in a sequence: refit while the tree holds up, rebuild when it
+doesn't - sah_cost.)
+
+Only two levels: a group can't hold instances. Each instance gets its own
+object_id (for the denoiser, and so a light in a group can't get mistaken for
+one that lights.h samples - lights inside groups only get found by bouncing
+into them).
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// x -> M x + t, with M any invertible 3x3 matrix (rows m[i][0..2], and t in m[i][3])
+class affine_transform {
+public:
+	affine_transform() {
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 4; ++j)
+				m[i][j] = i == j ? 1 : 0;
+	}
+
+	static affine_transform translate(const vec3& offset) {
+		affine_transform result;
+		for (int i = 0; i < 3; ++i)
+			result.m[i][3] = offset[i];
+		return result;
+	}
+
+	static affine_transform scale(const vec3& factors) {
+		affine_transform result;
+		for (int i = 0; i < 3; ++i)
+			result.m[i][i] = factors[i];
+		return result;
+	}
+
+	// Counter-clockwise by degrees, looking down axis (any length) at the origin
+	static affine_transform rotate(const vec3& axis, double degrees) {
+		vec3 a = unit_vector(axis);
+		double theta = degrees_to_radians(degrees);
+		double c = std::cos(theta), s = std::sin(theta);
+		double x = double(a.x()), y = double(a.y()), z = double(a.z());
+		// Rodrigues' rotation formula, as a matrix
+		double r[3][3] = {
+			{ c + x * x * (1 - c),     x * y * (1 - c) - z * s, x * z * (1 - c) + y * s },
+			{ y * x * (1 - c) + z * s, c + y * y * (1 - c),     y * z * (1 - c) - x * s },
+			{ z * x * (1 - c) - y * s, z * y * (1 - c) + x * s, c + z * z * (1 - c) },
+		};
+		affine_transform result;
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				result.m[i][j] = real(r[i][j]);
+		return result;
+	}
+
+	// This transform, followed by next
+	affine_transform then(const affine_transform& next) const {
+		affine_transform result;
+		for (int i = 0; i < 3; ++i) {
+			for (int j = 0; j < 4; ++j) {
+				double sum = j == 3 ? double(next.m[i][3]) : 0;
+				for (int k = 0; k < 3; ++k)
+					sum += double(next.m[i][k]) * double(m[k][j]);
+				result.m[i][j] = real(sum);
+			}
+		}
+		return result;
+	}
+
+	// (in double, and rounded once at the end)
+	affine_transform inverse() const {
+		double a[3][3];
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				a[i][j] = double(m[i][j]);
+		// The adjugate (transposed cofactors), over the determinant
+		double c[3][3];
+		for (int i = 0; i < 3; ++i) {
+			for (int j = 0; j < 3; ++j) {
+				int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+				c[i][j] = a[i1][j1] * a[i2][j2] - a[i1][j2] * a[i2][j1];
+			}
+		}
+		double det = a[0][0] * c[0][0] + a[0][1] * c[1][0] + a[0][2] * c[2][0];
+		affine_transform result;
+		for (int i = 0; i < 3; ++i) {
+			double offset = 0;
+			for (int j = 0; j < 3; ++j) {
+				result.m[i][j] = real(c[i][j] / det);
+				offset -= c[i][j] / det * double(m[j][3]);
+			}
+			result.m[i][3] = real(offset);
+		}
+		return result;
+	}
+
+	// 0 -> squashed flat (no inverse). Negative -> it mirrors.
+	double determinant() const {
+		double a[3][3];
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				a[i][j] = double(m[i][j]);
+		return a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+			- a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+			+ a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+	}
+
+	point3 point(const point3& p) const {
+		return point3(
+			m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+			m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+			m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+	}
+
+	vec3 vector(const vec3& v) const {
+		return vec3(
+			m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+			m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+			m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+	}
+
+	// M^T v. A normal goes from object to world space through the inverse's transpose, which is
+	// this on the inverse transform (and doesn't need a third matrix around).
+	vec3 transposed_vector(const vec3& v) const {
+		return vec3(
+			m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+			m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+			m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+	}
+
+	// The smallest box around the transformed box (Arvo, "Transforming Axis-Aligned Bounding Boxes",
+	// Graphics Gems 1990): the center moves, and each axis' half width is what every axis adds to it
+	aabb box(const aabb& b) const {
+		point3 center = point(b.centroid());
+		vec3 half = real(0.5) * (b.max() - b.min());
+		vec3 extent(0, 0, 0);
+		for (int i = 0; i < 3; ++i)
+			extent[i] = std::abs(m[i][0]) * half.x() + std::abs(m[i][1]) * half.y() + std::abs(m[i][2]) * half.z();
+		return aabb(center - extent, center + extent);
+	}
+
+	// How much the biggest component of a vector can grow (the max row sum of |M|) - for
+	// carrying spawn_offset out of object space
+	real max_stretch() const {
+		real stretch = 0;
+		for (int i = 0; i < 3; ++i)
+			stretch = std::max(stretch, std::abs(m[i][0]) + std::abs(m[i][1]) + std::abs(m[i][2]));
+		return stretch;
+	}
+
+public:
+	real m[3][4];
+};
+
+// A shared group of geometry (the bottom level), placed in the world by a transform
+class instance : public hittable {
+public:
+	instance(shared_ptr<hittable> geometry, const affine_transform& to_world, uint32_t object_id)
+		: geometry(geometry), object_id(object_id) {
+		place(to_world);
+	}
+
+	// Moves it. Call the instance_bvh's refit() (or build()) after moving any of its instances.
+	void place(const affine_transform& transform) {
+		to_world = transform;
+		to_object = transform.inverse();
+		stretch = transform.max_stretch();
+		aabb local;
+		if (geometry->bounding_box(local))
+			world_box = to_world.box(local);
+		else
+			world_box = aabb();
+	}
+
+	const affine_transform& placement() const { return to_world; }
+
+	virtual bool intersect(const ray& r, real t_min, ray_hit& hit) const override {
+		// t_max (hit.t) carries straight over: the direction isn't normalized, so t is the same in both spaces
+		ray_hit local = { hit.t, 0, nullptr };
+		if (!geometry->intersect(object_ray(r), t_min, local))
+			return false;
+		hit.t = local.t;
+		hit.primitive = local.primitive;
+		hit.object = this;
+		hit.inner = local.object;
+		return true;
+	}
+
+	virtual void fill_hit_record(const ray& r, const ray_hit& hit, hit_record& rec) const override {
+		ray_hit local = hit;
+		local.object = hit.inner;
+		local.inner = nullptr;
+		hit.inner->fill_hit_record(object_ray(r), local, rec);
+		// The normal was already turned to face the (object space) ray, and transforming it this
+		// way keeps it facing the world space one, so front_face stays as it was
+		rec.p = to_world.point(rec.p);
+		rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+		rec.spawn_offset = rec.spawn_offset * stretch + surface_error_scale * max_abs_component(rec.p);
+		rec.object_id = object_id;
+	}
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override {
+		return geometry->occluded(object_ray(r), t_min, t_max);
+	}
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		output_box = world_box;
+		return world_box.minimum.x() <= world_box.maximum.x();
+	}
+
+private:
+	ray object_ray(const ray& r) const {
+		return ray(to_object.point(r.origin()), to_object.vector(r.direction()));
+	}
+
+public:
+	shared_ptr<hittable> geometry; // a sphere_set, a mesh, or a hittable_list of those - no instances
+	uint32_t object_id;            // hit_record::object_id for everything in it
+
+private:
+	affine_transform to_world, to_object;
+	aabb world_box;
+	real stretch = 1; // to_world.max_stretch()
+};
+
+// Entering an instance (transforming the ray, and testing the group's root box) costs a few traversal steps
+const double instance_primitive_cost = 3.0;
+
+// The top level: a BVH over instances. The instances are kept in leaf order (build() shuffles them),
+// so each leaf is a contiguous run, like sphere_set's spheres.
+class instance_bvh : public hittable {
+public:
+	void add(const instance& i) { instances.push_back(i); }
+	size_t size() const { return instances.size(); }
+
+	void build(int threads = 0) {
+		std::vector<uint32_t> order;
+		basic_bvh_builder<instance_bounds>(bounds(), 4, instance_primitive_cost).build(nodes, order, setup_thread_count(threads));
+		std::vector<instance> sorted;
+		sorted.reserve(order.size());
+		for (auto k : order)
+			sorted.push_back(instances[k]);
+		instances = std::move(sorted);
+	}
+
+	// After place()-ing some of the instances: fixes up the boxes, without touching any group's tree
+	void refit(int threads = 0) {
+		refit_bvh(nodes.data(), nodes.size(), bounds(), setup_thread_count(threads));
+	}
+
+	// How good the tree is (bvh_sah_cost) - goes up as refits stretch it out of shape
+	double sah_cost() const {
+		return bvh_sah_cost(nodes.data(), nodes.size(), instance_primitive_cost);
+	}
+
+	// The instances and the tree (not the groups they share)
+	size_t memory_bytes() const {
+		return instances.size() * sizeof(instance) + nodes.size() * sizeof(bvh_node);
+	}
+
+	virtual bool intersect(const ray& r, real t_min, ray_hit& hit) const override {
+		if (nodes.empty())
+			return false;
+		return traverse_bvh(nodes.data(), r, t_min, hit.t, [&](uint32_t first, uint32_t count, real&) {
+			bool hit_anything = false;
+			for (uint32_t k = first; k < first + count; ++k) {
+				if (instances[k].intersect(r, t_min, hit))
+					hit_anything = true;
+			}
+			return hit_anything;
+		});
+	}
+
+	virtual void fill_hit_record(const ray& r, const ray_hit& hit, hit_record& rec) const override {
+		hit.object->fill_hit_record(r, hit, rec); // (hit.object is the instance that found it)
+	}
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override {
+		if (nodes.empty())
+			return false;
+		return any_hit_bvh(nodes.data(), r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+			for (uint32_t k = first; k < first + count; ++k) {
+				if (instances[k].occluded(r, t_min, t_max))
+					return true;
+			}
+			return false;
+		});
+	}
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		if (nodes.empty())
+			return false;
+		output_box = nodes[0].box;
+		return true;
+	}
+
+private:
+	// What the BVH builder sees of the instances (see box_list in bvh.h)
+	struct instance_bounds {
+		const instance* instances;
+		size_t count;
+
+		size_t size() const { return count; }
+		aabb box(uint32_t k) const {
+			aabb b;
+			instances[k].bounding_box(b);
+			return b;
+		}
+	};
+
+	instance_bounds bounds() const { return { instances.data(), instances.size() }; }
+
+public:
+	std::vector<instance> instances;
+	std::vector<bvh_node> nodes;
+};
@@ -0,0 +1,328 @@
+#pragma once
+
+#include "rtweekend.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+/*
+As a physics major, I'm amazed how well this simple model is working, despite a lot of assumptions, and missing elemnents.
+This author's done a great job so far, so I'm sure we're getting to at least some of these, but here's a few
+thoughts for improvement, just in case:
+1) We have no light sources (update: now we do - lights.h). This was confusing to me at first. Rather than light, we just return the background when we
+don't hit anything. I guess this is kind of like a foggy day, when looking any direction is just the same brightness, 
+with no apparent source/direction to the light. It's basically all secondary scattering...Kind of a cool work around.
+2) ray tracing is expensive: Why not turn down the sample count, record you first contact object, creating a
+	mask, and smoothing within that mask...
+	- OK, for a "perfect" render, this model is simpler, and more accurate, but the CPU time is getting a
+	bit crazy (maybe not too bad with shaders, but I imagine you would want to process as many objects as
+	possible, and some large/realistic scenes (I'm talking modern triangles, not just spheres) could have
+	many objects, and potentially high frame rates
+		- You could blur on secondary objects too, but I'm not sure that would really be needed
+		- Not sure if it's worth it, but you could also blur in a scaled space...I don't have my intuition,
+		so I'm just throwing ideas around, but converting to RMS / log / exp space and then blurring might be interesting.
+		The main effect would be how much you let anomalous pixels pull their surroundings, rather than getting 
+		pulled in.
+		- Also, why used random rays? Would sub-pixel rays for interpolated contributions make more sense?
+			- You could get more even distribution
+			- You could re-uses a weighted contribution of each ray on the 4 pixels whose centers it would be between
+3) I'm sure we'll get to more reflective surfaces...curious how we'll approach those
+	- If we got really deep, we might address the changes to light as reflections approach 90 degrees off of the normal
+		- The light becomes polarized (which probably doesn't matter in 99% of simulations, though lots of 
+		modern glass/windows will never look quite right)
+		- I'm pretty sure it also loses saturation. I understand why it wouldn't be in this tutorial, but 
+		a bright room, with direct sunlight should get hotspots, and change in color on reflective surfaces
+4) I peaked ahead, so I know we'll be dealing with transparent objects
+	- Will they be pure transparent models, or include translucent scattered (which could be done with pure ray
+	tracer, or more computationally efficient with a skin depth model)
+
+*/
+// Why a path ended (for --path-stats)
+enum class path_end { escaped, absorbed, roulette, max_depth };
+const int num_path_ends = 4;
+
+// How many paths ended after how many bounces, and why
+class path_stats {
+public:
+	void record(path_end reason, int bounces) {
+		if (bounces >= int(counts.size()))
+			counts.resize(bounces + 1, std::array<uint64_t, num_path_ends>());
+		++counts[bounces][int(reason)];
+	}
+
+	void merge(const path_stats& other) {
+		for (size_t b = 0; b < other.counts.size(); ++b)
+			for (int reason = 0; reason < num_path_ends; ++reason)
+				record_n(path_end(reason), int(b), other.counts[b][reason]);
+	}
+
+	void print(std::ostream& out) const {
+		const char* names[num_path_ends] = { "escaped", "absorbed", "roulette", "max depth" };
+		uint64_t paths = 0, bounces = 0;
+		out << "bounces";
+		for (auto name : names)
+			out << std::setw(12) << name;
+		out << '\n';
+		for (size_t b = 0; b < counts.size(); ++b) {
+			out << std::setw(7) << b;
+			for (int reason = 0; reason < num_path_ends; ++reason) {
+				out << std::setw(12) << counts[b][reason];
+				paths += counts[b][reason];
+				bounces += counts[b][reason] * b;
+			}
+			out << '\n';
+		}
+		out << "Average path length: " << (paths ? double(bounces) / paths : 0.0) << " bounces over " << paths << " paths\n";
+	}
+
+	// Paths that ended each way, whatever their length: [reason]
+	std::array<uint64_t, num_path_ends> totals() const {
+		std::array<uint64_t, num_path_ends> total = {};
+		for (const auto& row : counts)
+			for (int reason = 0; reason < num_path_ends; ++reason)
+				total[reason] += row[reason];
+		return total;
+	}
+
+	// Rays that went through world.hit: a path that escaped after b bounces traced b + 1
+	// (the last one missed), one that ended any other way after b bounces traced b
+	uint64_t rays() const {
+		uint64_t total = 0;
+		for (size_t b = 0; b < counts.size(); ++b) {
+			total += counts[b][int(path_end::escaped)] * (b + 1);
+			for (int reason = 1; reason < num_path_ends; ++reason)
+				total += counts[b][reason] * b;
+		}
+		return total;
+	}
+
+public:
+	std::vector<std::array<uint64_t, num_path_ends>> counts; // [bounces][reason]
+
+private:
+	void record_n(path_end reason, int bounces, uint64_t n) {
+		if (bounces >= int(counts.size()))
+			counts.resize(bounces + 1, std::array<uint64_t, num_path_ends>());
+		counts[bounces][int(reason)] += n;
+	}
+};
+
+// Each thread counts into its own path_stats (see stats.h)
+inline path_stats& thread_path_stats() { return thread_stats<path_stats>(); }
+
+// Everybody's counts added up (call it once the render threads are done)
+inline path_stats total_path_stats() { return total_stats<path_stats>(); }
+
+// Russian roulette: after roulette_start bounces, a path whose throughput t has dropped
+// below roulette_threshold keeps going with probability p = max(t.r, t.g, t.b) / threshold,
+// and survivors get divided by p. On average that's exactly what we'd have gotten by
+// following every path all the way (so the image doesn't change), but the dim paths that
+// can barely contribute anything mostly stop, instead of bouncing around until max_depth.
+// Bright paths are never killed: every kill adds noise, and those are the paths that matter.
+// (Killing with p = max(t) straight away was ~2x worse in noise per unit of work.)
+const int roulette_start = 3;
+const real roulette_threshold = real(0.25);
+
+inline real max_component(const color& c) {
+	return std::max(c.x(), std::max(c.y(), c.z()));
+}
+
+// Returns false if the path got killed, otherwise scales the throughput up to make up for it
+inline bool survive_roulette(color& throughput, int bounces, sampler& gen) {
+	if (bounces < roulette_start)
+		return true;
+	real p = max_component(throughput) / roulette_threshold;
+	if (p >= 1)
+		return true;
+	if (gen.get_1d() >= p)
+		return false;
+	throughput /= p;
+	return true;
+}
+
+// Sky color for rays that don't hit anything (light_list::sky scales it)
+inline color background(const ray& r) {
+	// Create background/horizon (blue to white fade)
+	vec3 unit_direction = unit_vector(r.direction());
+	// ensure 0-1, since direction magnitudes range: -1 to 1
+	auto hit = real(0.5)*(unit_direction.y() + 1);
+	// Linear Interpolation (LERP) between white(1,1,1), and blue(0.5,0.7,1.0)
+	return (1 - hit) * color(1, 1, 1) + hit * color(real(0.5), real(0.7), 1);
+}
+
+// Veach's power heuristic: how much of a light's contribution goes to the technique that found
+// it with pdf f, when the other one would have found it with pdf g
+inline real power_heuristic(real f, real g) {
+	real f2 = f * f, g2 = g * g;
+	return f2 + g2 > 0 ? f2 / (f2 + g2) : 0;
+}
+
+// Shadow rays stop this far short of the light (as a fraction of the distance), so they can't hit the light itself
+const real shadow_ray_margin = real(1e-3);
+
+// Next event estimation at a lambertian hit (lights.h): picks a point on a light, and if nothing's
+// in the way, returns the light it sends along the path (times the path's throughput so far, that's
+// what the path picks up), weighted against the bounce having found the same light.
+// Always takes the same sample dimensions, whether or not the light counts.
+inline color sample_direct_light(
+	const hit_record& rec, const color& albedo, const hittable& world, const light_list& lights, sampler& gen
+) {
+	real pick = gen.get_1d();
+	point2 uv = gen.get_2d();
+	light_sample light;
+	if (!lights.sample(rec.p, pick, uv, light))
+		return color(0, 0, 0);
+	real cosine = dot(rec.normal, light.direction);
+	if (cosine <= 0)
+		return color(0, 0, 0);
+	RT_COUNT(shadow_rays);
+	if (world.occluded(spawn_ray(rec, light.direction), 0, light.distance * (1 - shadow_ray_margin)))
+		return color(0, 0, 0);
+	// lambertian: brdf = albedo / pi, and its own bounces have pdf = cosine / pi
+	real bsdf_pdf = cosine / pi;
+	real weight = power_heuristic(light.pdf, bsdf_pdf);
+	return albedo * light.radiance * (bsdf_pdf * weight / light.pdf);
+}
+
+// Where a path last bounced, for weighting the light it runs into (see emitted_light)
+struct path_vertex {
+	point3 p;
+	real bsdf_pdf = 0; // pdf of the bounce that left p. 0: the camera, or a mirror/glass bounce (nothing to weigh against)
+};
+
+// The light a path picks up from hitting rec (only lights glow), weighted against next event
+// estimation having found it from the last bounce
+inline color emitted_light(const ray& r, const hit_record& rec, const path_vertex& from, const material& m, const light_list& lights) {
+	color emitted = m.emitted(rec);
+	if (from.bsdf_pdf <= 0)
+		return emitted;
+	return emitted * power_heuristic(from.bsdf_pdf, lights.pdf(from.p, unit_vector(r.direction()), rec));
+}
+
+// Where a bounce leaves rec from, for the next emitted_light (lambertian is the only one next
+// event estimation samples - the rest are as good as mirrors)
+inline path_vertex bounce_vertex(const hit_record& rec, const material& m, const ray& scattered) {
+	path_vertex v;
+	v.p = rec.p;
+	if (m.type() == material_type::lambertian)
+		v.bsdf_pdf = std::max(dot(rec.normal, unit_vector(scattered.direction())), real(0)) / pi;
+	return v;
+}
+
+// Follows a path whose first hit has already been found (rec == nullptr means it missed everything).
+// Split out of ray_color so the packet tracer (packet.h) can find the first hits itself.
+// This used to recurse (ray_color -> shade -> ray_color ... up to 50 deep), multiplying the
+// attenuations on the way back up. Now it's a loop that carries the product (throughput)
+// forward, so it needs no stack, and can stop early with Russian roulette.
+// Light gets picked up along the way (radiance): from the sky when the path escapes, from any
+// light it hits, and from the lights next event estimation finds at each lambertian bounce.
+inline color shade(
+	ray r, const hit_record* rec, const hittable& world, const material_table& materials, const light_list& lights,
+	int depth, sampler& gen
+) {
+	color throughput(1, 1, 1);
+	color radiance(0, 0, 0);
+	path_vertex from; // (the camera)
+	hit_record next;
+	for (int bounces = 0; ; ++bounces) {
+		if (!rec) {
+			thread_path_stats().record(path_end::escaped, bounces);
+			return radiance + throughput * (lights.sky * background(r));
+		}
+
+		const material& m = materials[rec->mat_id];
+		if (m.type() == material_type::diffuse_light)
+			radiance += throughput * emitted_light(r, *rec, from, m, lights);
+
+		ray scattered;
+		color attenuation;
+		gen.start_bounce(depth); // every bounce gets its own block of sample dimensions (see sampler.h)
+		if (!m.scatter(r, *rec, attenuation, scattered, gen)) {
+			thread_path_stats().record(path_end::absorbed, bounces + 1);
+			return radiance;
+		}
+		if (!lights.empty()) {
+			if (m.type() == material_type::lambertian)
+				radiance += throughput * sample_direct_light(*rec, attenuation, world, lights, gen);
+			from = bounce_vertex(*rec, m, scattered);
+		}
+
+		//// Lambertian reflection off of diffuse surfaces (2 options with very similar effects...to my eye at least)
+		//// Option 1: using this for now...seems closest to my understanding after reading the wiki
+		//point3 target = rec.p + rec.normal + random_unit_vector(); // random ray coming off of target pointing towards random point in the unit sphere
+		//// Option 2: Very similar render (I can't tell the difference (look up Lambertian Diffuse)
+		////point3 target = rec.p + random_in_hemisphere(rec.normal);
+		//return GAMMA * ray_color(ray(rec.p, target - rec.p), world, depth - 1);
+
+		//vec3 N = unit_vector(r.at(hit) - vec3(0, 0, -1));
+		//return 0.5*color(N.x() + 1, N.y() + 1, N.z() + 1); // (x+1)*.5 shifts -1 -> 1 distribution to 0 -> 1 
+
+		//return 0.5 *  (rec.normal + color(1, 1, 1)); // still just a representation of the normal (not a real physics based reflection)
+		
+		//return color(1, 0, 0); // red sphere
+
+		throughput = throughput * attenuation;
+		if (--depth <= 0) { // max_depth is just a hard cap now - roulette stops almost every path well before it
+			thread_path_stats().record(path_end::max_depth, bounces + 1);
+			return radiance;
+		}
+		if (!survive_roulette(throughput, bounces + 1, gen)) {
+			thread_path_stats().record(path_end::roulette, bounces + 1);
+			return radiance;
+		}
+
+		r = scattered;
+		// t_min = 0: see "shadow acne" in ray_color
+		rec = world.hit(r, 0, infinity, next) ? &next : nullptr;
+		RT_END_RAY(bounces + 1);
+	}
+}
+
+// The AOVs for a camera ray, from its first hit (rec == nullptr if it missed everything).
+// luminance_sq waits for the sample's color.
+inline aov_sample first_hit_aovs(const ray& r, const hit_record* rec, const material_table& materials, const light_list& lights) {
+	aov_sample aov;
+	if (!rec) {
+		aov.albedo = lights.sky * background(r);
+		return aov;
+	}
+	aov.albedo = materials[rec->mat_id].albedo();
+	aov.normal = rec->normal;
+	aov.depth = rec->t * r.direction().length();
+	aov.object = rec->object_id;
+	return aov;
+}
+
+// first_hit: if not nullptr, gets the AOVs for r's first hit
+inline color ray_color(
+	const ray& r, const hittable& world, const material_table& materials, const light_list& lights, int depth, sampler& gen,
+	aov_sample* first_hit = nullptr
+) {
+	if (depth <= 0)
+		return  color(0, 0, 0);
+
+	hit_record rec;
+
+	// limit lower end of range to avoid floating a reflected ray hitting the spot it reflected off of...
+	// This is a bug that can occur because of floating point precision. You start the ray where the last one collided,
+	// but that could be +/-0.0000000000000000001 (or however many 0's). Then the ray could technically be inside the sphere
+	// when it's created. This happens a lot, causing a speckling problem, called "shadow acne". This impact is way bigger than
+	// I expected. Without this fix, repeated reflection were slowing the render down a ton (I think most rays would reflect once or twice,
+	// but must have ended up reflecting max_depth times because of this). Also, the "acne" is very pronounced. It looked very noisy. 
+	// I'm very glad the tutorial pointed this out, because it would have taken me forever to find this one!
+	// Update: the tutorial's fix was ignoring hits closer than t = 0.001. Now scattered rays start
+	// just off of the surface instead (spawn_ray, hittable.h), so nothing needs ignoring: t_min = 0.
+	bool hit_anything = world.hit(r, 0, infinity, rec);
+	RT_END_RAY(0);
+	if (first_hit)
+		*first_hit = first_hit_aovs(r, hit_anything ? &rec : nullptr, materials, lights);
+	return shade(r, hit_anything ? &rec : nullptr, world, materials, lights, depth, gen);
+}
@@ -0,0 +1,257 @@
+/******************************************************************************
+Trevor's thoughts:
+Back in integrator.h I noted that we have no light sources - a path only picks
+up any light when it happens to fly off into the sky. That's fine for a sky
+that lights everything evenly, but a small bright lamp would almost never get
+found that way, and the few paths that do find it are the fireflies.
+
+So now there are lights: any sphere or mesh whose material is a diffuse_light
+(material.h). Every time a path lands on something diffuse, it also picks a
+point on one of the lights and asks the scene whether anything's in the way
+(occluded() - an any-hit query, so it stops at the first blocker instead of
+looking for the closest one). That's "next event estimation": every diffuse
+bounce gets a shot at every light, instead of only the ones it happens to
+bounce into.
+	- Which light: picked by power (brightness x surface area), so the lamps
+	  that matter most get the most samples
+	- Spheres get sampled by the cone of directions they cover, as seen from
+	  the hit point (every sample lands on the sphere, and on the side facing
+	  us - sampling its whole surface would waste half on the back)
+	- Meshes get a triangle picked by area, then a uniform point on it
+A path can still bounce into a light on its own, too. Both ways count, and
+multiple importance sampling (Veach's power heuristic) weights each by how
+likely it was to find that light, compared to the other way. Light samples win
+for small lights (a bounce would rarely find them), bounces win for big, close
+ones seen at a grazing angle (where the light sample's odds get thin). Either
+way nothing's counted twice, and nothing's lost.
+
+The sky isn't in here. It still only counts when a path escapes (it's the
+whole sky, so bounces find it fine), but its brightness can be turned down
+(sky r g b in a scene file), so the lights can do the work.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "color.h"
+#include "hittable.h"
+#include "material.h"
+#include "sampler.h"
+#include "sphere_set.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+// A point on a light, as seen from a hit point
+struct light_sample {
+	vec3 direction; // unit, from the hit point toward the light
+	real distance;  // to the point on the light
+	color radiance; // what the light sends back along direction
+	real pdf;       // per unit solid angle, including the odds of picking this light
+};
+
+// Two unit vectors perpendicular to n (and each other). Branchless: Duff et al., "Building an
+// Orthonormal Basis, Revisited" (JCGT 2017).
+inline void orthonormal_basis(const vec3& n, vec3& b1, vec3& b2) {
+	real sign = std::copysign(real(1), n.z());
+	real a = -1 / (sign + n.z());
+	real b = n.x() * n.y() * a;
+	b1 = vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+	b2 = vec3(b, sign + n.y() * n.y() * a, -n.y());
+}
+
+class light_list {
+public:
+	bool empty() const { return lights.empty(); }
+	size_t size() const { return lights.size(); }
+
+	// A (solid) sphere with an emissive material: k of a sphere_set -> object_id k
+	void add_sphere(const point3& center, real radius, const color& emit, uint32_t object_id) {
+		light l;
+		l.center = center;
+		l.radius = radius;
+		l.emit = emit;
+		add(l, object_id, 4 * pi * radius * radius);
+	}
+
+	// A mesh with an emissive material (built already - the triangles are in their final order)
+	void add_mesh(const triangle_mesh& mesh, const color& emit) {
+		light l;
+		l.mesh = &mesh;
+		l.emit = emit;
+		l.first_triangle = triangle_cdf.size();
+		double area = 0;
+		for (size_t k = 0; k < mesh.num_triangles(); ++k) {
+			area += double(triangle_area(mesh, k));
+			triangle_cdf.push_back(real(area));
+		}
+		if (area <= 0) {
+			triangle_cdf.resize(l.first_triangle);
+			return;
+		}
+		add(l, mesh.object_id, real(area));
+	}
+
+	// Picks a light (pick) and a point on it (uv), as seen from p. False if there's nothing to
+	// see from here: p's inside the sphere, or behind the triangle.
+	bool sample(const point3& p, real pick, point2 uv, light_sample& out) const {
+		real target = pick * total_power;
+		size_t k = std::upper_bound(power_cdf.begin(), power_cdf.end(), target) - power_cdf.begin();
+		k = std::min(k, lights.size() - 1);
+		const light& l = lights[k];
+		real odds = l.power / total_power;
+
+		if (!l.mesh) {
+			vec3 to_center = l.center - p;
+			real d2 = to_center.length_squared();
+			real r2 = l.radius * l.radius;
+			if (d2 <= r2)
+				return false;
+			real d = std::sqrt(d2);
+			real cone = cone_size(d2, r2);
+			real cos_theta = 1 - uv.u * cone;
+			real sin_theta = std::sqrt(std::max(real(0), 1 - cos_theta * cos_theta));
+			real phi = 2 * pi * uv.v;
+			vec3 w = to_center / d, b1, b2;
+			orthonormal_basis(w, b1, b2);
+			out.direction = unit_vector(cos_theta * w + sin_theta * std::cos(phi) * b1 + sin_theta * std::sin(phi) * b2);
+			// Where that direction enters the sphere (the near side)
+			out.distance = d * cos_theta - std::sqrt(std::max(real(0), r2 - d2 * sin_theta * sin_theta));
+			out.radiance = l.emit;
+			out.pdf = odds / (2 * pi * cone);
+			return true;
+		}
+
+		// Which triangle: reuse what's left of pick (it only had to land in this light's slice)
+		real low = k > 0 ? power_cdf[k - 1] : 0;
+		real within = clamp((target - low) / l.power, real(0), real(1));
+		auto first = triangle_cdf.begin() + l.first_triangle;
+		auto last = first + l.mesh->num_triangles();
+		size_t t = std::upper_bound(first, last, within * *(last - 1)) - first;
+		t = std::min(t, l.mesh->num_triangles() - 1);
+
+		// A uniform point on it (the square -> triangle warp)
+		point3 v0, v1, v2;
+		corners(*l.mesh, t, v0, v1, v2);
+		real su = std::sqrt(uv.u);
+		point3 x = (1 - su) * v0 + (uv.v * su) * v1 + (su - uv.v * su) * v2;
+		vec3 normal = unit_vector(cross(v1 - v0, v2 - v0));
+		vec3 to_light = x - p;
+		real d2 = to_light.length_squared();
+		if (d2 <= 0)
+			return false;
+		out.distance = std::sqrt(d2);
+		out.direction = to_light / out.distance;
+		real cosine = -dot(normal, out.direction);
+		if (cosine <= 0) // (only the front glows)
+			return false;
+		out.radiance = l.emit;
+		out.pdf = odds * d2 / (cosine * l.area);
+		return true;
+	}
+
+	// The pdf sample() would have had for picking the point rec, seen from p along direction
+	// (unit) - for weighting a bounce that hit a light on its own. 0 if it's not a light.
+	real pdf(const point3& p, const vec3& direction, const hit_record& rec) const {
+		auto found = by_object.find(rec.object_id);
+		if (found == by_object.end())
+			return 0;
+		const light& l = lights[found->second];
+		real odds = l.power / total_power;
+		if (!l.mesh) {
+			real d2 = (l.center - p).length_squared();
+			real r2 = l.radius * l.radius;
+			return d2 <= r2 ? 0 : odds / (2 * pi * cone_size(d2, r2));
+		}
+		// (emissive meshes are flat shaded - collect_lights - so rec.normal is the face's normal)
+		real cosine = std::abs(dot(rec.normal, direction));
+		if (!rec.front_face || cosine <= 0)
+			return 0;
+		return odds * (rec.p - p).length_squared() / (cosine * l.area);
+	}
+
+public:
+	color sky = color(1, 1, 1); // the background gets multiplied by this (scene.h)
+
+private:
+	struct light {
+		point3 center;                       // spheres
+		real radius = 0;
+		const triangle_mesh* mesh = nullptr; // meshes
+		size_t first_triangle = 0;           // where its triangles start in triangle_cdf
+		real area = 0;
+		color emit;
+		real power = 0;                      // brightness x area: how often it gets picked
+	};
+
+	void add(light l, uint32_t object_id, real area) {
+		l.area = area;
+		l.power = std::max(luminance(l.emit), real(1e-6)) * area;
+		total_power += l.power;
+		power_cdf.push_back(total_power);
+		by_object[object_id] = uint32_t(lights.size());
+		lights.push_back(l);
+	}
+
+	// 1 - cos(the cone's half angle), for a sphere of radius^2 r2 at distance^2 d2. Written
+	// so it doesn't cancel out to 0 for small, far away lights.
+	static real cone_size(real d2, real r2) {
+		real sin2 = r2 / d2;
+		return sin2 / (1 + std::sqrt(std::max(real(0), 1 - sin2)));
+	}
+
+	static void corners(const triangle_mesh& mesh, size_t k, point3& v0, point3& v1, point3& v2) {
+		const uint32_t* corner = &mesh.indices[3 * k];
+		v0 = mesh.positions[corner[0]];
+		v1 = mesh.positions[corner[1]];
+		v2 = mesh.positions[corner[2]];
+	}
+
+	static real triangle_area(const triangle_mesh& mesh, size_t k) {
+		point3 v0, v1, v2;
+		corners(mesh, k, v0, v1, v2);
+		return cross(v1 - v0, v2 - v0).length() / 2;
+	}
+
+	std::vector<light> lights;
+	std::vector<real> power_cdf;    // running total of power, one per light
+	std::vector<real> triangle_cdf; // running total of area, per triangle of each mesh light
+	real total_power = 0;
+	std::unordered_map<uint32_t, uint32_t> by_object; // hit_record::object_id -> lights index
+};
+
+// Every sphere and mesh with an emissive material, from the built scene (spheres are numbered
+// in the sphere_set's final order, like their object_ids). Emissive meshes lose their vertex
+// normals: they don't change how a light looks, and the light's pdf needs the flat ones.
+// Hollow spheres (negative radius) glow inwards, and don't get sampled.
+inline light_list collect_lights(
+	const sphere_set& spheres, const std::vector<shared_ptr<triangle_mesh>>& meshes,
+	const material_table& materials, const color& sky
+) {
+	light_list lights;
+	lights.sky = sky;
+	std::vector<char> emissive(materials.size());
+	bool any = false;
+	for (size_t m = 0; m < materials.size(); ++m)
+		any |= (emissive[m] = materials[m].type() == material_type::diffuse_light) != 0;
+	if (!any)
+		return lights;
+
+	for (size_t k = 0; k < spheres.size(); ++k) {
+		material_id m = spheres.mat_id[k];
+		if (emissive[m] && spheres.radius[k] > 0) {
+			lights.add_sphere(point3(spheres.cx[k], spheres.cy[k], spheres.cz[k]), spheres.radius[k],
+				materials[m].get<diffuse_light>().emit, uint32_t(k));
+		}
+	}
+	for (const auto& mesh : meshes) {
+		if (emissive[mesh->mat_id]) {
+			mesh->normals.clear();
+			lights.add_mesh(*mesh, materials[mesh->mat_id].get<diffuse_light>().emit);
+		}
+	}
+	return lights;
+}
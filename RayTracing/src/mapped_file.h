@@ -0,0 +1,184 @@
+/******************************************************************************
+Trevor's thoughts:
+Loading a big scene used to mean building it: every sphere, every material, then
+the BVH over all of them. A scene cache (scene_cache.h) already has all of that
+laid out exactly the way it sits in memory, so instead of reading it in, we map
+the file and point straight at it. The OS only pages in the parts that get
+touched, so startup is just opening the file.
+
+mapped_array is what the renderer's big arrays are made of (sphere_set, the
+material table): either it owns its elements (a std::vector, when a scene gets
+built the normal way), or it points into someone else's memory - a mapped file -
+and holds on to it, so the mapping lives as long as anything is using it.
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file, mapped read-only
+class mapped_file {
+public:
+	// nullptr if the file can't be opened or mapped
+	static std::shared_ptr<const mapped_file> open(const std::string& path) {
+		std::shared_ptr<mapped_file> file(new mapped_file());
+#ifdef _WIN32
+		HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+			return nullptr;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+			CloseHandle(handle);
+			return nullptr;
+		}
+		HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(handle); // (the mapping keeps the file open)
+		if (!mapping)
+			return nullptr;
+		file->bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+		if (!file->bytes)
+			return nullptr;
+		file->length = size_t(size.QuadPart);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return nullptr;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			::close(fd);
+			return nullptr;
+		}
+		void* p = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // (the mapping keeps the file open)
+		if (p == MAP_FAILED)
+			return nullptr;
+		file->bytes = static_cast<const char*>(p);
+		file->length = size_t(info.st_size);
+#endif
+		return file;
+	}
+
+	~mapped_file() {
+		if (!bytes)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(bytes);
+#else
+		munmap(const_cast<char*>(bytes), length);
+#endif
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	const char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	mapped_file() {}
+
+	const char* bytes = nullptr;
+	size_t length = 0;
+};
+
+// A read-mostly array that either owns its elements, or points at elements that live in
+// someone else's memory (eg: a mapped_file), and keeps that memory alive.
+// Changing a borrowed one (push_back/resize) copies it out into its own vector first.
+template <typename T>
+class mapped_array {
+public:
+	mapped_array() {}
+	mapped_array(std::vector<T> values) : owned(std::move(values)) { point_at_owned(); }
+	mapped_array(const T* elements, size_t count, std::shared_ptr<const void> keep_alive)
+		: elements(elements), count(count), keep_alive(std::move(keep_alive)) {}
+
+	mapped_array(const mapped_array& other) { *this = other; }
+	mapped_array(mapped_array&& other) noexcept { *this = std::move(other); }
+
+	mapped_array& operator=(const mapped_array& other) {
+		owned = other.owned;
+		keep_alive = other.keep_alive;
+		if (keep_alive) {
+			elements = other.elements;
+			count = other.count;
+		}
+		else {
+			point_at_owned();
+		}
+		return *this;
+	}
+
+	mapped_array& operator=(mapped_array&& other) noexcept {
+		owned = std::move(other.owned); // (a moved vector keeps its buffer, so elements stays good)
+		keep_alive = std::move(other.keep_alive);
+		elements = other.elements;
+		count = other.count;
+		other.owned.clear();
+		other.elements = nullptr;
+		other.count = 0;
+		return *this;
+	}
+
+	const T& operator[](size_t k) const { return elements[k]; }
+	const T* data() const { return elements; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T* begin() const { return elements; }
+	const T* end() const { return elements + count; }
+
+	// True if the elements live in someone else's memory
+	bool borrowed() const { return keep_alive != nullptr; }
+
+	void push_back(const T& value) {
+		make_owned();
+		owned.push_back(value);
+		point_at_owned();
+	}
+
+	void resize(size_t n, const T& value = T()) {
+		make_owned();
+		owned.resize(n, value);
+		point_at_owned();
+	}
+
+	// For filling it in place (eg: from several threads at once). Copies a borrowed one out first.
+	T* writable_data() {
+		make_owned();
+		return owned.data();
+	}
+
+private:
+	void make_owned() {
+		if (!keep_alive)
+			return;
+		owned.assign(elements, elements + count);
+		keep_alive.reset();
+	}
+
+	void point_at_owned() {
+		elements = owned.data();
+		count = owned.size();
+	}
+
+	std::vector<T> owned;
+	const T* elements = nullptr;
+	size_t count = 0;
+	std::shared_ptr<const void> keep_alive;
+};
@@ -1,31 +1,41 @@
 #pragma once
 
 #include "rtweekend.h"
+#include "hittable.h"
+#include "mapped_file.h"
+#include "sampler.h"
+#include "stats.h"
 
-struct hit_record;
+#include <vector>
 
-class material {
-public:
-	virtual bool scatter(
-		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-	) const = 0;
-};
+// Materials used to be a class hierarchy, handed around as shared_ptr<material>: every
+// hit copied the shared_ptr into its hit_record (an atomic increment + decrement, on a
+// count every thread was hammering), and every scatter was a virtual call.
+// Now each kind is a plain class, and a material is a tag + one of them. The scene keeps
+// them all in one flat material_table, and hits just carry a 32 bit material_id into it
+// (hittable.h). scatter() is a switch on the tag.
+
+// Also lets the wavefront tracer (wavefront.h) sort hits by material, and then run each
+// material's scatter over a whole batch
+enum class material_type { lambertian, metal, dielectric, diffuse_light };
+const int num_material_types = 4;
 
 
-class lambertian : public material {
+class lambertian {
 public: 
 	lambertian(const color& a) : albedo(a) {}
 
-	virtual bool scatter(
-		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-	) const override {
-		auto scatter_direction = rec.normal + random_unit_vector();
+	bool scatter(
+		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& gen
+	) const {
+		RT_COUNT(scatter_lambertian);
+		auto scatter_direction = rec.normal + sample_unit_sphere(gen.get_2d());
 
 		// catch poorly defined scatter direction near zero
 		if (scatter_direction.near_zero())
 			scatter_direction = rec.normal;
 
-		scattered = ray(rec.p, scatter_direction);
+		scattered = spawn_ray(rec, scatter_direction);
 		attenuation = albedo;
 		return true;
 	}
@@ -35,63 +45,152 @@ public:
 };
 
 
-class metal : public material {
+class metal {
 public:
-	metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+	metal(const color& a, real f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
-	virtual bool scatter(
-		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-	) const override {
+	bool scatter(
+		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& gen
+	) const {
+		RT_COUNT(scatter_metal);
 		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-		scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+		point2 direction = gen.get_2d();
+		scattered = spawn_ray(rec, reflected + fuzz*sample_unit_ball(direction, gen.get_1d()));
 		attenuation = albedo;
 		return (dot(scattered.direction(), rec.normal) > 0);
 	}
 
 public:
 	color albedo;
-	double fuzz;
+	real fuzz;
 };
 
 
-class dielectric : public material {
+class dielectric {
 public:
-	dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+	dielectric(real index_of_refraction) : ir(index_of_refraction) {}
 
-	virtual bool scatter(
-		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-	) const override {
-		attenuation = color(1.0, 1.0, 1.0);
-		double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+	bool scatter(
+		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& gen
+	) const {
+		RT_COUNT(scatter_dielectric);
+		attenuation = color(1, 1, 1);
+		real refraction_ratio = rec.front_face ? (1 / ir) : ir;
 
 		vec3 unit_direction = unit_vector(r_in.direction());
-		double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-		double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+		real cos_theta = std::min(dot(-unit_direction, rec.normal), real(1));
+		real sin_theta = std::sqrt(1 - cos_theta * cos_theta);
 
-		bool cannot_refract = refraction_ratio * sin_theta > 1.0; // Total internal reflection
+		bool cannot_refract = refraction_ratio * sin_theta > 1; // Total internal reflection
 		vec3 direction;
 
-		if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+		if (cannot_refract || reflectance(cos_theta, refraction_ratio) > gen.get_1d())
 			direction = reflect(unit_direction, rec.normal);
 		else
 			direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-		scattered = ray(rec.p, direction);
+		scattered = spawn_ray(rec, direction); // (starts on whichever side of the surface it's heading to)
 		return true;
 	}
 
 public:
-	double ir; // Index of Refraction
+	real ir; // Index of Refraction
 
 private:
-	static double reflectance(double cosine, double ref_idx) {
+	static real reflectance(real cosine, real ref_idx) {
 		// Use Schlick's approximation for reflectance.
 		// No idea how this approximation was derived (probably a tailor expansion 
 		// from something really complicated...however, conceptually, this 
 		// is the equation that makes light reflect off of a surface more at more extreme angles
 		auto r0 = (1 - ref_idx) / (1 + ref_idx);
 		r0 = r0 * r0;
-		return r0 + (1 - r0)*pow((1 - cosine), 5);
+		// (1 - cosine)^5, multiplied out: pow is slow, and would take the float build through double
+		real x = 1 - cosine;
+		real x2 = x * x;
+		return r0 + (1 - r0) * (x2 * x2 * x);
+	}
+};
+
+
+// Glows, and doesn't reflect anything: a sphere or mesh made of this is a light (lights.h).
+// Only the front glows (a sphere's outside, a triangle's counter-clockwise side).
+class diffuse_light {
+public:
+	diffuse_light(const color& e) : emit(e) {}
+
+	bool scatter(
+		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& gen
+	) const {
+		return false;
+	}
+
+	color emitted(const hit_record& rec) const {
+		return rec.front_face ? emit : color(0, 0, 0);
+	}
+
+public:
+	color emit; // radiance (can be way over 1)
+};
+
+
+// One entry in the material table: which kind it is, and that kind's parameters.
+// (Converts from any of the kinds, eg: table.push_back(lambertian(albedo)))
+class material {
+public:
+	material(const lambertian& m) : kind(material_type::lambertian), as_lambertian(m) {}
+	material(const metal& m) : kind(material_type::metal), as_metal(m) {}
+	material(const dielectric& m) : kind(material_type::dielectric), as_dielectric(m) {}
+	material(const diffuse_light& m) : kind(material_type::diffuse_light), as_diffuse_light(m) {}
+
+	material_type type() const { return kind; }
+
+	bool scatter(
+		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& gen
+	) const {
+		switch (kind) {
+		case material_type::lambertian: return as_lambertian.scatter(r_in, rec, attenuation, scattered, gen);
+		case material_type::metal: return as_metal.scatter(r_in, rec, attenuation, scattered, gen);
+		case material_type::dielectric: return as_dielectric.scatter(r_in, rec, attenuation, scattered, gen);
+		case material_type::diffuse_light: return as_diffuse_light.scatter(r_in, rec, attenuation, scattered, gen);
+		}
+		return false;
+	}
+
+	// Light given off by the surface itself (only lights have any)
+	color emitted(const hit_record& rec) const {
+		return kind == material_type::diffuse_light ? as_diffuse_light.emitted(rec) : color(0, 0, 0);
+	}
+
+	// The surface's own color, whatever the lighting (the denoiser's albedo AOV). Glass passes everything.
+	color albedo() const {
+		switch (kind) {
+		case material_type::lambertian: return as_lambertian.albedo;
+		case material_type::metal: return as_metal.albedo;
+		case material_type::dielectric: return color(1, 1, 1);
+		case material_type::diffuse_light: return color(1, 1, 1); // (all of its color is light)
+		}
+		return color(0, 0, 0);
 	}
+
+	// The parameters, when you already know the kind (eg: a batch of one kind in wavefront.h)
+	template <typename Material>
+	const Material& get() const;
+
+private:
+	material_type kind;
+	union {
+		lambertian as_lambertian;
+		metal as_metal;
+		dielectric as_dielectric;
+		diffuse_light as_diffuse_light;
+	};
 };
 
+template <> inline const lambertian& material::get<lambertian>() const { return as_lambertian; }
+template <> inline const metal& material::get<metal>() const { return as_metal; }
+template <> inline const dielectric& material::get<dielectric>() const { return as_dielectric; }
+template <> inline const diffuse_light& material::get<diffuse_light>() const { return as_diffuse_light; }
+
+// Every material in the scene, indexed by material_id (hit_record::mat_id). A mapped_array,
+// so a scene cache's table can be used straight out of the file (scene_cache.h).
+using material_table = mapped_array<material>;
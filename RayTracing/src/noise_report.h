@@ -0,0 +1,94 @@
+/******************************************************************************
+Trevor's thoughts:
+How do we know a sampler actually helps? Render the scene once with a LOT of
+samples (the reference), then render it again with each sampler at 1, 2, 4, ...
+spp and measure how far off each one is (RMS error of the displayed pixel values,
+so 0.01 is about 2.5 levels out of 255).
+With plain random numbers the error only drops like 1/sqrt(spp) (4x the samples for
+half the noise). A good sampler starts lower and/or drops faster. The last line
+says how many spp each sampler needs to be at least as clean as uniform is at the
+full spp - that's the real speedup.
+******************************************************************************/
+
+#pragma once
+
+#include "color.h"
+#include "render.h"
+
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Error of one image against the reference, in displayed (gamma corrected, clamped) values
+inline double rms_error(const framebuffer& image, const framebuffer& reference) {
+	double sum = 0;
+	for (int j = 0; j < image.height; ++j) {
+		for (int i = 0; i < image.width; ++i) {
+			color a = image.average(i, j), b = reference.average(i, j);
+			for (int c = 0; c < 3; ++c) {
+				double d = clamp(correct_gamma(a[c]), 0.0, 1.0) - clamp(correct_gamma(b[c]), 0.0, 1.0);
+				sum += d * d;
+			}
+		}
+	}
+	return sqrt(sum / (3.0 * image.width * image.height));
+}
+
+// render_image: void(const render_settings& settings, framebuffer& image) - renders the
+// (already built) scene with the given settings
+template <typename RenderImage>
+void noise_report(const render_settings& settings, RenderImage render_image, std::ostream& out) {
+	// The reference samples with a different seed, so its noise isn't correlated with any of
+	// the images we're measuring (the scene is already built, so it doesn't change)
+	render_settings reference_settings = settings;
+	reference_settings.adaptive = false;
+	reference_settings.samples_per_pixel = settings.noise_report;
+	reference_settings.seed = settings.seed + 1;
+	framebuffer reference(settings.image_width, settings.image_height);
+	render_image(reference_settings, reference);
+
+	std::vector<int> spps;
+	for (int spp = 1; spp < settings.samples_per_pixel; spp *= 2)
+		spps.push_back(spp);
+	spps.push_back(settings.samples_per_pixel);
+
+	std::vector<std::vector<double>> error(num_sampler_types, std::vector<double>(spps.size()));
+	for (int type = 0; type < num_sampler_types; ++type) {
+		for (size_t k = 0; k < spps.size(); ++k) {
+			render_settings s = settings;
+			s.sampler = sampler_type(type);
+			s.samples_per_pixel = spps[k];
+			framebuffer image(s.image_width, s.image_height);
+			render_image(s, image);
+			error[type][k] = rms_error(image, reference);
+		}
+	}
+
+	out << "RMS error vs a " << settings.noise_report << " spp reference ("
+		<< settings.image_width << "x" << settings.image_height << ")\n";
+	out << std::setw(6) << "spp";
+	for (int type = 0; type < num_sampler_types; ++type)
+		out << std::setw(12) << sampler_name(sampler_type(type));
+	out << '\n' << std::fixed << std::setprecision(5);
+	for (size_t k = 0; k < spps.size(); ++k) {
+		out << std::setw(6) << spps[k];
+		for (int type = 0; type < num_sampler_types; ++type)
+			out << std::setw(12) << error[type][k];
+		out << '\n';
+	}
+
+	// Fewest spp that's at least as clean as uniform at the full spp
+	const double target = error[int(sampler_type::uniform)].back();
+	out << std::setw(6) << "match";
+	for (int type = 0; type < num_sampler_types; ++type) {
+		size_t k = 0;
+		while (k < spps.size() && error[type][k] > target)
+			++k;
+		if (k < spps.size())
+			out << std::setw(12) << spps[k];
+		else
+			out << std::setw(12) << ">" + std::to_string(spps.back());
+	}
+	out << "  (spp needed to match uniform at " << spps.back() << " spp)\n";
+}
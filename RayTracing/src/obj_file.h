@@ -0,0 +1,255 @@
+/******************************************************************************
+Trevor's thoughts:
+OBJ is the lowest common denominator for meshes: text, one thing per line, and
+every modeling tool can write it. We only need the geometry out of it:
+	v 1.0 2.0 3.0      (a vertex position - a 4th number, w, gets ignored)
+	vn 0 1 0           (a vertex normal)
+	f 1 2 3 4          (a face: the corners' vertex numbers, counting from 1;
+	                    negative ones count back from the last vertex so far)
+A face corner can also be v/vt, v//vn or v/vt/vn. Faces with more than 3 corners
+get split into a fan of triangles. Everything else (texture coordinates, groups,
+smoothing, usemtl) gets skipped: a whole mesh gets one material, from the scene
+file (see the mesh keyword in scene_file.h).
+
+Big models are hundreds of MB of text, so this doesn't go anywhere near
+iostreams: the file gets mapped (mapped_file.h), walked through with a pointer,
+and the numbers get parsed right where they sit.
+
+In OBJ, positions and normals have their own indices, but triangle_mesh uses one
+index for both. So each different (position, normal) pair the faces use turns
+into one mesh vertex. Most files (no normals, or v//vn with the same number
+twice) map straight across, without having to look up every corner.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "mapped_file.h"
+#include "triangle_mesh.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class obj_parser {
+public:
+	obj_parser(const std::string& path) : path(path) {}
+
+	// Reads the whole file into out (which should be empty). Errors go to cerr as path:line: message.
+	bool parse(const char* text, size_t size, triangle_mesh& out) {
+		const char* end = text + size;
+		for (const char* line = text; line < end; ) {
+			const char* line_end = static_cast<const char*>(std::memchr(line, '\n', size_t(end - line)));
+			if (!line_end)
+				line_end = end;
+			++line_number;
+			if (!parse_line(line, line_end))
+				return false;
+			line = line_end + 1;
+		}
+		return finish(out);
+	}
+
+private:
+	struct corner {
+		uint32_t position;
+		uint32_t normal; // no_normal if the face didn't give one
+	};
+	static const uint32_t no_normal = 0xffffffff;
+
+	bool parse_line(const char* p, const char* end) {
+		skip_spaces(p, end);
+		if (p == end || *p == '#')
+			return true;
+		if (end - p > 2 && p[0] == 'v' && is_space(p[1])) {
+			p += 2;
+			point3 v;
+			if (!read_vec3(p, end, v))
+				return fail("expected: v <x> <y> <z>");
+			positions.push_back(v);
+			return true;
+		}
+		if (end - p > 3 && p[0] == 'v' && p[1] == 'n' && is_space(p[2])) {
+			p += 3;
+			vec3 n;
+			if (!read_vec3(p, end, n))
+				return fail("expected: vn <x> <y> <z>");
+			normals.push_back(n);
+			return true;
+		}
+		if (end - p > 2 && p[0] == 'f' && is_space(p[1])) {
+			p += 2;
+			return parse_face(p, end);
+		}
+		return true; // something we don't need (vt, o, g, s, usemtl, mtllib, ...)
+	}
+
+	bool parse_face(const char* p, const char* end) {
+		face.clear();
+		skip_spaces(p, end);
+		while (p < end && *p != '#' && *p != '\r') {
+			corner c;
+			if (!read_index(p, end, positions.size(), c.position))
+				return fail("bad vertex in face (vertices have to be defined before the faces that use them)");
+			c.normal = no_normal;
+			if (p < end && *p == '/') {
+				++p;
+				if (p < end && *p != '/') { // texture coordinate - not needed
+					uint32_t skipped;
+					if (!read_index(p, end, ~size_t(0), skipped))
+						return fail("bad texture coordinate in face");
+				}
+				if (p < end && *p == '/') {
+					++p;
+					if (!read_index(p, end, normals.size(), c.normal))
+						return fail("bad normal in face (normals have to be defined before the faces that use them)");
+				}
+			}
+			if (p < end && !is_space(*p))
+				return fail("unexpected characters in face");
+			face.push_back(c);
+			skip_spaces(p, end);
+		}
+		if (face.size() < 3)
+			return fail("a face needs at least 3 corners");
+
+		// A fan of triangles around the first corner
+		for (size_t k = 1; k + 1 < face.size(); ++k) {
+			corners.push_back(face[0]);
+			corners.push_back(face[k]);
+			corners.push_back(face[k + 1]);
+			uses_normals = uses_normals || face[0].normal != no_normal || face[k].normal != no_normal || face[k + 1].normal != no_normal;
+			same_indices = same_indices && face[0].normal == face[0].position
+				&& face[k].normal == face[k].position && face[k + 1].normal == face[k + 1].position;
+		}
+		return true;
+	}
+
+	// Turns the corners into the mesh's one-index-per-vertex form
+	bool finish(triangle_mesh& out) {
+		out.indices.resize(corners.size());
+		if (!uses_normals || (same_indices && normals.size() == positions.size())) {
+			for (size_t k = 0; k < corners.size(); ++k)
+				out.indices[k] = corners[k].position;
+			out.positions = std::move(positions);
+			if (uses_normals)
+				out.normals = std::move(normals);
+			return true;
+		}
+
+		// One mesh vertex per (position, normal) pair. A corner without a normal gets a zero one,
+		// which leaves triangle_mesh to fall back on the face's own normal.
+		std::unordered_map<uint64_t, uint32_t> vertices;
+		vertices.reserve(positions.size());
+		for (size_t k = 0; k < corners.size(); ++k) {
+			const corner& c = corners[k];
+			uint64_t key = uint64_t(c.position) << 32 | c.normal;
+			auto found = vertices.find(key);
+			if (found == vertices.end()) {
+				found = vertices.emplace(key, uint32_t(out.positions.size())).first;
+				out.positions.push_back(positions[c.position]);
+				out.normals.push_back(c.normal == no_normal ? vec3(0, 0, 0) : normals[c.normal]);
+			}
+			out.indices[k] = found->second;
+		}
+		return true;
+	}
+
+	static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	static void skip_spaces(const char*& p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t'))
+			++p;
+	}
+
+	// A 1-based (or negative = counting back) OBJ index -> 0-based, checked against count
+	static bool read_index(const char*& p, const char* end, size_t count, uint32_t& index) {
+		bool negative = p < end && *p == '-';
+		if (negative)
+			++p;
+		if (p == end || *p < '0' || *p > '9')
+			return false;
+		uint64_t value = 0;
+		while (p < end && *p >= '0' && *p <= '9' && value < (uint64_t(1) << 40))
+			value = value * 10 + uint64_t(*p++ - '0');
+		if (value == 0 || value > count)
+			return false;
+		index = uint32_t(negative ? count - value : value - 1);
+		return true;
+	}
+
+	bool read_vec3(const char*& p, const char* end, vec3& v) {
+		double x, y, z;
+		if (!read_number(p, end, x) || !read_number(p, end, y) || !read_number(p, end, z))
+			return false;
+		v = vec3(real(x), real(y), real(z));
+		return true;
+	}
+
+	// Plain decimals (what every exporter writes) get parsed here: the digits go into an
+	// integer, and one multiply or divide by an exact power of 10 scales it, which rounds
+	// correctly as long as both are exact in a double. Anything else goes to strtod.
+	static bool read_number(const char*& p, const char* end, double& value) {
+		static const double powers_of_10[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		skip_spaces(p, end);
+		const char* start = p;
+		bool negative = p < end && *p == '-';
+		if (p < end && (*p == '-' || *p == '+'))
+			++p;
+		uint64_t digits = 0;
+		int num_digits = 0, exponent = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p, ++num_digits)
+			digits = digits * 10 + uint64_t(*p - '0');
+		if (p < end && *p == '.') {
+			for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++num_digits, --exponent)
+				digits = digits * 10 + uint64_t(*p - '0');
+		}
+		bool simple = num_digits > 0 && num_digits <= 15 && (p == end || is_space(*p) || *p == '#');
+		if (simple) {
+			value = double(digits) / powers_of_10[-exponent];
+			value = negative ? -value : value;
+			return true;
+		}
+
+		// Exponents, long mantissas, inf/nan: copy the word out (the file isn't 0 terminated) for strtod
+		p = start;
+		char word[64];
+		size_t length = 0;
+		while (p < end && !is_space(*p) && length + 1 < sizeof(word))
+			word[length++] = *p++;
+		word[length] = '\0';
+		char* parsed;
+		value = std::strtod(word, &parsed);
+		return length > 0 && parsed == word + length && (p == end || is_space(*p));
+	}
+
+	bool fail(const std::string& message) {
+		std::cerr << path << ":" << line_number << ": " << message << "\n";
+		return false;
+	}
+
+	const std::string& path;
+	int line_number = 0;
+	std::vector<point3> positions;
+	std::vector<vec3> normals;
+	std::vector<corner> corners; // 3 per triangle
+	std::vector<corner> face;    // the face being read
+	bool uses_normals = false;
+	bool same_indices = true; // every corner is v//v (or v/vt/v)
+};
+
+// Loads an OBJ file's triangles into mesh (not built yet - see triangle_mesh::build)
+inline bool load_obj(const std::string& path, triangle_mesh& mesh) {
+	std::shared_ptr<const mapped_file> file = mapped_file::open(path);
+	if (!file) {
+		std::cerr << "Couldn't read " << path << "\n";
+		return false;
+	}
+	return obj_parser(path).parse(file->data(), file->size(), mesh);
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "distributed.h"
+#include "image_io.h"
+#include "render.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Command line options, so we don't have to recompile to change the render settings.
+// Anything that isn't given keeps whatever main() already put in settings.
+inline void print_usage(const char* program) {
+	std::cerr << "Usage: " << program << " [options] > image.ppm   (or --output image.png)\n"
+		<< "  --width N        image width in pixels (height follows the aspect ratio)\n"
+		<< "  --spp N          samples per pixel (the max, with --adaptive)\n"
+		<< "  --adaptive T     stop sampling a pixel once its relative error is below T (eg: 0.03)\n"
+		<< "  --min-spp N      adaptive: samples every pixel gets before it can stop\n"
+		<< "  --output FILE    write the image here instead of stdout (.ppm, .png or .pfm)\n"
+		<< "  --format X       p3 (text ppm, the default for stdout), p6 (binary ppm), png, or pfm (linear floats)\n"
+		<< "  --heatmap FILE   also write the samples per pixel as a false color image\n"
+		<< "  --stats FILE     write ray/intersection/scatter counts as JSON (needs an RT_ENABLE_STATS build)\n"
+		<< "  --tile-heatmap FILE  write how long each tile took as a false color image (RT_ENABLE_STATS build)\n"
+		<< "  --progressive    render in passes over the whole frame (1, 2, 4 ... 32 spp, then 32 more per pass)\n"
+		<< "  --time-budget S  progressive: stop after the last pass that fits in S seconds (--spp is the cap, if given)\n"
+		<< "  --checkpoint FILE  progressive: save the samples so far here every so often (and at the end)\n"
+		<< "  --checkpoint-every S  seconds between checkpoints (default 60)\n"
+		<< "  --resume FILE    progressive: carry on from a checkpoint (raise --spp to add samples to a finished one)\n"
+		<< "  --frames N       render an N frame animation (bouncing spheres, orbiting camera) to FILE_0000.ext, ...\n"
+		<< "  --orbit DEG      frames: degrees the camera orbits over the whole sequence (default 30)\n"
+		<< "  --listen ADDR    hand the tiles out to worker processes that connect to ADDR (host:port, :port, or a socket path)\n"
+		<< "  --spawn-workers N  listen: also start N workers on this machine (--threads is per worker then)\n"
+		<< "  --worker ADDR    render tiles for the coordinator at ADDR (give it the same scene and options)\n"
+		<< "  --denoise        smooth the noise away after rendering, without blurring edges (denoise.h)\n"
+		<< "  --aovs FILE      also write what the camera rays hit first: FILE_albedo.ext, FILE_normal.ext, FILE_depth.ext\n"
+		<< "  --preview FILE   interactive: keep FILE refreshed (1 spp at 1/16, 1/4, full size, then more samples),\n"
+		<< "                   and start over whenever the camera moves (camera lines on stdin, or in the --scene file)\n"
+		<< "  --preview-every S  preview: seconds between refreshes once it's adding samples (default 0.5)\n"
+		<< "  --depth N        max bounces per path\n"
+		<< "  --threads N      render (and BVH build) threads (0 = one per core)\n"
+		<< "  --tile N         tile size in pixels\n"
+		<< "  --seed N         scene + sampling seed (same seed -> same image)\n"
+		<< "  --packets        trace primary rays 8 at a time (default)\n"
+		<< "  --no-packets     trace every ray on its own\n"
+		<< "  --integrator X   path (default) or wavefront\n"
+		<< "  --path-stats     print how many bounces paths took, and why they ended\n"
+		<< "  --sampler X      uniform, stratified, sobol (default) or bluenoise\n"
+		<< "  --noise-report N print noise vs spp for every sampler (up to --spp), against an N spp reference\n"
+		<< "  --scene FILE     render this scene: a text file (see scene_file.h) or a scene cache (default: the random spheres)\n"
+		<< "  --save-scene FILE  write the scene out as text, and exit\n"
+		<< "  --save-cache FILE  write the scene out as a cache (with its BVH, for fast loading), and exit\n";
+}
+
+// The value of one option, before the rest get parsed (eg: --scene, since the scene's own
+// settings are the defaults that everything else on the command line overrides). nullptr if it isn't there.
+inline const char* find_option(int argc, char** argv, const char* name) {
+	for (int k = 1; k + 1 < argc; ++k) {
+		if (!std::strcmp(argv[k], name))
+			return argv[k + 1];
+	}
+	return nullptr;
+}
+
+inline bool parse_options(int argc, char** argv, double aspect_ratio, render_settings& settings) {
+	bool spp_given = false;
+	for (int k = 1; k < argc; ++k) {
+		const char* arg = argv[k];
+		const char* value = k + 1 < argc ? argv[k + 1] : nullptr;
+		bool takes_value = true;
+
+		if (!std::strcmp(arg, "--packets")) { settings.packets = true; takes_value = false; }
+		else if (!std::strcmp(arg, "--no-packets")) { settings.packets = false; takes_value = false; }
+		else if (!std::strcmp(arg, "--path-stats")) { settings.path_stats = true; takes_value = false; }
+		else if (!std::strcmp(arg, "--progressive")) { settings.progressive = true; takes_value = false; }
+		else if (!std::strcmp(arg, "--denoise")) { settings.denoise = true; takes_value = false; }
+		else if (!value) { print_usage(argv[0]); return false; }
+		else if (!std::strcmp(arg, "--width")) {
+			settings.image_width = std::atoi(value);
+			settings.image_height = static_cast<int>(settings.image_width / aspect_ratio);
+		}
+		else if (!std::strcmp(arg, "--spp")) {
+			settings.samples_per_pixel = std::atoi(value);
+			spp_given = true;
+		}
+		else if (!std::strcmp(arg, "--depth")) settings.max_depth = std::atoi(value);
+		else if (!std::strcmp(arg, "--threads")) settings.threads = std::atoi(value);
+		else if (!std::strcmp(arg, "--tile")) settings.tile_size = std::atoi(value);
+		else if (!std::strcmp(arg, "--seed")) settings.seed = std::strtoull(value, nullptr, 10);
+		else if (!std::strcmp(arg, "--integrator")) {
+			if (!std::strcmp(value, "path")) settings.integrator = integrator_type::path;
+			else if (!std::strcmp(value, "wavefront")) settings.integrator = integrator_type::wavefront;
+			else { print_usage(argv[0]); return false; }
+		}
+		else if (!std::strcmp(arg, "--sampler")) {
+			bool found = false;
+			for (int type = 0; type < num_sampler_types; ++type) {
+				if (!std::strcmp(value, sampler_name(sampler_type(type)))) {
+					settings.sampler = sampler_type(type);
+					found = true;
+				}
+			}
+			if (!found) { print_usage(argv[0]); return false; }
+		}
+		else if (!std::strcmp(arg, "--adaptive")) {
+			settings.adaptive = true;
+			settings.adaptive_threshold = std::atof(value);
+		}
+		else if (!std::strcmp(arg, "--min-spp")) settings.min_spp = std::atoi(value);
+		else if (!std::strcmp(arg, "--heatmap")) settings.heatmap_path = value;
+		else if (!std::strcmp(arg, "--stats")) settings.stats_path = value;
+		else if (!std::strcmp(arg, "--tile-heatmap")) settings.tile_heatmap_path = value;
+		else if (!std::strcmp(arg, "--output")) settings.output_path = value;
+		else if (!std::strcmp(arg, "--format")) settings.output_format = value;
+		else if (!std::strcmp(arg, "--noise-report")) settings.noise_report = std::atoi(value);
+		else if (!std::strcmp(arg, "--time-budget")) settings.time_budget = std::atof(value);
+		else if (!std::strcmp(arg, "--checkpoint")) settings.checkpoint_path = value;
+		else if (!std::strcmp(arg, "--checkpoint-every")) settings.checkpoint_interval = std::atof(value);
+		else if (!std::strcmp(arg, "--resume")) settings.resume_path = value;
+		else if (!std::strcmp(arg, "--scene")) settings.scene_path = value;
+		else if (!std::strcmp(arg, "--save-scene")) settings.save_scene_path = value;
+		else if (!std::strcmp(arg, "--save-cache")) settings.save_cache_path = value;
+		else if (!std::strcmp(arg, "--frames")) settings.sequence_frames = std::atoi(value);
+		else if (!std::strcmp(arg, "--orbit")) settings.orbit_degrees = std::atof(value);
+		else if (!std::strcmp(arg, "--listen")) settings.listen_address = value;
+		else if (!std::strcmp(arg, "--spawn-workers")) settings.spawn_workers = std::atoi(value);
+		else if (!std::strcmp(arg, "--worker")) settings.worker_address = value;
+		else if (!std::strcmp(arg, "--aovs")) settings.aov_path = value;
+		else if (!std::strcmp(arg, "--preview")) settings.preview_path = value;
+		else if (!std::strcmp(arg, "--preview-every")) settings.preview_interval = std::atof(value);
+		else { print_usage(argv[0]); return false; }
+
+		if (takes_value)
+			++k;
+	}
+
+	if (settings.image_width < 2 || settings.image_height < 2 || settings.samples_per_pixel < 1 || settings.tile_size < 1
+		|| settings.min_spp < 1 || settings.max_depth < 1) {
+		std::cerr << "Image size, samples per pixel, depth, and tile size all need to be positive.\n";
+		return false;
+	}
+	// Any of the progressive options means progressive mode
+	if (settings.time_budget > 0 || !settings.checkpoint_path.empty() || !settings.resume_path.empty())
+		settings.progressive = true;
+	if (settings.time_budget > 0 && !spp_given)
+		settings.samples_per_pixel = 1 << 20; // the clock decides (this just keeps the sample indices sane)
+	if (settings.progressive && settings.adaptive) {
+		std::cerr << "--adaptive doesn't work with progressive passes (every pixel gets the same samples per pass).\n";
+		return false;
+	}
+	if (settings.sequence_frames < 0) {
+		std::cerr << "--frames has to be positive.\n";
+		return false;
+	}
+	if (settings.sequence_frames > 0 && (settings.progressive || settings.noise_report > 0 || settings.output_path.empty())) {
+		std::cerr << "--frames needs --output (the frames get numbered), and doesn't work with progressive options or --noise-report.\n";
+		return false;
+	}
+	bool distributed = !settings.listen_address.empty() || !settings.worker_address.empty();
+	if (distributed && !RT_HAS_SOCKETS) {
+		std::cerr << "--listen and --worker need POSIX sockets, which this build doesn't have.\n";
+		return false;
+	}
+	if (!settings.listen_address.empty() && !settings.worker_address.empty()) {
+		std::cerr << "Pick one of --listen (coordinator) and --worker.\n";
+		return false;
+	}
+	if (settings.spawn_workers < 0 || (settings.spawn_workers > 0 && settings.listen_address.empty())) {
+		std::cerr << "--spawn-workers needs --listen.\n";
+		return false;
+	}
+	if (distributed && (settings.progressive || settings.sequence_frames > 0 || settings.noise_report > 0
+		|| !settings.stats_path.empty() || !settings.tile_heatmap_path.empty() || settings.path_stats)) {
+		std::cerr << "--listen and --worker only do single images (no progressive options, --frames, --noise-report, or stats).\n";
+		return false;
+	}
+	bool aovs = settings.denoise || !settings.aov_path.empty();
+	if (aovs && (distributed || !settings.resume_path.empty() || settings.noise_report > 0)) {
+		std::cerr << "--denoise and --aovs don't work with --listen/--worker, --resume or --noise-report (none of those keep the AOVs).\n";
+		return false;
+	}
+	if (!settings.preview_path.empty() && (settings.progressive || settings.adaptive || settings.sequence_frames > 0
+		|| settings.noise_report > 0 || distributed || aovs)) {
+		std::cerr << "--preview doesn't work with progressive options, --adaptive, --frames, --noise-report, --listen/--worker, --denoise or --aovs.\n";
+		return false;
+	}
+	if (!RT_ENABLE_STATS && (!settings.stats_path.empty() || !settings.tile_heatmap_path.empty())) {
+		std::cerr << "--stats and --tile-heatmap need a build with RT_ENABLE_STATS=1 (cmake -DRT_ENABLE_STATS=ON).\n";
+		return false;
+	}
+	image_format format;
+	if (!choose_image_format(settings.output_path, settings.output_format, format)
+		|| (!settings.heatmap_path.empty() && !image_format_from_path(settings.heatmap_path, format))
+		|| (!settings.aov_path.empty() && !image_format_from_path(settings.aov_path, format))
+		|| (!settings.preview_path.empty() && !image_format_from_path(settings.preview_path, format))
+		|| (!settings.tile_heatmap_path.empty() && !image_format_from_path(settings.tile_heatmap_path, format))) {
+		std::cerr << "Unknown image format (use .ppm, .png, .pfm, or --format p3|p6|png|pfm).\n";
+		return false;
+	}
+	return true;
+}
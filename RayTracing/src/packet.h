@@ -0,0 +1,209 @@
+/******************************************************************************
+Trevor's thoughts:
+All of the samples for one pixel start at (nearly) the same spot on the lens and
+head in (nearly) the same direction, so they visit the same BVH nodes and hit the
+same spheres. Rather than walk the tree 8 separate times, we bundle 8 of those
+primary rays into a packet and walk the tree once:
+	- Each node's box is tested against all 8 rays (one SIMD-friendly loop over the lanes).
+	We only descend if at least one ray still hits it.
+	- Each sphere in a leaf is tested against all 8 rays the same way, and each lane
+	keeps its own closest t.
+	- The children get visited in the order the packet is heading (sign of the
+	direction on the split axis), since all the rays are heading the same way.
+Once the first hits are known, each ray goes back to being an individual: the
+bounces off of diffuse/metal/glass scatter all over the place, so there's no
+coherence left to exploit there.
+The lane loops have a fixed trip count, SoA data, and no branches, so the compiler
+turns them into vector code (AVX: 4 lanes per instruction, AVX-512: 8).
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "integrator.h"
+#include "render.h"
+#include "sphere_set.h"
+
+#include <algorithm>
+
+const int packet_size = 8;
+
+struct ray_packet {
+	// Structure of arrays, one lane per ray
+	alignas(64) real ox[packet_size], oy[packet_size], oz[packet_size];
+	alignas(64) real dx[packet_size], dy[packet_size], dz[packet_size];
+	alignas(64) real inv_dx[packet_size], inv_dy[packet_size], inv_dz[packet_size];
+	alignas(64) real a[packet_size], inv_a[packet_size]; // direction.length_squared() (and 1 over it), for the sphere test
+	int count = 0; // lanes in use (the rest are parked with t_max = -infinity, so they never hit anything)
+
+	ray_packet() {
+		for (int lane = 0; lane < packet_size; ++lane)
+			set(lane, ray(point3(0, 0, 0), vec3(1, 1, 1)));
+	}
+
+	void set(int lane, const ray& r) {
+		ox[lane] = r.origin().x(); oy[lane] = r.origin().y(); oz[lane] = r.origin().z();
+		dx[lane] = r.direction().x(); dy[lane] = r.direction().y(); dz[lane] = r.direction().z();
+		inv_dx[lane] = 1 / dx[lane]; inv_dy[lane] = 1 / dy[lane]; inv_dz[lane] = 1 / dz[lane];
+		a[lane] = r.direction().length_squared();
+		inv_a[lane] = 1 / a[lane];
+	}
+
+	ray get(int lane) const {
+		return ray(point3(ox[lane], oy[lane], oz[lane]), vec3(dx[lane], dy[lane], dz[lane]));
+	}
+
+	const real* inv_dir(int axis) const {
+		return axis == 0 ? inv_dx : (axis == 1 ? inv_dy : inv_dz);
+	}
+};
+
+struct packet_hit {
+	alignas(64) real t[packet_size];  // closest hit (or t_max if the ray missed)
+	uint32_t index[packet_size];        // which sphere (only meaningful if hit[lane])
+	bool hit[packet_size];
+};
+
+// Does the box get hit by any of the rays (before their current closest hits)?
+inline bool box_hit_any(const aabb& box, const ray_packet& p, real t_min, const real* t_max) {
+	bool any = false;
+	for (int lane = 0; lane < packet_size; ++lane) {
+		real tx0 = (box.minimum.x() - p.ox[lane]) * p.inv_dx[lane];
+		real tx1 = (box.maximum.x() - p.ox[lane]) * p.inv_dx[lane];
+		real ty0 = (box.minimum.y() - p.oy[lane]) * p.inv_dy[lane];
+		real ty1 = (box.maximum.y() - p.oy[lane]) * p.inv_dy[lane];
+		real tz0 = (box.minimum.z() - p.oz[lane]) * p.inv_dz[lane];
+		real tz1 = (box.maximum.z() - p.oz[lane]) * p.inv_dz[lane];
+		real t_enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), t_min));
+		real t_exit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), t_max[lane]));
+		any |= t_enter <= t_exit;
+	}
+	return any;
+}
+
+// Closest hit for every ray in the packet, with one shared walk through the sphere_set's BVH
+inline void hit_packet(const sphere_set& world, const ray_packet& p, real t_min, real t_max, packet_hit& out) {
+	for (int lane = 0; lane < packet_size; ++lane) {
+		out.t[lane] = lane < p.count ? t_max : -infinity;
+		out.index[lane] = 0;
+	}
+
+	if (!world.nodes.empty()) {
+		const bvh_node* nodes = world.nodes.data();
+		uint32_t stack[max_bvh_depth];
+		int sp = 0;
+		uint32_t index = 0;
+		while (true) {
+			const bvh_node& node = nodes[index];
+			RT_COUNT(bvh_nodes);
+			if (box_hit_any(node.box, p, t_min, out.t)) {
+				if (node.count == 0) {
+					// Every ray is heading roughly the same way, so let the first one pick the order
+					bool second_first = p.inv_dir(node.axis)[0] < 0;
+					stack[sp++] = second_first ? index + 1 : node.offset;
+					index = second_first ? node.offset : index + 1;
+					continue;
+				}
+
+				// Leaf: test each sphere against all the rays (same math, in the same order, as
+				// sphere_roots - so a packet finds exactly the hits the single rays would)
+				RT_COUNT_TESTS(uint64_t(node.count) * p.count);
+				for (uint32_t k = node.offset; k < node.offset + node.count; ++k) {
+					const real cx = world.cx[k], cy = world.cy[k], cz = world.cz[k];
+					const real r2 = world.radius[k] * world.radius[k];
+					for (int lane = 0; lane < packet_size; ++lane) {
+						real ocx = p.ox[lane] - cx, ocy = p.oy[lane] - cy, ocz = p.oz[lane] - cz;
+						real half_b = ocx * p.dx[lane] + ocy * p.dy[lane] + ocz * p.dz[lane];
+						real c = ocx * ocx + ocy * ocy + ocz * ocz - r2;
+						real s = half_b * p.inv_a[lane];
+						real lx = ocx - s * p.dx[lane], ly = ocy - s * p.dy[lane], lz = ocz - s * p.dz[lane];
+						real discriminant = p.a[lane] * (r2 - (lx * lx + ly * ly + lz * lz));
+						real sqrtd = std::sqrt(discriminant > 0 ? discriminant : 0);
+						real q = half_b >= 0 ? -(half_b + sqrtd) : sqrtd - half_b;
+						real t0 = q * p.inv_a[lane], t1 = c / q;
+						real near_root = t0 < t1 ? t0 : t1;
+						real far_root = t0 > t1 ? t0 : t1;
+						bool near_ok = discriminant >= 0 && near_root >= t_min && near_root <= out.t[lane];
+						bool far_ok = discriminant >= 0 && far_root >= t_min && far_root <= out.t[lane];
+						out.t[lane] = near_ok ? near_root : (far_ok ? far_root : out.t[lane]);
+						out.index[lane] = (near_ok || far_ok) ? k : out.index[lane];
+					}
+				}
+			}
+
+			if (sp == 0)
+				break;
+			index = stack[--sp];
+		}
+	}
+
+	for (int lane = 0; lane < packet_size; ++lane)
+		out.hit[lane] = lane < p.count && out.t[lane] < t_max;
+}
+
+// Same as render_tile, except the samples for each pixel are traced 8 at a time.
+// shade: color(const ray& r, const hit_record* rec, const hittable& world, const material_table& materials,
+//	const light_list& lights, int depth, sampler& gen)
+//	- colors a ray whose first hit is already known (rec == nullptr if it missed everything)
+template <typename Shade>
+void render_tile_packets(
+	const tile& t, const camera& cam, const sphere_set& world, const material_table& materials, const light_list& lights,
+	const render_settings& settings, Shade shade, framebuffer& image
+) {
+	ray_packet packet;
+	packet_hit hits;
+	auto gen = make_sampler(settings);
+	const bool aovs = image.has_aovs();
+	for (int j = t.y0; j < t.y1; ++j) {
+		for (int i = t.x0; i < t.x1; ++i) {
+			const uint64_t pixel = pixel_index(settings, i, j);
+
+			color pixel_color(0, 0, 0);
+			pixel_stats stats;
+			aov_sample pixel_aovs;
+			int taken = settings.first_sample;
+			for (int end = next_round_end(settings, taken, stats); taken < end; end = next_round_end(settings, taken, stats)) {
+				for (int s = taken; s < end; s += packet_size) {
+					packet.count = std::min(packet_size, end - s);
+					for (int lane = 0; lane < packet.count; ++lane) {
+						gen->start_path(pixel, s + lane);
+						point2 jitter = gen->get_2d();
+						auto v = (real(j) + jitter.v) / real(settings.image_height - 1);
+						auto u = (real(i) + jitter.u) / real(settings.image_width - 1);
+						packet.set(lane, cam.get_ray(u, v, *gen));
+					}
+
+					hit_packet(world, packet, 0, infinity, hits);
+					RT_END_PACKET(packet.count);
+
+					for (int lane = 0; lane < packet.count; ++lane) {
+						// Each sample picks its random stream back up right where ray_color would have
+						// (the sampler doesn't care that we interleaved 8 samples)
+						gen->start_path(pixel, s + lane);
+						ray r = packet.get(lane);
+						color sample;
+						hit_record rec;
+						const hit_record* first = nullptr;
+						if (hits.hit[lane]) {
+							world.fill_hit_record(r, hits.index[lane], hits.t[lane], rec);
+							first = &rec;
+						}
+						sample = shade(r, first, world, materials, lights, settings.max_depth, *gen);
+						pixel_color += sample;
+						stats.add(sample);
+						if (aovs) {
+							aov_sample sample_aovs = first_hit_aovs(r, first, materials, lights);
+							sample_aovs.luminance_sq = luminance(sample) * luminance(sample);
+							pixel_aovs += sample_aovs;
+						}
+					}
+				}
+				taken = end;
+			}
+			image.add(i, j, pixel_color, taken - settings.first_sample);
+			if (aovs)
+				image.add_aovs(i, j, pixel_aovs);
+		}
+	}
+}
@@ -0,0 +1,42 @@
+/******************************************************************************
+Trevor's thoughts:
+Rendering has its own thread pool (render.h), with tiles and work stealing. Setup
+work - generating millions of spheres, shuffling them into BVH order - is much
+simpler: one big loop where every iteration takes about as long as any other.
+parallel_for just cuts the range into one contiguous chunk per thread.
+
+Anything run through it has to come out the same no matter how many threads there
+are (so: no shared random generator, and each iteration only writes its own slots).
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// threads <= 0 -> one per hardware thread
+inline int setup_thread_count(int threads) {
+	if (threads > 0)
+		return threads;
+	int n = int(std::thread::hardware_concurrency());
+	return n > 0 ? n : 1;
+}
+
+// Calls body(begin, end) on chunks that cover [0, count), each on its own thread
+template <typename Body>
+inline void parallel_for(size_t count, int threads, Body&& body) {
+	size_t chunks = std::min(size_t(setup_thread_count(threads)), count);
+	if (chunks <= 1) {
+		body(size_t(0), count);
+		return;
+	}
+
+	std::vector<std::thread> pool;
+	for (size_t c = 1; c < chunks; ++c)
+		pool.emplace_back([&, c] { body(count * c / chunks, count * (c + 1) / chunks); });
+	body(size_t(0), count / chunks); // the calling thread takes the first chunk
+	for (auto& t : pool)
+		t.join();
+}
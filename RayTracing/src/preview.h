@@ -0,0 +1,285 @@
+/******************************************************************************
+Trevor's thoughts:
+Setting up a shot used to be: edit the camera line, render, wait, squint, repeat.
+Even progressive mode's first pass is a full size 1 spp image, which is most of a
+second for the random scene - and every tweak starts the whole program over.
+
+--preview FILE keeps one process (scene, BVH and render threads all built once)
+and keeps FILE up to date with the best image so far, for an image viewer that
+reloads it (it gets replaced with a rename, so nothing ever sees half a file):
+	- First a pyramid of 1 spp images: 1/16 size (a few ms), 1/4 size, then full
+	  size. The small ones get blown up to full size (nearest pixel), so FILE is
+	  always the same size. Camera rays only care about where a pixel is across the
+	  image (0..1), so a smaller image is the same shot, just with bigger pixels.
+	- Then passes that add samples to the full size image, like progressive mode,
+	  except they stop growing at preview_pass_spp, so FILE gets refreshed every
+	  --preview-every seconds or so instead of every 32 spp
+	- Once it has all --spp samples, it sits and waits
+Moving the camera starts it all over: type a camera line on stdin (scene file
+syntax - only the settings you give change, eg: camera lookfrom 10 3 5), or edit
+the camera line in the --scene file (it gets checked a few times a second).
+Whatever's being rendered right then gets cancelled (render_settings::cancel: the
+threads stop after the tile they're on), so the new 1/16 image is up a tile or two
+later. quit on stdin ends it.
+
+The image size stays put, so aspect in a new camera line doesn't do anything.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "image_io.h"
+#include "progressive.h"
+#include "render.h"
+#include "scene.h"
+#include "scene_file.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+const int preview_levels[] = { 16, 4, 1 }; // the 1 spp pyramid: image size divided by these
+const int preview_pass_spp = 8;            // after the pyramid, passes add at most this many spp
+const double scene_poll_seconds = 0.2;     // how often the --scene file gets checked for camera edits
+
+// Samples every pixel should have after the preview pass that starts at done (progressive
+// mode's passes, cut up so none is more than preview_pass_spp)
+inline int next_preview_pass_end(int done, int samples_per_pixel) {
+	return std::min(next_pass_end(done, samples_per_pixel), (done / preview_pass_spp + 1) * preview_pass_spp);
+}
+
+// Blows small up to image's size: every pixel of image gets the nearest one of small's
+inline void upscale_nearest(const framebuffer& small, framebuffer& image) {
+	image.clear();
+	for (int j = 0; j < image.height; ++j) {
+		int sj = std::min(small.height - 1, int(int64_t(j) * small.height / image.height));
+		for (int i = 0; i < image.width; ++i) {
+			int si = std::min(small.width - 1, int(int64_t(i) * small.width / image.width));
+			image.add(i, j, small.sum(si, sj), small.samples(si, sj));
+		}
+	}
+}
+
+// Where camera changes come from while previewing: camera lines (or quit) on stdin, and the
+// camera lines of the scene file. Either one cancels the render in progress.
+class camera_watch {
+public:
+	// scene_path: a text scene whose camera lines to follow (empty -> just stdin)
+	camera_watch(const camera_setup& view, const std::string& scene_path) : state(std::make_shared<shared_state>()) {
+		state->latest = view;
+		// Blocked in getline until there's a line, so it can't be told to stop: it's left to
+		// run out with the program (and only touches state, which it keeps alive)
+		std::thread(read_stdin, state).detach();
+		if (!scene_path.empty())
+			scene_poller = std::thread(poll_scene_file, state, scene_path);
+	}
+
+	camera_watch(const camera_watch&) = delete;
+	camera_watch& operator=(const camera_watch&) = delete;
+
+	~camera_watch() {
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->stopping = true;
+		}
+		state->wake.notify_all();
+		if (scene_poller.joinable())
+			scene_poller.join();
+	}
+
+	// Set whenever the camera changes (or it's time to quit): for render_settings::cancel
+	const std::atomic<bool>& cancelled() const { return state->cancel; }
+
+	// Waits for the camera to change, and puts the new one in view. False -> quit instead.
+	// changed_at: when the change came in
+	bool next_view(camera_setup& view, std::chrono::steady_clock::time_point& changed_at) {
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->wake.wait(lock, [&] { return state->changed || state->quit; });
+		if (state->quit)
+			return false;
+		view = state->latest;
+		changed_at = state->changed_at;
+		state->changed = false;
+		state->cancel = false;
+		return true;
+	}
+
+private:
+	struct shared_state {
+		std::mutex mutex;
+		std::condition_variable wake;
+		camera_setup latest;        // the newest camera
+		bool changed = false;       // latest hasn't been picked up by next_view yet
+		bool quit = false;
+		bool stopping = false;      // (the watch is going away)
+		std::chrono::steady_clock::time_point changed_at;
+		std::atomic<bool> cancel{ false };
+
+		// (with the lock held)
+		void change(const camera_setup& view) {
+			camera_setup next = view;
+			next.aspect_ratio = latest.aspect_ratio; // (the image size doesn't change)
+			latest = next;
+			changed = true;
+			changed_at = std::chrono::steady_clock::now();
+			cancel = true;
+			wake.notify_all();
+		}
+	};
+
+	static void read_stdin(std::shared_ptr<shared_state> state) {
+		std::string text;
+		while (std::getline(std::cin, text)) {
+			std::istringstream line(text);
+			std::string keyword;
+			line >> keyword;
+			if (keyword == "quit") {
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->quit = true;
+				state->cancel = true;
+				state->wake.notify_all();
+				return;
+			}
+			if (keyword != "camera") {
+				if (!keyword.empty())
+					std::cerr << "Preview: only camera lines (eg: camera lookfrom 13 2 3 vfov 30) and quit go here\n";
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(state->mutex);
+			camera_setup view = state->latest;
+			line.clear();
+			line.str(text);
+			if (read_scene_camera("stdin", line, view))
+				state->change(view);
+		}
+		// (stdin closed: the scene file can still move the camera, and ctrl-c still works)
+	}
+
+	// Re-reads the file's camera lines whenever it's been written to, and moves the camera if
+	// they say something different than they did before
+	static void poll_scene_file(std::shared_ptr<shared_state> state, std::string path) {
+		camera_setup file_view;
+		struct stat seen = {};
+		bool first = true;
+		std::unique_lock<std::mutex> lock(state->mutex);
+		while (!state->stopping) {
+			struct stat now = {};
+			if (stat(path.c_str(), &now) == 0 && (first || now.st_mtime != seen.st_mtime || now.st_size != seen.st_size)) {
+				seen = now;
+				lock.unlock();
+				camera_setup view;
+				std::ifstream file(path);
+				bool ok = file && read_scene_camera(path, file, view);
+				lock.lock();
+				if (ok && !first && !same_view(view, file_view))
+					state->change(view);
+				if (ok)
+					file_view = view;
+				first = false;
+			}
+			state->wake.wait_for(lock, std::chrono::duration<double>(scene_poll_seconds), [&] { return state->stopping; });
+		}
+	}
+
+	static bool same_view(const camera_setup& a, const camera_setup& b) {
+		auto same = [](const vec3& u, const vec3& v) { return u.x() == v.x() && u.y() == v.y() && u.z() == v.z(); };
+		return same(a.lookfrom, b.lookfrom) && same(a.lookat, b.lookat) && same(a.vup, b.vup) && a.vfov == b.vfov
+			&& a.aperture == b.aperture && a.focus_dist == b.focus_dist;
+	}
+
+	std::shared_ptr<shared_state> state;
+	std::thread scene_poller;
+};
+
+// render_image: void(const render_settings& settings, framebuffer& image), rendering with cam -
+// which gets replaced every time the camera moves. Returns once quit comes in on stdin.
+template <typename RenderImage>
+bool run_preview(
+	const render_settings& settings, const camera_setup& start_view, const std::string& scene_path, camera& cam,
+	RenderImage render_image
+) {
+	using clock = std::chrono::steady_clock;
+	auto ms_since = [](clock::time_point t) { return 1000 * std::chrono::duration<double>(clock::now() - t).count(); };
+
+	image_format format;
+	image_format_from_path(settings.preview_path, format); // (already checked by parse_options)
+	framebuffer image(settings.image_width, settings.image_height);
+	auto publish = [&] { return replace_file(settings.preview_path, encode_image(image, format)); };
+
+	camera_watch watch(start_view, scene_path);
+	render_settings base = settings;
+	base.progress = false;
+	base.cancel = &watch.cancelled();
+	std::cerr << "Preview: writing " << settings.preview_path
+		<< " (type camera lines here to move the camera, quit to stop)\n";
+
+	camera_setup view = start_view;
+	while (true) {
+		const auto start = clock::now();
+		cam = view.make_camera();
+
+		// The pyramid: 1 spp at 1/16, 1/4, then full size
+		for (int scale : preview_levels) {
+			render_settings level = base;
+			level.first_sample = 0;
+			level.pass_end = 1;
+			if (scale == 1) {
+				image.clear();
+				render_image(level, image);
+			}
+			else {
+				level.image_width = std::max(2, settings.image_width / scale);
+				level.image_height = std::max(2, settings.image_height / scale);
+				framebuffer small(level.image_width, level.image_height);
+				render_image(level, small);
+				if (!watch.cancelled())
+					upscale_nearest(small, image);
+			}
+			if (watch.cancelled())
+				break;
+			double rendered = ms_since(start);
+			if (!publish())
+				return false;
+			std::cerr << "Preview: 1/" << scale << " size rendered at " << rendered << " ms, written at " << ms_since(start) << " ms\n";
+		}
+
+		// Then more samples at full size, refreshing the file every so often
+		int done = 1;
+		auto last_publish = clock::now();
+		while (!watch.cancelled() && done < settings.samples_per_pixel) {
+			render_settings pass = base;
+			pass.first_sample = done;
+			pass.pass_end = next_preview_pass_end(done, settings.samples_per_pixel);
+			render_image(pass, image);
+			if (watch.cancelled())
+				break;
+			done = pass.pass_end;
+			if (done == settings.samples_per_pixel || ms_since(last_publish) >= 1000 * settings.preview_interval) {
+				if (!publish())
+					return false;
+				last_publish = clock::now();
+				std::cerr << "\rPreview: " << done << " spp at " << ms_since(start) / 1000 << " seconds " << std::flush;
+			}
+		}
+		if (!watch.cancelled())
+			std::cerr << "\nPreview: done, waiting for the camera to move\n";
+
+		clock::time_point changed_at;
+		if (!watch.next_view(view, changed_at))
+			return true;
+		std::cerr << "\nPreview: camera moved, restarting (" << ms_since(changed_at) << " ms after the change)\n";
+	}
+}
@@ -0,0 +1,196 @@
+/******************************************************************************
+Trevor's thoughts:
+A 1200x675 render at 512 spp takes a while, and if it dies (or I need the machine
+back) halfway through, everything is lost. Progressive mode renders the whole
+frame in passes instead of finishing one tile at a time:
+	1, 2, 4, 8, 16, 32 spp, then 32 more per pass
+Each pass just traces samples [done, end) of every pixel and adds them on top of
+the framebuffer (render_settings::first_sample and pass_end). samples_per_pixel
+stays the whole render's count, so the sampler lays its points out exactly as it
+would in one go (the stratified grid is spp cells, whichever pass we're on). Sobol
+points come in balanced power of 2 blocks, so ending passes on multiples of 32
+keeps them at their best.
+
+After a pass, if it's been long enough, the framebuffer gets saved to a checkpoint
+file: the summed colors, the sample counts, and what the random numbers depend on.
+There's no generator state to save - every random number is a function of (seed,
+pixel, sample, bounce) (sampler.h), so "pixel p has n samples" is all it takes to
+pick up exactly where we left off. A resumed render is bit-identical to one that
+never stopped, and resuming with a bigger --spp adds samples to a finished image
+(except with the stratified sampler: its grid is laid out for the spp, so the
+samples already taken only fit the spp they were taken for - it has to resume
+with the same --spp). The checkpoint also keeps a fingerprint of the scene and
+camera, so it won't add samples to some other scene's image.
+
+With a time budget, it keeps going until the next pass wouldn't fit (guessing from
+how long the last one took per sample), so you get the best image that fits in
+20 minutes instead of guessing an spp.
+******************************************************************************/
+
+#pragma once
+
+#include "framebuffer.h"
+#include "image_io.h"
+#include "render.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+const int progressive_pass_spp = 32; // once the passes have doubled up to this, they stop growing
+
+// Samples every pixel should have after the pass that starts at done
+inline int next_pass_end(int done, int samples_per_pixel) {
+	int end = done < progressive_pass_spp ? std::max(1, 2 * done) : done + progressive_pass_spp;
+	return std::min(end, samples_per_pixel);
+}
+
+///////////////// Checkpoint files /////////////////
+// "RTCKPT02", then (all little endian): u32 width, u32 height, u64 seed, u32 max_depth,
+// u32 sampler, u32 spp (what the samples were laid out for), u64 scene fingerprint
+// (render_settings::scene_fingerprint), then a u32 sample count per pixel and 3 floats
+// (summed r, g, b) per pixel, in framebuffer order. The integrator, packets, threads etc
+// aren't in there, since they don't change the image.
+const char checkpoint_magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '2' };
+
+inline void append_u32_little_endian(std::string& out, uint32_t v) {
+	for (int b = 0; b < 4; ++b)
+		out += char(v >> (8 * b));
+}
+
+inline uint32_t read_u32_little_endian(const std::string& in, size_t& pos) {
+	uint32_t v = 0;
+	for (int b = 0; b < 4; ++b)
+		v |= uint32_t(uint8_t(in[pos++])) << (8 * b);
+	return v;
+}
+
+inline std::string encode_checkpoint(const render_settings& settings, const framebuffer& image) {
+	std::string out(checkpoint_magic, sizeof(checkpoint_magic));
+	append_u32_little_endian(out, uint32_t(image.width));
+	append_u32_little_endian(out, uint32_t(image.height));
+	append_u32_little_endian(out, uint32_t(settings.seed));
+	append_u32_little_endian(out, uint32_t(settings.seed >> 32));
+	append_u32_little_endian(out, uint32_t(settings.max_depth));
+	append_u32_little_endian(out, uint32_t(settings.sampler));
+	append_u32_little_endian(out, uint32_t(settings.samples_per_pixel));
+	append_u32_little_endian(out, uint32_t(settings.scene_fingerprint));
+	append_u32_little_endian(out, uint32_t(settings.scene_fingerprint >> 32));
+	out.reserve(out.size() + 4 * (image.sample_counts.size() + image.accum.size()));
+	for (int n : image.sample_counts)
+		append_u32_little_endian(out, uint32_t(n));
+	for (float f : image.accum) {
+		uint32_t bits;
+		std::memcpy(&bits, &f, sizeof(bits));
+		append_u32_little_endian(out, bits);
+	}
+	return out;
+}
+
+// (replace_file: getting killed halfway through a save never leaves us without a good one)
+inline bool save_checkpoint(const std::string& path, const render_settings& settings, const framebuffer& image) {
+	return replace_file(path, encode_checkpoint(settings, image));
+}
+
+// Fills image with the checkpoint's samples. Fails if the file is broken, or if it was
+// rendered with settings that would give a different image (size, seed, depth, sampler,
+// scene or camera - or spp, for the stratified sampler).
+inline bool load_checkpoint(const std::string& path, const render_settings& settings, framebuffer& image) {
+	std::ifstream file(path, std::ios::binary);
+	std::string in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (!file) {
+		std::cerr << "Couldn't read " << path << "\n";
+		return false;
+	}
+
+	const size_t header = sizeof(checkpoint_magic) + 9 * 4;
+	const size_t pixels = size_t(image.width) * image.height;
+	if (in.size() != header + 16 * pixels || in.compare(0, sizeof(checkpoint_magic), checkpoint_magic, sizeof(checkpoint_magic)) != 0) {
+		std::cerr << path << " isn't a checkpoint for a " << image.width << "x" << image.height << " image\n";
+		return false;
+	}
+	size_t pos = sizeof(checkpoint_magic);
+	uint32_t width = read_u32_little_endian(in, pos);
+	uint32_t height = read_u32_little_endian(in, pos);
+	uint64_t seed = read_u32_little_endian(in, pos);
+	seed |= uint64_t(read_u32_little_endian(in, pos)) << 32;
+	uint32_t max_depth = read_u32_little_endian(in, pos);
+	uint32_t sampler = read_u32_little_endian(in, pos);
+	uint32_t spp = read_u32_little_endian(in, pos);
+	uint64_t fingerprint = read_u32_little_endian(in, pos);
+	fingerprint |= uint64_t(read_u32_little_endian(in, pos)) << 32;
+	if (width != uint32_t(image.width) || height != uint32_t(image.height) || seed != settings.seed
+		|| max_depth != uint32_t(settings.max_depth) || sampler != uint32_t(settings.sampler)) {
+		std::cerr << path << " was rendered with a different size, --seed, --depth or --sampler\n";
+		return false;
+	}
+	if (fingerprint != settings.scene_fingerprint) {
+		std::cerr << path << " was rendered from a different scene or camera\n";
+		return false;
+	}
+	if (settings.sampler == sampler_type::stratified && spp != uint32_t(settings.samples_per_pixel)) {
+		std::cerr << path << " was rendered for --spp " << spp << ", and the stratified sampler's grid depends on it"
+			<< " (resume with --spp " << spp << ", or use another --sampler)\n";
+		return false;
+	}
+
+	for (auto& n : image.sample_counts)
+		n = int(read_u32_little_endian(in, pos));
+	for (auto& f : image.accum) {
+		uint32_t bits = read_u32_little_endian(in, pos);
+		std::memcpy(&f, &bits, sizeof(f));
+	}
+	return true;
+}
+
+///////////////// The pass loop /////////////////
+// render_image: void(const render_settings& settings, framebuffer& image) - adds samples
+// [settings.first_sample, sample_end(settings)) of every pixel to image.
+// image may already hold samples (from load_checkpoint): every pixel needs the same count.
+template <typename RenderImage>
+bool render_progressive(const render_settings& settings, framebuffer& image, RenderImage render_image) {
+	using clock = std::chrono::steady_clock;
+	const auto start = clock::now();
+	auto seconds_since = [](clock::time_point t) { return std::chrono::duration<double>(clock::now() - t).count(); };
+
+	int done = image.samples(0, 0);
+	if (std::any_of(image.sample_counts.begin(), image.sample_counts.end(), [&](int n) { return n != done; })) {
+		std::cerr << "Every pixel needs the same number of samples to render more passes\n";
+		return false;
+	}
+
+	auto last_checkpoint = start;
+	double seconds_per_sample = 0; // measured on the last pass
+	while (done < settings.samples_per_pixel) {
+		int end = next_pass_end(done, settings.samples_per_pixel);
+		if (settings.time_budget > 0 && seconds_since(start) + seconds_per_sample * (end - done) > settings.time_budget)
+			break; // wouldn't make it (an empty image always gets its first pass, though)
+
+		render_settings pass = settings;
+		pass.first_sample = done;
+		pass.pass_end = end;
+		auto pass_start = clock::now();
+		render_image(pass, image);
+		seconds_per_sample = seconds_since(pass_start) / (end - done);
+		done = end;
+		std::cerr << "\nPass done: " << done << " spp (" << seconds_since(start) << " seconds)";
+
+		bool finished = done >= settings.samples_per_pixel;
+		if (!settings.checkpoint_path.empty()
+			&& (finished || seconds_since(last_checkpoint) >= settings.checkpoint_interval)) {
+			if (!save_checkpoint(settings.checkpoint_path, settings, image))
+				return false;
+			last_checkpoint = clock::now();
+		}
+	}
+
+	// Stopped by the time budget: save what we've got, so it can be picked back up later
+	if (done < settings.samples_per_pixel && !settings.checkpoint_path.empty()
+		&& !save_checkpoint(settings.checkpoint_path, settings, image))
+		return false;
+	return true;
+}
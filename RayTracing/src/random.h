@@ -0,0 +1,126 @@
+/******************************************************************************
+Trevor's thoughts:
+rand() was slow, shared one hidden state between every thread, only has 15 bits
+on some compilers, and gave a different image every run. Two generators replace it:
+
+pcg32: a small, fast, sequential generator (O'Neill's PCG-XSH-RR). Each
+(seed, stream) pair gives an independent sequence. Good for things that are
+naturally done in order, like building the scene.
+
+rng: a counter-based generator (Philox4x32-10, from Salmon et al. "Parallel Random
+Numbers: As Easy as 1, 2, 3"). There's no state to carry around - the random numbers
+are just a hash of (seed, pixel, sample, bounce, draw #). That means:
+	- any path can be picked up at any bounce (the wavefront tracer relies on this)
+	- the image doesn't depend on the number of threads, the tile order, or whether
+	rays get traced one at a time, in packets, or in waves
+Every function that needs randomness takes one of these explicitly, so there's no
+hidden global state anywhere.
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+
+// splitmix64 finalizer - scrambles nearby seeds (eg: pixel 10 and 11) into unrelated values
+inline uint64_t hash_seed(uint64_t x) {
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+// Two 32-bit draws -> a double in [0,1) with the full 53 bits of precision
+inline double uint_pair_to_double(uint32_t hi, uint32_t lo) {
+	uint64_t bits = (uint64_t(hi) << 21) ^ (uint64_t(lo) >> 11);
+	return bits * (1.0 / 9007199254740992.0); // 2^-53
+}
+
+class pcg32 {
+public:
+	pcg32(uint64_t seed = 0, uint64_t stream = 0) {
+		inc = (stream << 1u) | 1u; // must be odd
+		state = 0;
+		next_uint();
+		state += hash_seed(seed);
+		next_uint();
+	}
+
+	uint32_t next_uint() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ull + inc;
+		uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = uint32_t(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+
+	double next_double() {
+		uint32_t hi = next_uint();
+		return uint_pair_to_double(hi, next_uint());
+	}
+
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+class rng {
+public:
+	rng(uint64_t seed = 0) : seed(seed) { start_path(0, 0); }
+
+	// Every (pixel, sample) pair gets its own independent stream
+	void start_path(uint64_t pixel, uint32_t sample) {
+		uint64_t k = hash_seed(seed ^ hash_seed(pixel));
+		key[0] = uint32_t(k);
+		key[1] = uint32_t(k >> 32);
+		counter[0] = sample;
+		start_bounce(0);
+	}
+
+	// ...and every bounce within a path gets its own sub-stream. Bounce 0 is the camera
+	// (pixel jitter + lens), then 1, 2, ... for each bounce after that.
+	void start_bounce(uint32_t bounce) {
+		counter[1] = bounce;
+		counter[2] = 0; // block number within this bounce
+		counter[3] = 0;
+		available = 0;
+	}
+
+	uint32_t next_uint() {
+		if (available == 0)
+			refill();
+		return block[--available];
+	}
+
+	double next_double() {
+		uint32_t hi = next_uint();
+		return uint_pair_to_double(hi, next_uint());
+	}
+
+private:
+	// Philox4x32-10: 10 rounds of multiply/xor/key-bump over the 128-bit counter
+	void refill() {
+		uint32_t c[4] = { counter[0], counter[1], counter[2], counter[3] };
+		uint32_t k[2] = { key[0], key[1] };
+		for (int round = 0; round < 10; ++round) {
+			uint64_t p0 = uint64_t(0xD2511F53u) * c[0];
+			uint64_t p1 = uint64_t(0xCD9E8D57u) * c[2];
+			uint32_t next[4] = {
+				uint32_t(p1 >> 32) ^ c[1] ^ k[0], uint32_t(p1),
+				uint32_t(p0 >> 32) ^ c[3] ^ k[1], uint32_t(p0)
+			};
+			c[0] = next[0]; c[1] = next[1]; c[2] = next[2]; c[3] = next[3];
+			k[0] += 0x9E3779B9u;
+			k[1] += 0xBB67AE85u;
+		}
+		block[0] = c[0]; block[1] = c[1]; block[2] = c[2]; block[3] = c[3];
+		available = 4;
+		++counter[2];
+	}
+
+private:
+	uint64_t seed;
+	uint32_t key[2];
+	uint32_t counter[4];
+	uint32_t block[4];
+	int available;
+};
@@ -0,0 +1,417 @@
+/******************************************************************************
+Trevor's thoughts:
+The original render loop walked every scanline on one thread, which left every
+other core idle. Now the frame is cut into tiles, and a small pool of threads
+pulls tiles off of work-stealing queues:
+	- Tiles are ordered along a Morton (Z-order) curve, so neighbouring tiles
+	(which tend to hit the same spheres) get rendered close together in time.
+	- Each thread starts with its own contiguous run of tiles. When it runs out,
+	it steals from the far end of somebody else's queue. That balances out the
+	expensive glass/metal tiles against the cheap sky tiles.
+	- Every sample's random numbers are a function of (seed, pixel, sample, bounce)
+	(see sampler.h and random.h), so the image is bit-identical no matter how many
+	threads (or what tile size) we use.
+
+Adaptive sampling: most of the frame is sky or flat diffuse, which is clean after
+a handful of samples, while the glass and its caustics need hundreds. With
+settings.adaptive, each pixel takes min_spp samples, then keeps doubling its count
+(1x, 2x, 4x... which also keeps the Sobol points at their best, powers of 2) until
+the relative error of its mean is under the threshold, or it hits
+samples_per_pixel. The error comes from a running (Welford) variance of the
+sample brightness, so nothing has to be stored per sample. Every pixel decides
+from its own samples only, so the image is still deterministic.
+
+The threads themselves can outlive a render: a render_pool starts them once, and
+every render(pool, ...) after that just wakes them up. That's what main uses, so
+progressive passes and sequence frames (sequence.h) don't start a fresh set of
+threads each time - and their thread_local buffers (eg: the wavefront tracer's)
+stay allocated from one frame to the next.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "lights.h"
+#include "sampler.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class integrator_type {
+	path,      // ray_color, one path at a time (integrator.h)
+	wavefront  // breadth-first batches, sorted by material (wavefront.h)
+};
+
+struct render_settings {
+	int image_width = 1200;
+	int image_height = 675;
+	int samples_per_pixel = 512;
+	int first_sample = 0; // only samples [first_sample, sample_end()) get traced (and added to the image) - see progressive.h
+	int pass_end = 0; // > 0: stop at this sample instead (a pass - samples_per_pixel stays the total, which the sampler lays its points out for)
+	int max_depth = 50;
+	int tile_size = 16;
+	int threads = 0; // 0 -> one per hardware thread
+	uint64_t seed = 0;
+	bool packets = true; // trace primary rays in coherent packets (packet.h)
+	integrator_type integrator = integrator_type::path;
+	sampler_type sampler = sampler_type::sobol; // where each sample's random numbers come from (sampler.h)
+	bool adaptive = false; // stop sampling each pixel once it's clean enough (samples_per_pixel becomes the max)
+	int min_spp = 64; // adaptive: first round (fewer than this, and the variance estimate can't be trusted)
+	double adaptive_threshold = 0.03; // adaptive: stop once the standard error is below this fraction of the mean
+	bool progress = true; // print the tiles remaining as we go
+	bool path_stats = false; // print how long paths got, and why they ended
+	std::string output_path; // empty -> stdout
+	std::string output_format; // p3, p6, png or pfm (empty -> from output_path's extension, or p3 for stdout)
+	std::string heatmap_path; // if set, write the per-pixel sample counts here
+	std::string stats_path; // RT_ENABLE_STATS builds: write the counters here as JSON (stats.h)
+	std::string tile_heatmap_path; // RT_ENABLE_STATS builds: write how long each tile took, as a false color image
+	bool progressive = false; // render in passes over the whole frame (progressive.h)
+	double time_budget = 0; // progressive: > 0 -> stop after the last pass that fits in this many seconds
+	std::string checkpoint_path; // progressive: save the framebuffer here between passes
+	double checkpoint_interval = 60; // progressive: seconds between checkpoints
+	std::string resume_path; // progressive: start from this checkpoint instead of a black image
+	uint64_t scene_fingerprint = 0; // progressive: what the scene and camera hash to, so a checkpoint only resumes the same one
+	int noise_report = 0; // > 0: print noise vs spp for every sampler (against a reference with this many spp) instead of an image
+	std::string scene_path; // empty -> random_scene(seed). A text scene (scene_file.h) or a scene cache (scene_cache.h).
+	std::string save_scene_path; // write the scene out as text here, instead of rendering
+	std::string save_cache_path; // write the built scene out as a cache here, instead of rendering
+	int sequence_frames = 0; // > 0: render an animation this many frames long instead of one image (sequence.h)
+	double orbit_degrees = 30; // sequence: how far the camera goes around lookat over the whole sequence
+	std::string listen_address; // distributed: hand the tiles out to workers that connect here (distributed.h)
+	int spawn_workers = 0; // distributed: start this many workers on this machine too
+	std::string worker_address; // distributed: render tiles for the coordinator at this address
+	bool denoise = false; // filter the finished image with its AOVs (denoise.h)
+	std::string aov_path; // if set, also write the AOVs as images: path_albedo.ext, path_normal.ext, path_depth.ext
+	std::string preview_path; // interactive preview: keep refreshing the image here, restarting on camera changes (preview.h)
+	double preview_interval = 0.5; // preview: seconds between snapshots, once it's refining at full size
+	const std::atomic<bool>* cancel = nullptr; // if set, render() stops handing out tiles once it's true (the image is left half done)
+};
+
+// Running mean/variance of one pixel's sample brightness (Welford's algorithm:
+// numerically stable, and only 3 numbers per pixel)
+struct pixel_stats {
+	int count = 0;
+	double mean = 0;
+	double m2 = 0; // sum of squared differences from the mean
+
+	void add(const color& sample) {
+		double x = luminance(sample);
+		++count;
+		double delta = x - mean;
+		mean += delta / count;
+		m2 += delta * (x - mean);
+	}
+
+	// Standard error of the mean, relative to the mean. The mean is floored, so nearly
+	// black pixels don't chase a relative error they'll never reach.
+	double relative_error() const {
+		if (count < 2)
+			return infinity;
+		double variance = m2 / (count - 1);
+		return sqrt(variance / count) / std::max(mean, 0.05);
+	}
+};
+
+// Where this render's samples stop: the end of its pass, or all of them
+inline int sample_end(const render_settings& settings) {
+	return settings.pass_end > 0 ? std::min(settings.pass_end, settings.samples_per_pixel) : settings.samples_per_pixel;
+}
+
+// How many samples a pixel should have after its next round (== taken if it's done)
+inline int next_round_end(const render_settings& settings, int taken, const pixel_stats& stats) {
+	const int end = sample_end(settings);
+	if (!settings.adaptive)
+		return end;
+	if (taken == 0)
+		return std::min(settings.min_spp, end);
+	if (taken >= end || stats.relative_error() < settings.adaptive_threshold)
+		return taken;
+	return std::min(2 * taken, end);
+}
+
+struct tile {
+	int x0, y0; // inclusive
+	int x1, y1; // exclusive
+};
+
+// Interleave the bits of x and y -> position along the Z-order curve
+inline uint64_t morton_code(uint32_t x, uint32_t y) {
+	uint64_t code = 0;
+	for (int bit = 0; bit < 32; ++bit) {
+		code |= uint64_t((x >> bit) & 1) << (2 * bit);
+		code |= uint64_t((y >> bit) & 1) << (2 * bit + 1);
+	}
+	return code;
+}
+
+inline std::vector<tile> make_tiles(int width, int height, int tile_size) {
+	std::vector<tile> tiles;
+	std::vector<uint64_t> codes;
+	for (int ty = 0; ty * tile_size < height; ++ty) {
+		for (int tx = 0; tx * tile_size < width; ++tx) {
+			tile t;
+			t.x0 = tx * tile_size;
+			t.y0 = ty * tile_size;
+			t.x1 = std::min(t.x0 + tile_size, width);
+			t.y1 = std::min(t.y0 + tile_size, height);
+			tiles.push_back(t);
+			codes.push_back(morton_code(tx, ty));
+		}
+	}
+
+	// Sort into Z-order (works for any image size, not just powers of 2)
+	std::vector<size_t> order(tiles.size());
+	for (size_t k = 0; k < order.size(); ++k)
+		order[k] = k;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return codes[a] < codes[b]; });
+
+	std::vector<tile> sorted;
+	sorted.reserve(tiles.size());
+	for (auto k : order)
+		sorted.push_back(tiles[k]);
+	return sorted;
+}
+
+// One of these per worker. The owner takes work from the front (walking its run of tiles
+// in order), thieves take from the back, so the two rarely fight over the same cache lines.
+class work_queue {
+public:
+	void push(int item) {
+		std::lock_guard<std::mutex> lock(m);
+		items.push_back(item);
+	}
+
+	bool pop(int& item) {
+		std::lock_guard<std::mutex> lock(m);
+		if (items.empty())
+			return false;
+		item = items.front();
+		items.pop_front();
+		return true;
+	}
+
+	bool steal(int& item) {
+		std::lock_guard<std::mutex> lock(m);
+		if (items.empty())
+			return false;
+		item = items.back();
+		items.pop_back();
+		return true;
+	}
+
+private:
+	std::mutex m;
+	std::deque<int> items;
+};
+
+class tile_scheduler {
+public:
+	tile_scheduler(int num_items, int num_workers) : queues(num_workers) {
+		// Hand out contiguous runs, so each worker starts in its own neighbourhood of the image
+		for (int w = 0; w < num_workers; ++w) {
+			int begin = int(int64_t(num_items) * w / num_workers);
+			int end = int(int64_t(num_items) * (w + 1) / num_workers);
+			for (int k = begin; k < end; ++k)
+				queues[w].push(k);
+		}
+	}
+
+	bool next(int worker, int& item) {
+		if (queues[worker].pop(item))
+			return true;
+		// Out of our own work - go steal from the others
+		int n = int(queues.size());
+		for (int k = 1; k < n; ++k) {
+			if (queues[(worker + k) % n].steal(item))
+				return true;
+		}
+		return false;
+	}
+
+private:
+	std::vector<work_queue> queues;
+};
+
+inline int render_thread_count(const render_settings& settings) {
+	if (settings.threads > 0)
+		return settings.threads;
+	int n = int(std::thread::hardware_concurrency());
+	return n > 0 ? n : 1;
+}
+
+// Index used to key the random numbers for a pixel (see random.h)
+inline uint64_t pixel_index(const render_settings& settings, int i, int j) {
+	return uint64_t(j) * settings.image_width + i;
+}
+
+inline std::unique_ptr<sampler> make_sampler(const render_settings& settings) {
+	return make_sampler(settings.sampler, settings.seed, settings.samples_per_pixel, settings.image_width, settings.max_depth);
+}
+
+// trace: color(const ray& r, const hittable& world, const material_table& materials, const light_list& lights,
+//	int depth, sampler& gen, aov_sample* first_hit) - eg: ray_color. first_hit is nullptr unless the image keeps AOVs.
+template <typename Trace>
+void render_tile(
+	const tile& t, const camera& cam, const hittable& world, const material_table& materials, const light_list& lights,
+	const render_settings& settings, Trace trace, framebuffer& image
+) {
+	auto gen = make_sampler(settings);
+	const bool aovs = image.has_aovs();
+	for (int j = t.y0; j < t.y1; ++j) {
+		for (int i = t.x0; i < t.x1; ++i) {
+			color pixel_color(0, 0, 0);
+			pixel_stats stats;
+			aov_sample pixel_aovs, sample_aovs;
+			int s = settings.first_sample;
+			for (int end = next_round_end(settings, s, stats); s < end; end = next_round_end(settings, s, stats)) {
+				for (; s < end; ++s) {
+					gen->start_path(pixel_index(settings, i, j), s);
+					// technically, adding the random offset is just a blur effect...
+					// It just happens to be a sub-pixel blur, which counter-acts aliasing
+					// (the stratified grid that used to be commented out here is now sampler_type::stratified)
+					point2 jitter = gen->get_2d();
+					auto v = (real(j) + jitter.v) / real(settings.image_height - 1);
+					auto u = (real(i) + jitter.u) / real(settings.image_width - 1);
+					ray r = cam.get_ray(u, v, *gen);
+					color sample = trace(r, world, materials, lights, settings.max_depth, *gen, aovs ? &sample_aovs : nullptr);
+					pixel_color += sample;
+					stats.add(sample);
+					if (aovs) {
+						sample_aovs.luminance_sq = luminance(sample) * luminance(sample);
+						pixel_aovs += sample_aovs;
+					}
+				}
+			}
+			image.add(i, j, pixel_color, s - settings.first_sample);
+			if (aovs)
+				image.add_aovs(i, j, pixel_aovs);
+		}
+	}
+}
+
+// Threads that wait around between renders, instead of being started and joined every time
+class render_pool {
+public:
+	// threads: how many render() gets to use, counting the thread that calls it (which always pitches in)
+	explicit render_pool(int threads) {
+		for (int id = 1; id < threads; ++id)
+			workers.emplace_back([this, id] { work(id); });
+	}
+
+	render_pool(const render_pool&) = delete;
+	render_pool& operator=(const render_pool&) = delete;
+
+	~render_pool() {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& t : workers)
+			t.join();
+	}
+
+	int size() const { return int(workers.size()) + 1; }
+
+	// Calls job(id) once on every thread, id 0 being the calling thread's, and returns once they've all finished
+	void run(const std::function<void(int)>& job) {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			current = &job;
+			busy = int(workers.size());
+			++generation;
+		}
+		wake.notify_all();
+		job(0);
+		std::unique_lock<std::mutex> lock(m);
+		finished.wait(lock, [&] { return busy == 0; });
+		current = nullptr;
+	}
+
+private:
+	void work(int id) {
+		uint64_t done = 0; // the last job this thread ran
+		while (true) {
+			const std::function<void(int)>* job;
+			{
+				std::unique_lock<std::mutex> lock(m);
+				wake.wait(lock, [&] { return stopping || generation != done; });
+				if (stopping)
+					return;
+				done = generation;
+				job = current;
+			}
+			(*job)(id);
+			std::lock_guard<std::mutex> lock(m);
+			if (--busy == 0)
+				finished.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex m;
+	std::condition_variable wake, finished;
+	const std::function<void(int)>* current = nullptr;
+	uint64_t generation = 0; // bumped for every job
+	int busy = 0; // workers still running the current job
+	bool stopping = false;
+};
+
+// Runs render_one(tile) over every tile of the image, spread across the pool's threads.
+// Setting *settings.cancel makes every thread stop after the tile it's on.
+// eg: render(pool, settings, [&](const tile& t) { render_tile(t, cam, world, materials, lights, settings, ray_color, image); });
+template <typename TileFn>
+void render(render_pool& pool, const render_settings& settings, TileFn render_one) {
+	auto tiles = make_tiles(settings.image_width, settings.image_height, settings.tile_size);
+	int num_threads = std::min(pool.size(), int(tiles.size()));
+	tile_scheduler scheduler(int(tiles.size()), num_threads);
+
+	auto start = std::chrono::steady_clock::now();
+	std::atomic<int> tiles_done(0);
+
+	auto worker = [&](int id) {
+		int k;
+		while (!(settings.cancel && settings.cancel->load(std::memory_order_relaxed)) && scheduler.next(id, k)) {
+			RT_STATS_ONLY(auto tile_start = std::chrono::steady_clock::now();)
+			render_one(tiles[k]);
+			RT_STATS_ONLY({
+				std::chrono::duration<double> tile_seconds = std::chrono::steady_clock::now() - tile_start;
+				const tile& t = tiles[k];
+				thread_render_stats().tile_times.push_back({ t.x0, t.y0, t.x1, t.y1, tile_seconds.count() });
+			})
+			int done = ++tiles_done;
+			if (id == 0 && settings.progress) { // only one thread talks, so the progress line doesn't get garbled
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				std::cerr << "\r (Time Taken: " << elapsed.count() << ") Tiles remaining: "
+					<< tiles.size() - done << " of " << tiles.size() << " " << std::flush;
+			}
+		}
+	};
+
+	pool.run([&](int id) {
+		if (id < num_threads)
+			worker(id);
+	});
+}
+
+// Same, with threads of its own that only last for this one render
+template <typename TileFn>
+void render(const render_settings& settings, TileFn render_one) {
+	auto tiles = make_tiles(settings.image_width, settings.image_height, settings.tile_size);
+	render_pool pool(std::min(render_thread_count(settings), int(tiles.size())));
+	render(pool, settings, render_one);
+}
@@ -0,0 +1,422 @@
+/******************************************************************************
+Trevor's thoughts:
+Every sample is really a point in a big many-dimensional cube: 2 numbers pick the
+spot in the pixel, 2 more pick the spot on the lens, then every bounce takes a few
+more to pick its direction. Plain random numbers clump up in that cube and leave
+holes, and the holes are the noise. A sampler hands out those numbers more evenly,
+so we hit the same noise level with fewer samples per pixel.
+
+To make that work, each number has to keep the same meaning from one sample to the
+next: "dimension 2 of sample 7" should always be the lens u for that pixel. So:
+	- each path vertex (0 = camera, then one per bounce) gets its own block of
+	dimensions, and get_1d()/get_2d() walk through that block in order
+	- the warps below turn numbers into disks/spheres/balls directly. The old
+	random_in_unit_* helpers used rejection sampling, which throws away a random
+	number of draws, so everything after them would shift dimensions.
+
+The samplers:
+	uniform: independent random numbers (what we had before), the baseline
+	stratified: each dimension cuts its square into a grid of spp cells and puts one
+	jittered point in each (cells are shuffled per pixel/dimension, so the
+	dimensions don't line up with each other)
+	sobol: Owen-scrambled Sobol points (Burley, "Practical Hash-based Owen
+	Scrambling"). Every dimension pair is its own scrambled + shuffled copy of the
+	first two Sobol dimensions ("padding"), which behaves well for any spp, and
+	gets even better at powers of 2.
+	blue_noise: the same Sobol points for every pixel, each shifted (Cranley-Patterson
+	rotation) by a blue noise mask made with void-and-cluster. The error is then
+	spread out as fine, high frequency grain instead of blotches, which looks a lot
+	cleaner at low spp even when the raw error is about the same.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+enum class sampler_type { uniform, stratified, sobol, blue_noise };
+const int num_sampler_types = 4;
+
+inline const char* sampler_name(sampler_type type) {
+	switch (type) {
+	case sampler_type::uniform: return "uniform";
+	case sampler_type::stratified: return "stratified";
+	case sampler_type::sobol: return "sobol";
+	case sampler_type::blue_noise: return "bluenoise";
+	}
+	return "?";
+}
+
+struct point2 {
+	real u, v; // each in [0,1)
+};
+
+// Direct warps from the unit square (no rejection, so each one uses a fixed number of dimensions)
+
+// Shirley & Chiu's concentric map: square -> disk, keeping neighbouring points close together
+inline vec3 sample_unit_disk(point2 p) {
+	real a = 2 * p.u - 1, b = 2 * p.v - 1;
+	if (a == 0 && b == 0)
+		return vec3(0, 0, 0);
+	real r, phi;
+	if (a * a > b * b) { r = a; phi = (pi / 4) * (b / a); }
+	else { r = b; phi = pi / 2 - (pi / 4) * (a / b); }
+	return vec3(r * std::cos(phi), r * std::sin(phi), 0);
+}
+
+// Uniform direction (a point on the surface of the unit sphere)
+inline vec3 sample_unit_sphere(point2 p) {
+	real z = 1 - 2 * p.u;
+	real r = std::sqrt(std::max(real(0), 1 - z * z));
+	real phi = 2 * pi * p.v;
+	return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Uniform point inside the unit ball: a direction, pushed out by cbrt (volume grows like r^3)
+inline vec3 sample_unit_ball(point2 p, real radius_sample) {
+	return std::cbrt(radius_sample) * sample_unit_sphere(p);
+}
+
+// Bit tricks shared by the samplers
+
+inline uint32_t reverse_bits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+	x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// Laine-Karras style hash: each output bit only depends on the input bits below it,
+// which is exactly an Owen scramble once the bits are reversed
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+	return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// The first two dimensions of the Sobol sequence (as 0.32 fixed point)
+inline uint32_t sobol_0(uint32_t index) {
+	return reverse_bits(index);
+}
+
+inline uint32_t sobol_1(uint32_t index) {
+	uint32_t x = 0;
+	for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+		if (index & 1)
+			x ^= v;
+	return x;
+}
+
+inline real fixed_to_unit(uint32_t x) {
+#if RT_USE_FLOAT
+	// A float only has room for 24 of the bits (and rounding all 32 into one can land on exactly 1)
+	return real(x >> 8) * (1.0f / 16777216.0f); // 2^-24
+#else
+	return x * (1.0 / 4294967296.0); // 2^-32
+#endif
+}
+
+// A random real in [0,1) from the rng, at whatever precision real is
+inline real next_unit(rng& gen) {
+#if RT_USE_FLOAT
+	return fixed_to_unit(gen.next_uint());
+#else
+	return gen.next_double();
+#endif
+}
+
+// Kensler's hashed permutation ("Correlated Multi-Jittered Sampling"): a random
+// permutation of [0, n) for any n, without storing it
+inline uint32_t permute(uint32_t i, uint32_t n, uint32_t p) {
+	uint32_t w = n - 1;
+	w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+	do {
+		i ^= p; i *= 0xe170893du;
+		i ^= p >> 16;
+		i ^= (i & w) >> 4;
+		i ^= p >> 8; i *= 0x0929eb3fu;
+		i ^= p >> 23;
+		i ^= (i & w) >> 1; i *= 1 | p >> 27;
+		i *= 0x6935fa69u;
+		i ^= (i & w) >> 11; i *= 0x74dcb303u;
+		i ^= (i & w) >> 2; i *= 0x9e501cc3u;
+		i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= n);
+	return (i + p) % n;
+}
+
+// Void-and-cluster (Ulichney): ranks every pixel of a size x size tile so that the
+// first k pixels are always as evenly spread out as possible, for every k.
+// "Energy" is a wrapped gaussian blur of the pixels that are on: the tightest cluster
+// is the on pixel with the most energy, the largest void is the off pixel with the least.
+inline std::vector<float> make_blue_noise_mask(int size, double sigma = 1.5) {
+	const int n = size * size;
+	std::vector<double> kernel(n);
+	for (int y = 0; y < size; ++y) {
+		for (int x = 0; x < size; ++x) {
+			int dx = std::min(x, size - x), dy = std::min(y, size - y);
+			kernel[y * size + x] = exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+		}
+	}
+
+	std::vector<char> on(n, 0);
+	std::vector<double> energy(n, 0.0);
+	auto splat = [&](int p, double sign) {
+		int px = p % size, py = p / size;
+		for (int y = 0; y < size; ++y) {
+			const double* row = &kernel[((y - py + size) % size) * size];
+			for (int x = 0; x < size; ++x)
+				energy[y * size + x] += sign * row[(x - px + size) % size];
+		}
+	};
+	auto set = [&](int p, bool value) { on[p] = value; splat(p, value ? 1 : -1); };
+	// Most energy among the pixels that are (or aren't) on
+	auto most_energy = [&](bool state) {
+		int best = 0;
+		double best_energy = -std::numeric_limits<double>::infinity();
+		for (int p = 0; p < n; ++p)
+			if (bool(on[p]) == state && energy[p] > best_energy) { best = p; best_energy = energy[p]; }
+		return best;
+	};
+	auto tightest_cluster = [&]() { return most_energy(true); };
+	auto largest_void = [&]() {
+		int best = 0;
+		double best_energy = std::numeric_limits<double>::infinity();
+		for (int p = 0; p < n; ++p)
+			if (!on[p] && energy[p] < best_energy) { best = p; best_energy = energy[p]; }
+		return best;
+	};
+
+	// Start from ~10% random pixels, then keep moving the tightest cluster into the largest
+	// void until that stops changing anything
+	pcg32 gen(size);
+	int initial = std::max(1, n / 10);
+	for (int placed = 0; placed < initial;) {
+		int p = int(gen.next_uint() % uint32_t(n));
+		if (!on[p]) { set(p, true); ++placed; }
+	}
+	while (true) {
+		int cluster = tightest_cluster();
+		set(cluster, false);
+		int hole = largest_void();
+		set(hole, true);
+		if (hole == cluster)
+			break;
+	}
+
+	std::vector<int> rank(n);
+	const std::vector<char> initial_on = on;
+	const std::vector<double> initial_energy = energy;
+
+	// Phase 1: take the initial pixels away one at a time (tightest first -> highest rank)
+	for (int r = initial - 1; r >= 0; --r) {
+		int cluster = tightest_cluster();
+		set(cluster, false);
+		rank[cluster] = r;
+	}
+
+	// Phase 2: from the initial pattern, fill the largest void until half are on
+	on = initial_on;
+	energy = initial_energy;
+	for (int r = initial; r < n / 2; ++r) {
+		int hole = largest_void();
+		set(hole, true);
+		rank[hole] = r;
+	}
+
+	// Phase 3: now the off pixels are the minority, so track their energy instead and
+	// keep turning on the off pixel that sits in the tightest cluster of off pixels
+	std::fill(energy.begin(), energy.end(), 0.0);
+	for (int p = 0; p < n; ++p)
+		if (!on[p])
+			splat(p, 1);
+	for (int r = n / 2; r < n; ++r) {
+		int best = most_energy(false);
+		on[best] = 1;
+		splat(best, -1);
+		rank[best] = r;
+	}
+
+	std::vector<float> mask(n);
+	for (int p = 0; p < n; ++p)
+		mask[p] = (rank[p] + 0.5f) / n;
+	return mask;
+}
+
+const int blue_noise_size = 64;
+
+// Built once, the first time anybody asks for it (~0.1s)
+inline const std::vector<float>& blue_noise_mask() {
+	static const std::vector<float> mask = make_blue_noise_mask(blue_noise_size);
+	return mask;
+}
+
+class sampler {
+public:
+	sampler(uint64_t seed, int samples_per_pixel, int image_width, int max_depth)
+		: seed(seed), samples_per_pixel(samples_per_pixel), image_width(image_width), max_depth(max_depth), gen(seed) {}
+	virtual ~sampler() {}
+
+	void start_path(uint64_t pixel_index, uint32_t sample_index) {
+		pixel = pixel_index;
+		sample = sample_index;
+		pixel_key = hash_seed(seed ^ hash_seed(pixel));
+		gen.start_path(pixel, sample);
+		start_vertex(0);
+	}
+
+	// depth: the remaining depth, same as ray_color's (so the first bounce is vertex 1)
+	void start_bounce(int depth) {
+		start_vertex(uint32_t(max_depth - depth + 1));
+	}
+
+	real get_1d() { return sample_1d(dimension++); }
+	point2 get_2d() { return sample_2d(dimension++); }
+
+protected:
+	virtual real sample_1d(uint32_t dim) = 0;
+	virtual point2 sample_2d(uint32_t dim) = 0;
+
+	// Scramble seeds: per (pixel, dimension), or shared by every pixel
+	uint32_t pixel_hash(uint32_t dim, uint32_t salt = 0) const {
+		return uint32_t(hash_seed(pixel_key ^ (uint64_t(dim) << 8 | salt)));
+	}
+	uint32_t global_hash(uint32_t dim, uint32_t salt = 0) const {
+		return uint32_t(hash_seed(hash_seed(seed) ^ (uint64_t(dim) << 8 | salt)));
+	}
+
+private:
+	void start_vertex(uint32_t vertex) {
+		dimension = vertex << 8; // up to 256 dimensions per vertex
+		gen.start_bounce(vertex);
+	}
+
+protected:
+	uint64_t seed;
+	int samples_per_pixel;
+	int image_width;
+	int max_depth;
+	uint64_t pixel = 0;
+	uint64_t pixel_key = 0;
+	uint32_t sample = 0;
+	uint32_t dimension = 0;
+	rng gen; // keyed by (pixel, sample, vertex), for anything that really should be random
+};
+
+class uniform_sampler : public sampler {
+public:
+	using sampler::sampler;
+
+protected:
+	virtual real sample_1d(uint32_t) override { return next_unit(gen); }
+	virtual point2 sample_2d(uint32_t) override {
+		real u = next_unit(gen);
+		return { u, next_unit(gen) };
+	}
+};
+
+class stratified_sampler : public sampler {
+public:
+	stratified_sampler(uint64_t seed, int samples_per_pixel, int image_width, int max_depth)
+		: sampler(seed, samples_per_pixel, image_width, max_depth) {
+		// The smallest grid with at least spp cells. If spp isn't a square, each
+		// sample still picks from all the cells, so some just go unused (no bias)
+		grid_x = int(ceil(sqrt(double(samples_per_pixel))));
+		grid_y = (samples_per_pixel + grid_x - 1) / grid_x;
+	}
+
+protected:
+	virtual real sample_1d(uint32_t dim) override {
+		uint32_t n = uint32_t(samples_per_pixel);
+		uint32_t cell = permute(sample % n, n, pixel_hash(dim, sample / n));
+		return (real(cell) + next_unit(gen)) / real(n);
+	}
+
+	virtual point2 sample_2d(uint32_t dim) override {
+		uint32_t n = uint32_t(samples_per_pixel);
+		uint32_t cell = permute(sample % n, uint32_t(grid_x * grid_y), pixel_hash(dim, sample / n));
+		real u = (real(cell % grid_x) + next_unit(gen)) / real(grid_x);
+		return { u, (real(cell / grid_x) + next_unit(gen)) / real(grid_y) };
+	}
+
+private:
+	int grid_x, grid_y;
+};
+
+class sobol_sampler : public sampler {
+public:
+	using sampler::sampler;
+
+protected:
+	virtual real sample_1d(uint32_t dim) override {
+		uint32_t index = nested_uniform_scramble(sample, pixel_hash(dim));
+		return fixed_to_unit(nested_uniform_scramble(sobol_0(index), pixel_hash(dim, 1)));
+	}
+
+	virtual point2 sample_2d(uint32_t dim) override {
+		uint32_t index = nested_uniform_scramble(sample, pixel_hash(dim));
+		return {
+			fixed_to_unit(nested_uniform_scramble(sobol_0(index), pixel_hash(dim, 1))),
+			fixed_to_unit(nested_uniform_scramble(sobol_1(index), pixel_hash(dim, 2)))
+		};
+	}
+};
+
+class blue_noise_sampler : public sampler {
+public:
+	blue_noise_sampler(uint64_t seed, int samples_per_pixel, int image_width, int max_depth)
+		: sampler(seed, samples_per_pixel, image_width, max_depth), mask(blue_noise_mask()) {}
+
+protected:
+	virtual real sample_1d(uint32_t dim) override {
+		uint32_t index = nested_uniform_scramble(sample, global_hash(dim));
+		return rotate(nested_uniform_scramble(sobol_0(index), global_hash(dim, 1)), global_hash(dim, 3));
+	}
+
+	virtual point2 sample_2d(uint32_t dim) override {
+		uint32_t index = nested_uniform_scramble(sample, global_hash(dim));
+		return {
+			rotate(nested_uniform_scramble(sobol_0(index), global_hash(dim, 1)), global_hash(dim, 3)),
+			rotate(nested_uniform_scramble(sobol_1(index), global_hash(dim, 2)), global_hash(dim, 4))
+		};
+	}
+
+private:
+	// Cranley-Patterson rotation by this pixel's mask value. Every dimension looks the
+	// mask up at its own (wrapped) offset, so the dimensions don't all share one shift.
+	real rotate(uint32_t x, uint32_t offset) const {
+		int px = int((pixel % uint64_t(image_width) + (offset & 0xFFFF)) % blue_noise_size);
+		int py = int((pixel / uint64_t(image_width) + (offset >> 16)) % blue_noise_size);
+		real u = fixed_to_unit(x) + mask[py * blue_noise_size + px];
+		return u < 1 ? u : u - 1;
+	}
+
+private:
+	const std::vector<float>& mask;
+};
+
+inline std::unique_ptr<sampler> make_sampler(
+	sampler_type type, uint64_t seed, int samples_per_pixel, int image_width, int max_depth
+) {
+	switch (type) {
+	case sampler_type::uniform: return std::make_unique<uniform_sampler>(seed, samples_per_pixel, image_width, max_depth);
+	case sampler_type::stratified: return std::make_unique<stratified_sampler>(seed, samples_per_pixel, image_width, max_depth);
+	case sampler_type::blue_noise: return std::make_unique<blue_noise_sampler>(seed, samples_per_pixel, image_width, max_depth);
+	case sampler_type::sobol: break;
+	}
+	return std::make_unique<sobol_sampler>(seed, samples_per_pixel, image_width, max_depth);
+}
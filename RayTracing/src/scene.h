@@ -0,0 +1,261 @@
+#pragma once
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "parallel.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <vector>
+
+// Where the camera sits - the same parameters as camera's constructor. The defaults are the
+// random_scene view.
+struct camera_setup {
+	point3 lookfrom = point3(13, 2, 3);
+	point3 lookat = point3(0, 0, 0);
+	vec3 vup = vec3(0, 1, 0); // (0,1,0) is world up
+	double vfov = 20; // degrees
+	double aspect_ratio = 16.0 / 9.0;
+	double aperture = 0.1; // 0 -> everything in focus
+	double focus_dist = 10; // (lookfrom - lookat).length() puts lookat in focus
+
+	camera make_camera() const {
+		return camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, focus_dist);
+	}
+};
+
+// Spheres and meshes that get built once, and placed any number of times (instance.h). Their
+// materials are the scene's, same as everything else's.
+struct scene_group {
+	shared_ptr<sphere_set> spheres = make_shared<sphere_set>(); // (not built yet)
+	std::vector<shared_ptr<triangle_mesh>> meshes;              // (not built yet)
+
+	bool empty() const { return spheres->mat_id.size() == 0 && meshes.empty(); } // (size() is 0 until it's built)
+
+	// Builds everything's tree, and returns what its instances should point to
+	shared_ptr<hittable> build(int threads = 0) {
+		auto list = make_shared<hittable_list>();
+		if (!spheres->mat_id.empty()) {
+			spheres->build(threads);
+			list->add(spheres);
+		}
+		for (const auto& mesh : meshes) {
+			mesh->build(threads);
+			list->add(mesh);
+		}
+		// (skip the list when there's only one thing in it)
+		return list->objects.size() == 1 ? list->objects[0] : list;
+	}
+
+	size_t memory_bytes() const {
+		size_t bytes = spheres->memory_bytes();
+		for (const auto& mesh : meshes)
+			bytes += mesh->memory_bytes();
+		return bytes;
+	}
+};
+
+// One copy of groups[group], placed in the world
+struct group_instance {
+	uint32_t group;
+	affine_transform to_world;
+};
+
+// Everything a render needs to know about the world: the camera, the objects (only while
+// building - they get packed into a sphere_set or bvh), and the materials they point into.
+// Spheres can also skip the objects list, and go straight into `spheres` (not built yet) -
+// no allocation or virtual call per sphere, which is what makes 100M of them possible.
+// Triangle meshes (from OBJ files) each get their own BVH, so they're kept apart in `meshes`.
+// Anything that gets repeated can go in a group instead, and get placed as many times as it
+// likes (`instances` - see instance.h).
+// Scenes can also come from a file (scene_file.h) or a prebuilt cache (scene_cache.h).
+struct scene {
+	camera_setup view;
+	// Render settings the scene asks for (0 -> main()'s defaults). The command line beats these.
+	int image_width = 0;
+	int samples_per_pixel = 0;
+	int max_depth = 0;
+	color sky = color(1, 1, 1); // the background gets multiplied by this (turn it down to let lights.h's lights show)
+
+	hittable_list objects;
+	sphere_set spheres;
+	std::vector<shared_ptr<triangle_mesh>> meshes; // (not built yet either)
+	std::vector<scene_group> groups;
+	std::vector<group_instance> instances; // copies of the groups, placed
+	material_table materials;
+
+	material_id add_material(const material& m) {
+		materials.push_back(m);
+		return material_id(materials.size() - 1);
+	}
+};
+
+// Builds every group that gets used, and puts its instances in top (built too). The instances'
+// object_ids are first_object_id, first_object_id + 1, ... (in s.instances order).
+inline void build_instances(scene& s, instance_bvh& top, uint32_t first_object_id, int threads = 0) {
+	std::vector<shared_ptr<hittable>> built(s.groups.size());
+	for (size_t k = 0; k < s.instances.size(); ++k) {
+		const group_instance& placed = s.instances[k];
+		if (!built[placed.group])
+			built[placed.group] = s.groups[placed.group].build(threads);
+		top.add(instance(built[placed.group], placed.to_world, first_object_id + uint32_t(k)));
+	}
+	top.build(threads);
+}
+
+// Adds random_scene's spheres (and their materials) to result.
+// grid_extent: small spheres are scattered over a (2*grid_extent)^2 grid (11 -> ~480 spheres; 500 -> ~1M)
+inline void add_random_spheres(scene& result, uint64_t seed, int grid_extent = 11) {
+	hittable_list& world = result.objects;
+	auto ground_material = result.add_material(lambertian(color(0.5, 0.5, 0.5)));
+	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+	// Add a bunch of smaller random spheres
+	pcg32 gen(seed); // same seed -> same scene (handy for videos)
+	for (int a = -grid_extent; a < grid_extent; a++) { // position in x + rand
+		for (int b = -grid_extent; b < grid_extent; b++) { // position in z + rand
+			auto choose_mat = random_double(gen);
+			point3 center(a + 0.9*random_double(gen), 0.2, b + 0.9*random_double(gen));
+
+			if ((center - point3(4, real(0.2), 0)).length() > real(0.9)) {
+				material_id sphere_material;
+
+				if (choose_mat < 0.8) {
+					// diffuse / non-reflective
+					auto albedo = color::random(gen) * color::random(gen); // TODO: why squared??? Maybe just to lower the ave values a bit?
+					sphere_material = result.add_material(lambertian(albedo));
+					world.add(make_shared<sphere>(center, 0.2, sphere_material)); // TODO: consider randomizing the radiuses as well
+				}
+				else if (choose_mat < 0.95) { // TODO: more intuitive to use the prob of this category, rather than this minus .8 from prev
+					// metal / reflective
+					auto albedo = color::random(gen, 0.5, 1);
+					auto fuzz = random_double(gen, 0, 0.5);
+					sphere_material = result.add_material(metal(albedo, fuzz));
+					world.add(make_shared<sphere>(center, 0.2, sphere_material));
+				}
+				else {
+					// dielectric / glass
+					sphere_material = result.add_material(dielectric(1.52)); // 1.52 = index of refraction of glass
+					world.add(make_shared<sphere>(center, 0.2, sphere_material));
+				}
+			}
+		}
+	}
+
+	// A larger show piece for each material
+	auto material1 = result.add_material(dielectric(1.5));
+	world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+	auto material2 = result.add_material(lambertian(color(0.4, 0.2, 0.1)));
+	world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+	auto material3 = result.add_material(metal(color(0.7, 0.6, 0.5), 0.0));
+	world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+}
+
+inline scene random_scene(uint64_t seed, int grid_extent = 11) {
+	scene result;
+	add_random_spheres(result, seed, grid_extent);
+	return result;
+}
+
+// random_scene's layout, for when there are going to be millions of spheres (grid_extent 5000 ->
+// 100M). Everything goes straight into result.spheres, and the rows are generated on several
+// threads. To make that work:
+//	- each row of the grid gets its own random stream, so the scene only depends on the seed (not
+//	on the thread count). It's a different scene than add_random_spheres with the same seed.
+//	- the materials are a fixed palette, made up front: colors and fuzz get rounded to a few
+//	levels each, and every sphere with the same ones shares a material. That's 8197 materials
+//	however many spheres there are (one each would take more memory than the spheres).
+//	- the cells that could overlap the big metal sphere are always skipped, so every row knows
+//	where its spheres go before anything's been generated
+inline void add_sphere_field(scene& result, uint64_t seed, int grid_extent, int threads = 0) {
+	const int lambertian_levels = 16; // per color channel
+	const int metal_levels = 8;       // per color channel, and for fuzz
+	auto level = [](double value, int levels) { return std::min(levels - 1, int(value * levels)); };
+	auto level_value = [](int q, int levels) { return (q + 0.5) / levels; };
+
+	auto ground_material = result.add_material(lambertian(color(0.5, 0.5, 0.5)));
+	const material_id first_lambertian = material_id(result.materials.size());
+	for (int r = 0; r < lambertian_levels; ++r)
+		for (int g = 0; g < lambertian_levels; ++g)
+			for (int b = 0; b < lambertian_levels; ++b)
+				result.add_material(lambertian(color(level_value(r, lambertian_levels),
+					level_value(g, lambertian_levels), level_value(b, lambertian_levels))));
+	const material_id first_metal = material_id(result.materials.size());
+	for (int r = 0; r < metal_levels; ++r)
+		for (int g = 0; g < metal_levels; ++g)
+			for (int b = 0; b < metal_levels; ++b)
+				for (int f = 0; f < metal_levels; ++f)
+					result.add_material(metal(color(0.5 + 0.5 * level_value(r, metal_levels),
+						0.5 + 0.5 * level_value(g, metal_levels), 0.5 + 0.5 * level_value(b, metal_levels)),
+						0.5 * level_value(f, metal_levels)));
+	const material_id glass = result.add_material(dielectric(1.52));
+
+	sphere_set& spheres = result.spheres;
+	spheres.add(point3(0, -1000, 0), 1000, ground_material);
+
+	// Where each row's spheres start
+	auto skipped = [](int a, int b) { return (a == 3 || a == 4) && (b == -1 || b == 0); };
+	const int side = 2 * grid_extent;
+	std::vector<size_t> row_first(side + 1, 0);
+	for (int row = 0; row < side; ++row) {
+		int a = row - grid_extent;
+		size_t kept = size_t(side);
+		for (int b = -1; b <= 0; ++b)
+			kept -= skipped(a, b) ? 1 : 0;
+		row_first[row + 1] = row_first[row] + kept;
+	}
+	const size_t first = spheres.add_uninitialized(row_first[side]);
+	real* x = spheres.cx.writable_data() + first;
+	real* y = spheres.cy.writable_data() + first;
+	real* z = spheres.cz.writable_data() + first;
+	real* radius = spheres.radius.writable_data() + first;
+	material_id* mat = spheres.mat_id.writable_data() + first;
+
+	parallel_for(size_t(side), threads, [&](size_t row_begin, size_t row_end) {
+		for (size_t row = row_begin; row < row_end; ++row) {
+			pcg32 gen(seed, row);
+			int a = int(row) - grid_extent;
+			size_t k = row_first[row];
+			for (int b = -grid_extent; b < grid_extent; ++b) {
+				if (skipped(a, b))
+					continue;
+				auto choose_mat = random_double(gen);
+				x[k] = real(a + 0.9 * random_double(gen));
+				y[k] = real(0.2);
+				z[k] = real(b + 0.9 * random_double(gen));
+				radius[k] = real(0.2);
+				if (choose_mat < 0.8) {
+					// diffuse: same squared-random colors as random_scene
+					int red = level(random_double(gen) * random_double(gen), lambertian_levels);
+					int green = level(random_double(gen) * random_double(gen), lambertian_levels);
+					int blue = level(random_double(gen) * random_double(gen), lambertian_levels);
+					mat[k] = first_lambertian + material_id((red * lambertian_levels + green) * lambertian_levels + blue);
+				}
+				else if (choose_mat < 0.95) {
+					// metal: albedo in [0.5, 1), fuzz in [0, 0.5)
+					int red = level(random_double(gen), metal_levels);
+					int green = level(random_double(gen), metal_levels);
+					int blue = level(random_double(gen), metal_levels);
+					int fuzz = level(random_double(gen), metal_levels);
+					mat[k] = first_metal + material_id(((red * metal_levels + green) * metal_levels + blue) * metal_levels + fuzz);
+				}
+				else {
+					mat[k] = glass;
+				}
+				++k;
+			}
+		}
+	});
+
+	// A larger show piece for each material
+	spheres.add(point3(0, 1, 0), 1, result.add_material(dielectric(1.5)));
+	spheres.add(point3(-4, 1, 0), 1, result.add_material(lambertian(color(0.4, 0.2, 0.1))));
+	spheres.add(point3(4, 1, 0), 1, result.add_material(metal(color(0.7, 0.6, 0.5), 0.0)));
+}
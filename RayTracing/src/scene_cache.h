@@ -0,0 +1,224 @@
+/******************************************************************************
+Trevor's thoughts:
+A text scene (scene_file.h) has to be parsed, turned into spheres, packed into a
+sphere_set and sorted into a BVH before the first ray goes out. That's fine for
+a few hundred spheres, but it takes a while for millions. A scene cache is the
+finished product: the sphere_set's arrays, its BVH nodes and the material table,
+byte for byte the way they sit in memory. Loading one is just mapping the file
+(mapped_file.h) and pointing at it - nothing gets parsed, copied or built, and
+the OS only reads in the pages that rays actually touch.
+
+	RayTracing --scene big.txt --save-cache big.rtscene   (once - builds it and exits)
+	RayTracing --scene big.rtscene                        (every time after that)
+
+Since it's the raw in-memory layout, a cache only works on the same kind of build
+that wrote it: same byte order, and the same `real` (RT_USE_FLOAT or not). The
+header records both, and the loader refuses anything that doesn't match, rather
+than reading garbage. It trusts everything else in the file.
+
+Layout: a scene_cache_header, then each array starting on a 64 byte boundary (at
+the offset the header gives for it). The sphere arrays get scene_cache_padding
+zeros on the end, so they're already padded for the widest SIMD loads.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "scene.h"
+#include "sphere_set.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+const char scene_cache_magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '2' }; // the last byte is the version (2: + sky)
+const uint32_t scene_cache_byte_order = 0x01020304; // reads back differently on a machine with the other byte order
+const size_t scene_cache_alignment = 64;
+const size_t scene_cache_padding = 16; // >= sphere_lanes on any build
+
+struct scene_cache_header {
+	char magic[8];
+	uint32_t byte_order;    // scene_cache_byte_order
+	uint32_t real_size;     // sizeof(real): 8, or 4 from an RT_USE_FLOAT build
+	uint32_t node_size;     // sizeof(bvh_node)
+	uint32_t material_size; // sizeof(material)
+
+	// camera_setup, and the scene's render settings
+	double lookfrom[3], lookat[3], vup[3];
+	double vfov, aspect_ratio, aperture, focus_dist;
+	double sky[3];
+	int32_t image_width, samples_per_pixel, max_depth, unused;
+
+	uint64_t num_spheres, num_nodes, num_materials;
+	// Byte offsets from the start of the file
+	uint64_t cx, cy, cz, radius, mat_id, nodes, materials;
+};
+
+// The material table gets used straight out of the file, so it has to be plain bytes
+static_assert(std::is_trivially_copyable<material>::value, "material has to be trivially copyable to be cached");
+static_assert(std::is_trivially_copyable<bvh_node>::value, "bvh_node has to be trivially copyable to be cached");
+
+inline bool is_scene_cache(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	char magic[sizeof(scene_cache_magic)];
+	// (any version - load_scene_cache says so if it's an old one)
+	return file.read(magic, sizeof(magic)) && std::memcmp(magic, scene_cache_magic, sizeof(magic) - 1) == 0;
+}
+
+// Writes s's camera, render settings and materials, and spheres (already built)
+inline bool save_scene_cache(const std::string& path, const scene& s, const sphere_set& spheres) {
+	scene_cache_header h = {};
+	std::memcpy(h.magic, scene_cache_magic, sizeof(h.magic));
+	h.byte_order = scene_cache_byte_order;
+	h.real_size = sizeof(real);
+	h.node_size = sizeof(bvh_node);
+	h.material_size = sizeof(material);
+	const camera_setup& view = s.view;
+	for (int k = 0; k < 3; ++k) {
+		h.lookfrom[k] = double(view.lookfrom[k]);
+		h.lookat[k] = double(view.lookat[k]);
+		h.vup[k] = double(view.vup[k]);
+	}
+	h.vfov = view.vfov;
+	h.aspect_ratio = view.aspect_ratio;
+	h.aperture = view.aperture;
+	h.focus_dist = view.focus_dist;
+	for (int k = 0; k < 3; ++k)
+		h.sky[k] = double(s.sky[k]);
+	h.image_width = s.image_width;
+	h.samples_per_pixel = s.samples_per_pixel;
+	h.max_depth = s.max_depth;
+	h.num_spheres = spheres.size();
+	h.num_nodes = spheres.nodes.size();
+	h.num_materials = s.materials.size();
+
+	// Lay the arrays out one after another, each on a fresh 64 byte boundary
+	uint64_t end = sizeof(h);
+	auto place = [&](uint64_t& offset, uint64_t bytes) {
+		offset = (end + scene_cache_alignment - 1) / scene_cache_alignment * scene_cache_alignment;
+		end = offset + bytes;
+	};
+	const uint64_t padded_spheres = h.num_spheres + scene_cache_padding;
+	place(h.cx, padded_spheres * sizeof(real));
+	place(h.cy, padded_spheres * sizeof(real));
+	place(h.cz, padded_spheres * sizeof(real));
+	place(h.radius, padded_spheres * sizeof(real));
+	place(h.mat_id, h.num_spheres * sizeof(material_id));
+	place(h.nodes, h.num_nodes * sizeof(bvh_node));
+	place(h.materials, h.num_materials * sizeof(material));
+
+	std::ofstream file(path, std::ios::binary);
+	uint64_t written = 0;
+	auto write_at = [&](uint64_t offset, const void* bytes, uint64_t count) {
+		static const char zeros[scene_cache_alignment] = {};
+		while (written < offset) {
+			uint64_t n = std::min<uint64_t>(offset - written, sizeof(zeros));
+			file.write(zeros, std::streamsize(n));
+			written += n;
+		}
+		file.write(static_cast<const char*>(bytes), std::streamsize(count));
+		written += count;
+	};
+	const real no_spheres[scene_cache_padding] = {};
+	auto write_spheres = [&](uint64_t offset, const mapped_array<real>& values) {
+		write_at(offset, values.data(), h.num_spheres * sizeof(real));
+		write_at(offset + h.num_spheres * sizeof(real), no_spheres, sizeof(no_spheres));
+	};
+	write_at(0, &h, sizeof(h));
+	write_spheres(h.cx, spheres.cx);
+	write_spheres(h.cy, spheres.cy);
+	write_spheres(h.cz, spheres.cz);
+	write_spheres(h.radius, spheres.radius);
+	write_at(h.mat_id, spheres.mat_id.data(), h.num_spheres * sizeof(material_id));
+	write_at(h.nodes, spheres.nodes.data(), h.num_nodes * sizeof(bvh_node));
+	write_at(h.materials, s.materials.data(), h.num_materials * sizeof(material));
+
+	if (!file.flush()) {
+		std::cerr << "Couldn't write " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+// Maps the cache, and points out's materials and spheres straight into it (out's camera and
+// render settings get copied over). The mapping stays open until nothing is using it.
+inline bool load_scene_cache(const std::string& path, scene& out, sphere_set& spheres) {
+	std::shared_ptr<const mapped_file> file = mapped_file::open(path);
+	if (!file) {
+		std::cerr << "Couldn't map " << path << "\n";
+		return false;
+	}
+
+	scene_cache_header h;
+	const size_t version_byte = sizeof(scene_cache_magic) - 1;
+	if (file->size() < version_byte || std::memcmp(file->data(), scene_cache_magic, version_byte) != 0) {
+		std::cerr << path << " isn't a scene cache\n";
+		return false;
+	}
+	if (file->size() < sizeof(h) || file->data()[version_byte] != scene_cache_magic[version_byte]) {
+		std::cerr << path << " was written by an older build - save it again from the scene file\n";
+		return false;
+	}
+	std::memcpy(&h, file->data(), sizeof(h));
+	if (h.real_size != sizeof(real)) {
+		std::cerr << path << " was written by a " << (h.real_size == 4 ? "float (RT_USE_FLOAT)" : "double")
+			<< " build, and this is a " << (sizeof(real) == 4 ? "float" : "double") << " one - save it again from the scene file\n";
+		return false;
+	}
+	if (h.byte_order != scene_cache_byte_order || h.node_size != sizeof(bvh_node) || h.material_size != sizeof(material)) {
+		std::cerr << path << " was written on a different kind of machine (or by an older build) - save it again from the scene file\n";
+		return false;
+	}
+
+	// Everything has to fit in the file (and be aligned, since we're going to point right at it)
+	bool fits = true;
+	auto check = [&](uint64_t offset, uint64_t count, size_t element_size) {
+		fits = fits && offset % scene_cache_alignment == 0 && offset <= file->size()
+			&& count <= (file->size() - offset) / element_size;
+	};
+	const uint64_t padded_spheres = h.num_spheres + scene_cache_padding;
+	check(h.cx, padded_spheres, sizeof(real));
+	check(h.cy, padded_spheres, sizeof(real));
+	check(h.cz, padded_spheres, sizeof(real));
+	check(h.radius, padded_spheres, sizeof(real));
+	check(h.mat_id, h.num_spheres, sizeof(material_id));
+	check(h.nodes, h.num_nodes, sizeof(bvh_node));
+	check(h.materials, h.num_materials, sizeof(material));
+	if (!fits || (h.num_spheres > 0) != (h.num_nodes > 0)) {
+		std::cerr << path << " is truncated or corrupt\n";
+		return false;
+	}
+
+	camera_setup& view = out.view;
+	view.lookfrom = point3(real(h.lookfrom[0]), real(h.lookfrom[1]), real(h.lookfrom[2]));
+	view.lookat = point3(real(h.lookat[0]), real(h.lookat[1]), real(h.lookat[2]));
+	view.vup = vec3(real(h.vup[0]), real(h.vup[1]), real(h.vup[2]));
+	view.vfov = h.vfov;
+	view.aspect_ratio = h.aspect_ratio;
+	view.aperture = h.aperture;
+	view.focus_dist = h.focus_dist;
+	out.sky = color(real(h.sky[0]), real(h.sky[1]), real(h.sky[2]));
+	out.image_width = h.image_width;
+	out.samples_per_pixel = h.samples_per_pixel;
+	out.max_depth = h.max_depth;
+
+	const char* base = file->data();
+	auto reals = [&](uint64_t offset) {
+		return mapped_array<real>(reinterpret_cast<const real*>(base + offset), size_t(padded_spheres), file);
+	};
+	spheres.cx = reals(h.cx);
+	spheres.cy = reals(h.cy);
+	spheres.cz = reals(h.cz);
+	spheres.radius = reals(h.radius);
+	spheres.mat_id = mapped_array<material_id>(reinterpret_cast<const material_id*>(base + h.mat_id), size_t(h.num_spheres), file);
+	spheres.nodes = mapped_array<bvh_node>(reinterpret_cast<const bvh_node*>(base + h.nodes), size_t(h.num_nodes), file);
+	spheres.num_spheres = size_t(h.num_spheres);
+	out.materials = material_table(reinterpret_cast<const material*>(base + h.materials), size_t(h.num_materials), file);
+	return true;
+}
@@ -0,0 +1,451 @@
+/******************************************************************************
+Trevor's thoughts:
+Scenes used to only exist as code (random_scene, and the commented out spheres
+in main), so trying a different one meant a rebuild. Now they can be a text file
+(--scene my_scene.txt). One thing per line, # starts a comment:
+
+	camera lookfrom 13 2 3  lookat 0 0 0  vup 0 1 0  vfov 20  aspect 16/9  aperture 0.1  focus_dist 10
+	render width 1200  spp 512  depth 50
+	material ground lambertian 0.5 0.5 0.5     (albedo)
+	material gold metal 0.8 0.6 0.2 0.3        (albedo, fuzz)
+	material glass dielectric 1.5              (index of refraction)
+	material lamp light 4 4 4                  (radiance - spheres and meshes made of it are lights, see lights.h)
+	sky 0.1 0.1 0.1                            (scales the background - the sky's light - default 1 1 1)
+	sphere 0 -1000 0  1000  ground             (center, radius, material name)
+	random_spheres seed 0 extent 11            (random_scene's spheres, see scene.h)
+	sphere_field seed 0 extent 5000            (the same idea at 100M spheres: add_sphere_field)
+	mesh bunny.obj white scale 10 translate 0 1 0   (a triangle mesh from an OBJ file, see obj_file.h)
+	group tree                                 (the spheres and meshes up to `end` go in the group instead)
+	end
+	instance tree rotate 0 1 0 45 scale 2 translate 5 0 3   (a copy of a group, placed - instance.h)
+
+camera and render take any of their settings, in any order; anything left out
+keeps its default (camera_setup in scene.h, and main() for render). A negative
+radius makes a hollow sphere, same as in code. Materials have to be defined
+before the spheres and meshes that use them. A mesh's path is relative to the
+scene file, and scale and translate (both optional) get applied in that order
+(a negative scale turns the mesh inside out, like a negative radius does).
+A group only gets built once, however many instances of it there are. An
+instance's scale, rotate (axis, then degrees) and translate can come in any
+order, any number of times, and get applied in the order they're written. A
+negative instance scale is just a mirror: the group's surfaces keep facing
+outwards (the normals go through the transform with it), unlike a negative mesh
+scale or a negative radius, which turn things inside out.
+
+Text is nice to edit, but slow to read for millions of spheres - for those, see
+scene_cache.h. --save-scene writes any scene (even a cached one) back out as text.
+Neither of those does meshes or groups yet - meshes are already in a file of their own.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "material.h"
+#include "obj_file.h"
+#include "scene.h"
+#include "sphere_set.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+class scene_parser {
+public:
+	// camera_only: skip everything but the camera lines (see read_scene_camera)
+	scene_parser(const std::string& path, scene& out, bool camera_only = false) : path(path), out(out), camera_only(camera_only) {}
+
+	bool parse(std::istream& in) {
+		std::string text;
+		while (std::getline(in, text)) {
+			++line_number;
+			size_t comment = text.find('#');
+			if (comment != std::string::npos)
+				text.resize(comment);
+			line.clear();
+			line.str(text);
+
+			std::string keyword;
+			if (!(line >> keyword))
+				continue; // blank (or just a comment)
+			if (camera_only && keyword != "camera")
+				continue;
+			bool ok;
+			if (keyword == "camera") ok = parse_camera();
+			else if (keyword == "render") ok = parse_render();
+			else if (keyword == "sky") ok = read_vec3(out.sky);
+			else if (keyword == "material") ok = parse_material();
+			else if (keyword == "sphere") ok = parse_sphere();
+			else if (keyword == "random_spheres") ok = parse_random_spheres();
+			else if (keyword == "sphere_field") ok = parse_sphere_field();
+			else if (keyword == "mesh") ok = parse_mesh();
+			else if (keyword == "group") ok = parse_group();
+			else if (keyword == "end") ok = parse_end();
+			else if (keyword == "instance") ok = parse_instance();
+			else ok = fail("unknown keyword '" + keyword + "'");
+			if (!ok)
+				return false;
+
+			std::string extra;
+			if (line >> extra)
+				return fail("unexpected '" + extra + "'");
+		}
+		if (open_group)
+			return fail("group '" + open_group_name + "' needs an end");
+		return true;
+	}
+
+private:
+	bool parse_camera() {
+		camera_setup& view = out.view;
+		std::string key;
+		while (line >> key) {
+			bool ok;
+			if (key == "lookfrom") ok = read_vec3(view.lookfrom);
+			else if (key == "lookat") ok = read_vec3(view.lookat);
+			else if (key == "vup") ok = read_vec3(view.vup);
+			else if (key == "vfov") ok = read_number(view.vfov);
+			else if (key == "aspect") ok = read_number(view.aspect_ratio);
+			else if (key == "aperture") ok = read_number(view.aperture);
+			else if (key == "focus_dist") ok = read_number(view.focus_dist);
+			else return fail("unknown camera setting '" + key + "'");
+			if (!ok)
+				return false;
+		}
+		if (view.vfov <= 0 || view.vfov >= 180 || view.aspect_ratio <= 0 || view.aperture < 0)
+			return fail("camera needs 0 < vfov < 180, aspect > 0 and aperture >= 0");
+		return true;
+	}
+
+	bool parse_render() {
+		std::string key;
+		while (line >> key) {
+			int* setting;
+			if (key == "width") setting = &out.image_width;
+			else if (key == "spp") setting = &out.samples_per_pixel;
+			else if (key == "depth") setting = &out.max_depth;
+			else return fail("unknown render setting '" + key + "'");
+			double value;
+			if (!read_number(value))
+				return false;
+			if (value < 1)
+				return fail(key + " has to be at least 1");
+			*setting = int(value);
+		}
+		return true;
+	}
+
+	bool parse_material() {
+		std::string name, kind;
+		if (!(line >> name >> kind))
+			return fail("expected: material <name> <lambertian|metal|dielectric|light> <parameters>");
+		if (names.count(name))
+			return fail("material '" + name + "' is already defined");
+
+		vec3 albedo;
+		double value;
+		if (kind == "lambertian") {
+			if (!read_vec3(albedo))
+				return false;
+			names[name] = out.add_material(lambertian(albedo));
+		}
+		else if (kind == "metal") {
+			if (!read_vec3(albedo) || !read_number(value))
+				return false;
+			names[name] = out.add_material(metal(albedo, real(value)));
+		}
+		else if (kind == "dielectric") {
+			if (!read_number(value))
+				return false;
+			names[name] = out.add_material(dielectric(real(value)));
+		}
+		else if (kind == "light") {
+			if (!read_vec3(albedo))
+				return false;
+			names[name] = out.add_material(diffuse_light(albedo));
+		}
+		else {
+			return fail("unknown material kind '" + kind + "'");
+		}
+		return true;
+	}
+
+	bool parse_sphere() {
+		point3 center;
+		double radius;
+		std::string name;
+		if (!read_vec3(center) || !read_number(radius))
+			return false;
+		if (!(line >> name))
+			return fail("expected: sphere <x> <y> <z> <radius> <material>");
+		auto m = names.find(name);
+		if (m == names.end())
+			return fail("no material called '" + name + "' (define it before the spheres that use it)");
+		(open_group ? *open_group->spheres : out.spheres).add(center, real(radius), m->second);
+		return true;
+	}
+
+	bool parse_random_spheres() {
+		if (open_group)
+			return fail("random_spheres can't go in a group");
+		double seed = 0, extent = 11;
+		if (!read_seed_and_extent("random_spheres", seed, extent))
+			return false;
+		add_random_spheres(out, uint64_t(seed), int(extent));
+		return true;
+	}
+
+	bool parse_sphere_field() {
+		if (open_group)
+			return fail("sphere_field can't go in a group");
+		double seed = 0, extent = 11;
+		if (!read_seed_and_extent("sphere_field", seed, extent))
+			return false;
+		// (a sphere index is 32 bits, so this is about as big as it gets)
+		if (extent > 30000)
+			return fail("sphere_field can't go past extent 30000 (3.6 billion spheres)");
+		add_sphere_field(out, uint64_t(seed), int(extent));
+		return true;
+	}
+
+	bool parse_mesh() {
+		std::string file, name;
+		if (!(line >> file >> name))
+			return fail("expected: mesh <file.obj> <material> [scale <s>] [translate <x> <y> <z>]");
+		auto m = names.find(name);
+		if (m == names.end())
+			return fail("no material called '" + name + "' (define it before the meshes that use it)");
+		double scale = 1;
+		vec3 translate(0, 0, 0);
+		std::string key;
+		while (line >> key) {
+			bool ok;
+			if (key == "scale") ok = read_number(scale);
+			else if (key == "translate") ok = read_vec3(translate);
+			else return fail("unknown mesh setting '" + key + "'");
+			if (!ok)
+				return false;
+		}
+		if (scale == 0)
+			return fail("a mesh can't have scale 0");
+
+		// Relative to the scene file, not to wherever we got run from
+		size_t slash = path.find_last_of("/\\");
+		bool absolute = !file.empty() && (file[0] == '/' || file[0] == '\\' || file.find(':') != std::string::npos);
+		if (!absolute && slash != std::string::npos)
+			file = path.substr(0, slash + 1) + file;
+
+		auto mesh = make_shared<triangle_mesh>();
+		if (!load_obj(file, *mesh))
+			return fail("couldn't load mesh " + file);
+		if (mesh->num_triangles() == 0)
+			return fail(file + " doesn't have any triangles");
+		mesh->transform(real(scale), translate);
+		mesh->mat_id = m->second;
+		(open_group ? open_group->meshes : out.meshes).push_back(mesh);
+		return true;
+	}
+
+	bool parse_group() {
+		std::string name;
+		if (!(line >> name))
+			return fail("expected: group <name>");
+		if (open_group)
+			return fail("groups can't go inside other groups (end '" + open_group_name + "' first)");
+		if (group_names.count(name))
+			return fail("group '" + name + "' is already defined");
+		group_names[name] = uint32_t(out.groups.size());
+		out.groups.push_back(scene_group());
+		open_group = &out.groups.back();
+		open_group_name = name;
+		return true;
+	}
+
+	bool parse_end() {
+		if (!open_group)
+			return fail("end without a group");
+		if (open_group->empty())
+			return fail("group '" + open_group_name + "' doesn't have anything in it");
+		open_group = nullptr;
+		return true;
+	}
+
+	bool parse_instance() {
+		std::string name;
+		if (!(line >> name))
+			return fail("expected: instance <group> [scale <s>] [rotate <x> <y> <z> <degrees>] [translate <x> <y> <z>]");
+		if (open_group)
+			return fail("instances can't go inside a group");
+		auto g = group_names.find(name);
+		if (g == group_names.end())
+			return fail("no group called '" + name + "' (define it before its instances)");
+		affine_transform to_world;
+		std::string key;
+		while (line >> key) {
+			double scale, degrees;
+			vec3 v;
+			if (key == "scale") {
+				if (!read_number(scale))
+					return false;
+				to_world = to_world.then(affine_transform::scale(vec3(real(scale), real(scale), real(scale))));
+			}
+			else if (key == "rotate") {
+				if (!read_vec3(v) || !read_number(degrees))
+					return false;
+				if (v.length_squared() == 0)
+					return fail("rotate needs an axis that isn't 0 0 0");
+				to_world = to_world.then(affine_transform::rotate(v, degrees));
+			}
+			else if (key == "translate") {
+				if (!read_vec3(v))
+					return false;
+				to_world = to_world.then(affine_transform::translate(v));
+			}
+			else {
+				return fail("unknown instance setting '" + key + "'");
+			}
+		}
+		if (to_world.determinant() == 0)
+			return fail("an instance can't have scale 0");
+		out.instances.push_back({ g->second, to_world });
+		return true;
+	}
+
+	bool read_seed_and_extent(const std::string& keyword, double& seed, double& extent) {
+		std::string key;
+		while (line >> key) {
+			bool ok;
+			if (key == "seed") ok = read_number(seed);
+			else if (key == "extent") ok = read_number(extent);
+			else return fail("unknown " + keyword + " setting '" + key + "'");
+			if (!ok)
+				return false;
+		}
+		if (seed < 0 || extent < 1)
+			return fail(keyword + " needs seed >= 0 and extent >= 1");
+		return true;
+	}
+
+	// A number, or a ratio like 16/9
+	bool read_number(double& value) {
+		std::string word;
+		if (!(line >> word))
+			return fail("expected a number");
+		char* end;
+		value = std::strtod(word.c_str(), &end);
+		bool ok = end != word.c_str();
+		if (ok && *end == '/') {
+			const char* start = end + 1;
+			double denominator = std::strtod(start, &end);
+			ok = end != start && denominator != 0;
+			value /= denominator;
+		}
+		if (!ok || *end != '\0')
+			return fail("expected a number, got '" + word + "'");
+		return true;
+	}
+
+	bool read_vec3(vec3& v) {
+		double x, y, z;
+		if (!read_number(x) || !read_number(y) || !read_number(z))
+			return false;
+		v = vec3(real(x), real(y), real(z));
+		return true;
+	}
+
+	bool fail(const std::string& message) {
+		std::cerr << path << ":" << line_number << ": " << message << "\n";
+		return false;
+	}
+
+	const std::string& path;
+	scene& out;
+	bool camera_only;
+	std::unordered_map<std::string, material_id> names;
+	std::unordered_map<std::string, uint32_t> group_names; // -> index in out.groups
+	scene_group* open_group = nullptr; // between group and end: where spheres and meshes go
+	std::string open_group_name;
+	std::istringstream line;
+	int line_number = 0;
+};
+
+// Adds everything in the file to out (camera, render settings, materials, spheres, meshes, groups
+// and instances)
+inline bool load_scene_file(const std::string& path, scene& out) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "Couldn't read " << path << "\n";
+		return false;
+	}
+	return scene_parser(path, out).parse(file);
+}
+
+// Just the camera lines of a scene file: each one changes the settings it mentions, starting
+// from view (the preview follows a scene file's camera this way - preview.h)
+inline bool read_scene_camera(const std::string& path, std::istream& in, camera_setup& view) {
+	scene s;
+	s.view = view;
+	if (!scene_parser(path, s, true).parse(in))
+		return false;
+	view = s.view;
+	return true;
+}
+
+// Writes the scene back out as text: s for the camera, render settings and materials, and
+// spheres for the geometry (so it works for a cached scene too, which has no objects list).
+// Numbers get every digit, so reading it back in gives exactly the same scene.
+inline void write_scene_text(std::ostream& out, const scene& s, const sphere_set& spheres) {
+	out.precision(std::numeric_limits<double>::max_digits10);
+	out << "# " << spheres.size() << " spheres, " << s.materials.size() << " materials\n";
+	const camera_setup& view = s.view;
+	out << "camera lookfrom " << view.lookfrom << "  lookat " << view.lookat << "  vup " << view.vup
+		<< "  vfov " << view.vfov << "  aspect " << view.aspect_ratio
+		<< "  aperture " << view.aperture << "  focus_dist " << view.focus_dist << "\n";
+	if (s.image_width > 0 || s.samples_per_pixel > 0 || s.max_depth > 0) {
+		out << "render";
+		if (s.image_width > 0) out << " width " << s.image_width;
+		if (s.samples_per_pixel > 0) out << " spp " << s.samples_per_pixel;
+		if (s.max_depth > 0) out << " depth " << s.max_depth;
+		out << "\n";
+	}
+	if (s.sky.x() != 1 || s.sky.y() != 1 || s.sky.z() != 1)
+		out << "sky " << s.sky << "\n";
+
+	for (size_t k = 0; k < s.materials.size(); ++k) {
+		const material& m = s.materials[k];
+		out << "material m" << k << " ";
+		switch (m.type()) {
+		case material_type::lambertian:
+			out << "lambertian " << m.get<lambertian>().albedo;
+			break;
+		case material_type::metal:
+			out << "metal " << m.get<metal>().albedo << " " << m.get<metal>().fuzz;
+			break;
+		case material_type::dielectric:
+			out << "dielectric " << m.get<dielectric>().ir;
+			break;
+		case material_type::diffuse_light:
+			out << "light " << m.get<diffuse_light>().emit;
+			break;
+		}
+		out << "\n";
+	}
+
+	for (size_t k = 0; k < spheres.size(); ++k) {
+		out << "sphere " << spheres.cx[k] << " " << spheres.cy[k] << " " << spheres.cz[k]
+			<< " " << spheres.radius[k] << " m" << spheres.mat_id[k] << "\n";
+	}
+}
+
+inline bool save_scene_file(const std::string& path, const scene& s, const sphere_set& spheres) {
+	std::ofstream file(path);
+	write_scene_text(file, s, spheres);
+	if (!file) {
+		std::cerr << "Couldn't write " << path << "\n";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,218 @@
+/******************************************************************************
+Trevor's thoughts:
+Rendering an animation one process per frame pays for everything every time:
+reading (or generating) the scene, building the BVH, starting the threads. For a
+100M sphere scene that's most of the time per frame. --frames N renders the whole
+sequence from one process instead, and only redoes what actually changed:
+	- The camera orbits around lookat (--orbit degrees over the whole sequence)
+	- The small spheres bounce: each one hops up and back down once a second,
+	  starting at its own time, so it doesn't look like a drill team
+	- Instances (instance.h) spin about their own vertical axis. That's just a
+	  new transform each, and a refit of the top level tree - their groups
+	  don't change at all
+	- The BVH gets refit (bvh.h) instead of rebuilt - same tree, new boxes. The
+	  hops are small next to the gaps between spheres, so the tree barely suffers,
+	  but once its SAH cost gets 50% worse than it was after the last build, it
+	  gets rebuilt anyway.
+	- The render threads (render_pool), the framebuffer and the scene's memory all
+	  stay put from one frame to the next
+Every frame uses the same sampling seed, so frame 0 is exactly the still image,
+and the noise doesn't crawl around from frame to frame. Nothing gets carried over
+from the previous frame's pixels though - things move, and reusing old samples
+for them would smear.
+
+Each frame reports how long its steps took, and the end compares that to what
+running main() once per frame would have cost (setup + one frame, every frame).
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "denoise.h"
+#include "framebuffer.h"
+#include "image_io.h"
+#include "instance.h"
+#include "parallel.h"
+#include "random.h"
+#include "render.h"
+#include "scene.h"
+#include "sphere_set.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const double sequence_fps = 24;
+const double bounce_max_radius = 0.3; // only spheres smaller than this bounce (the random scene's are 0.2)
+const double bounce_period = 1;       // seconds per hop
+const double bounce_height_scale = 3; // how high a hop goes, in radii
+const double bvh_rebuild_ratio = 1.5; // rebuild once a refit tree's SAH cost is this many times worse than a fresh one's
+const double spin_degrees_per_second = 45; // how fast instances turn
+
+// How far the sphere at (x, z) is off the ground at time t. Each one's hops start at its own
+// time (from its position, which never changes), and it sits still until then.
+inline double bounce_height(real x, real z, real radius, double t) {
+	if (!(radius > 0 && double(radius) < bounce_max_radius))
+		return 0;
+	double dx = double(x), dz = double(z);
+	uint64_t bx, bz;
+	std::memcpy(&bx, &dx, sizeof(bx));
+	std::memcpy(&bz, &dz, sizeof(bz));
+	double delay = bounce_period * double(hash_seed(bx ^ hash_seed(bz)) >> 11) * (1.0 / 9007199254740992.0); // 2^-53
+	if (t < delay)
+		return 0;
+	double u = (t - delay) / bounce_period;
+	u -= std::floor(u);
+	return 4 * bounce_height_scale * double(radius) * u * (1 - u); // a parabola: 0 at both ends of the hop
+}
+
+// Moves every bouncing sphere from where it was at from_t to where it is at to_t. Only works with
+// the height change, so it doesn't need to know where the spheres started (and rebuilds, which
+// shuffle the arrays, don't matter).
+inline void bounce_spheres(sphere_set& spheres, double from_t, double to_t, int threads) {
+	const real* x = spheres.cx.data();
+	const real* z = spheres.cz.data();
+	const real* r = spheres.radius.data();
+	real* y = spheres.cy.writable_data();
+	parallel_for(spheres.size(), threads, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; ++k) {
+			double dy = bounce_height(x[k], z[k], r[k], to_t) - bounce_height(x[k], z[k], r[k], from_t);
+			if (dy != 0)
+				y[k] = real(double(y[k]) + dy);
+		}
+	});
+}
+
+// Turns every instance by degrees, about the vertical (y) axis through its own origin (where
+// its group's 0,0,0 ended up). Only moves the instances - refit (or build) their tree after.
+inline void spin_instances(instance_bvh& instances, double degrees, int threads) {
+	parallel_for(instances.size(), threads, [&](size_t begin, size_t end) {
+		for (size_t k = begin; k < end; ++k) {
+			instance& placed = instances.instances[k];
+			const affine_transform& to_world = placed.placement();
+			vec3 origin(to_world.m[0][3], to_world.m[1][3], to_world.m[2][3]);
+			placed.place(to_world.then(affine_transform::translate(-origin))
+				.then(affine_transform::rotate(vec3(0, 1, 0), degrees))
+				.then(affine_transform::translate(origin)));
+		}
+	});
+}
+
+// The camera turned by degrees around lookat (about vup). The distance to lookat doesn't change,
+// so neither does the focus.
+inline camera_setup orbit_camera(camera_setup view, double degrees) {
+	double theta = degrees_to_radians(degrees);
+	real c = real(std::cos(theta)), s = real(std::sin(theta));
+	vec3 axis = unit_vector(view.vup);
+	vec3 v = view.lookfrom - view.lookat;
+	// Rodrigues' rotation formula
+	v = v * c + cross(axis, v) * s + axis * (dot(axis, v) * (1 - c));
+	view.lookfrom = view.lookat + v;
+	return view;
+}
+
+// out.png -> out_0000.png (frame number before the extension)
+inline std::string frame_path(const std::string& path, int frame) {
+	char number[16];
+	std::snprintf(number, sizeof(number), "_%04d", frame);
+	return insert_before_extension(path, number);
+}
+
+// Renders settings.sequence_frames frames into frame_path(settings.output_path, f). cam is whatever
+// render_image renders with, and gets moved along view's orbit. spheres and instances get moved
+// (and their trees fixed up) between frames. setup_seconds: how long it took to get the scene ready
+// (only for comparing against separate runs).
+// render_image: void(const render_settings& settings, framebuffer& image)
+template <typename RenderImage>
+bool render_sequence(
+	const render_settings& settings, const camera_setup& view, camera& cam, sphere_set& spheres,
+	instance_bvh& instances, double setup_seconds, RenderImage render_image
+) {
+	using clock = std::chrono::steady_clock;
+	auto ms_since = [](clock::time_point start) {
+		return 1000 * std::chrono::duration<double>(clock::now() - start).count();
+	};
+
+	image_format format;
+	choose_image_format(settings.output_path, settings.output_format, format); // already checked by parse_options
+	render_settings frame_settings = settings;
+	frame_settings.progress = false; // one line per frame instead
+	framebuffer image(settings.image_width, settings.image_height);
+	if (settings.denoise || !settings.aov_path.empty())
+		image.enable_aovs();
+	const int frames = settings.sequence_frames;
+	double build_cost = spheres.sah_cost();
+	double instance_build_cost = instances.sah_cost();
+	int rebuilds = 0;
+	std::vector<double> frame_ms;
+	auto sequence_start = clock::now();
+
+	for (int f = 0; f < frames; ++f) {
+		auto frame_start = clock::now();
+		double t = f / sequence_fps;
+
+		// Move the spheres, and fix up the tree (frame 0 is the scene as it was built)
+		auto step = clock::now();
+		double move_ms = 0, tree_ms = 0;
+		bool rebuilt = false;
+		if (f > 0) {
+			bounce_spheres(spheres, (f - 1) / sequence_fps, t, settings.threads);
+			spin_instances(instances, spin_degrees_per_second / sequence_fps, settings.threads);
+			move_ms = ms_since(step);
+			step = clock::now();
+			spheres.refit(settings.threads);
+			if (spheres.sah_cost() > bvh_rebuild_ratio * build_cost) {
+				spheres.build(settings.threads);
+				build_cost = spheres.sah_cost();
+				rebuilt = true;
+				++rebuilds;
+			}
+			// (the top level only - the groups inside the instances never change)
+			instances.refit(settings.threads);
+			if (instances.sah_cost() > bvh_rebuild_ratio * instance_build_cost) {
+				instances.build(settings.threads);
+				instance_build_cost = instances.sah_cost();
+				rebuilt = true;
+				++rebuilds;
+			}
+			tree_ms = ms_since(step);
+		}
+
+		step = clock::now();
+		cam = orbit_camera(view, settings.orbit_degrees * f / frames).make_camera();
+		image.clear();
+		render_image(frame_settings, image);
+		double render_ms = ms_since(step);
+
+		step = clock::now();
+		if (!settings.aov_path.empty() && !write_aov_images(frame_path(settings.aov_path, f), image))
+			return false;
+		std::string path = frame_path(settings.output_path, f);
+		if (!write_file(path, encode_image(settings.denoise ? denoise(image, settings.threads) : image, format)))
+			return false;
+		double write_ms = ms_since(step);
+
+		frame_ms.push_back(ms_since(frame_start));
+		if (settings.progress) {
+			std::cerr << "Frame " << f << ": " << frame_ms.back() << " ms (move " << move_ms
+				<< ", " << (rebuilt ? "rebuild " : "refit ") << tree_ms << ", render " << render_ms
+				<< (settings.denoise ? ", denoise + write " : ", write ") << write_ms << ") -> " << path << "\n";
+		}
+	}
+
+	double total_ms = ms_since(sequence_start);
+	std::vector<double> sorted = frame_ms;
+	std::sort(sorted.begin(), sorted.end());
+	double median = sorted[sorted.size() / 2];
+	std::cerr << "Sequence: " << frames << " frames in " << total_ms << " ms, " << total_ms / frames
+		<< " ms per frame (median " << median << ", min " << sorted.front() << ", max " << sorted.back()
+		<< "), " << rebuilds << " BVH rebuilds\n"
+		<< "Setup (once): " << 1000 * setup_seconds << " ms. One run per frame would be about "
+		<< 1000 * setup_seconds + median << " ms per frame (setup + the median frame)\n";
+	return true;
+}
@@ -0,0 +1,128 @@
+/******************************************************************************
+Trevor's thoughts:
+A really thin wrapper over whichever SIMD registers this build has, so the
+sphere kernel (sphere_set.h) only gets written once, instead of once per
+instruction set and again for float vs double:
+	AVX-512:  8 doubles or 16 floats per register
+	AVX:      4 doubles or  8 floats
+	neither:  1 of whatever real is (a plain scalar - the same code still works)
+That's where most of the float win comes from: the same instructions do twice
+as many spheres.
+
+Only the handful of operations the kernel needs are here. No FMA on purpose:
+the scalar code doesn't use it either (we build without fp contraction), and the
+packet and wavefront tracers have to get bit-identical hits to these.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+
+#if defined(__AVX512F__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX512F__) && RT_USE_FLOAT
+const int simd_lanes = 16;
+#define RT_SIMD_512 1
+#define RT_SIMD(op) _mm512_##op##_ps
+#define RT_SIMD_CMP _mm512_cmp_ps_mask
+using simd_register = __m512;
+using simd_mask_register = __mmask16;
+#elif defined(__AVX512F__)
+const int simd_lanes = 8;
+#define RT_SIMD_512 1
+#define RT_SIMD(op) _mm512_##op##_pd
+#define RT_SIMD_CMP _mm512_cmp_pd_mask
+using simd_register = __m512d;
+using simd_mask_register = __mmask8;
+#elif defined(__AVX__) && RT_USE_FLOAT
+const int simd_lanes = 8;
+#define RT_SIMD_256 1
+#define RT_SIMD(op) _mm256_##op##_ps
+using simd_register = __m256;
+using simd_mask_register = __m256;
+#elif defined(__AVX__)
+const int simd_lanes = 4;
+#define RT_SIMD_256 1
+#define RT_SIMD(op) _mm256_##op##_pd
+using simd_register = __m256d;
+using simd_mask_register = __m256d;
+#else
+const int simd_lanes = 1;
+using simd_register = real;
+using simd_mask_register = bool;
+#endif
+
+// 0, 1, 2, ... (one per lane)
+alignas(64) const real simd_lane_offsets[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+struct simd_mask {
+	simd_mask_register m;
+};
+
+struct simd_real {
+	simd_register v;
+
+	simd_real() {}
+	simd_real(simd_register v) : v(v) {}
+#if defined(RT_SIMD_512) || defined(RT_SIMD_256)
+	explicit simd_real(real x) : v(RT_SIMD(set1)(x)) {}
+
+	static simd_real load(const real* p) { return RT_SIMD(loadu)(p); }
+	void store(real* p) const { RT_SIMD(storeu)(p, v); }
+#else
+	// (simd_register is just real here, so the constructor above already does the broadcast)
+
+	static simd_real load(const real* p) { return *p; }
+	void store(real* p) const { *p = v; }
+#endif
+};
+
+#if defined(RT_SIMD_512) || defined(RT_SIMD_256)
+inline simd_real operator+(simd_real a, simd_real b) { return RT_SIMD(add)(a.v, b.v); }
+inline simd_real operator-(simd_real a, simd_real b) { return RT_SIMD(sub)(a.v, b.v); }
+inline simd_real operator*(simd_real a, simd_real b) { return RT_SIMD(mul)(a.v, b.v); }
+inline simd_real operator/(simd_real a, simd_real b) { return RT_SIMD(div)(a.v, b.v); }
+inline simd_real simd_sqrt(simd_real a) { return RT_SIMD(sqrt)(a.v); }
+// Same as the hardware (and as a < b ? a : b): if either one is NaN, you get b
+inline simd_real simd_min(simd_real a, simd_real b) { return RT_SIMD(min)(a.v, b.v); }
+inline simd_real simd_max(simd_real a, simd_real b) { return RT_SIMD(max)(a.v, b.v); }
+#else
+inline simd_real operator+(simd_real a, simd_real b) { return a.v + b.v; }
+inline simd_real operator-(simd_real a, simd_real b) { return a.v - b.v; }
+inline simd_real operator*(simd_real a, simd_real b) { return a.v * b.v; }
+inline simd_real operator/(simd_real a, simd_real b) { return a.v / b.v; }
+inline simd_real simd_sqrt(simd_real a) { return std::sqrt(a.v); }
+inline simd_real simd_min(simd_real a, simd_real b) { return a.v < b.v ? a.v : b.v; }
+inline simd_real simd_max(simd_real a, simd_real b) { return a.v > b.v ? a.v : b.v; }
+#endif
+
+// Comparisons (false if either side is NaN), and picking lanes by mask
+#if defined(RT_SIMD_512)
+inline simd_mask operator<(simd_real a, simd_real b) { return { RT_SIMD_CMP(a.v, b.v, _CMP_LT_OQ) }; }
+inline simd_mask operator<=(simd_real a, simd_real b) { return { RT_SIMD_CMP(a.v, b.v, _CMP_LE_OQ) }; }
+inline simd_mask operator>=(simd_real a, simd_real b) { return { RT_SIMD_CMP(a.v, b.v, _CMP_GE_OQ) }; }
+inline simd_mask operator&(simd_mask a, simd_mask b) { return { simd_mask_register(a.m & b.m) }; }
+inline simd_mask operator|(simd_mask a, simd_mask b) { return { simd_mask_register(a.m | b.m) }; }
+// mask ? a : b, lane by lane
+inline simd_real select(simd_mask mask, simd_real a, simd_real b) { return RT_SIMD(mask_blend)(mask.m, b.v, a.v); }
+// Is any lane set?
+inline bool any(simd_mask mask) { return mask.m != 0; }
+#elif defined(RT_SIMD_256)
+inline simd_mask operator<(simd_real a, simd_real b) { return { RT_SIMD(cmp)(a.v, b.v, _CMP_LT_OQ) }; }
+inline simd_mask operator<=(simd_real a, simd_real b) { return { RT_SIMD(cmp)(a.v, b.v, _CMP_LE_OQ) }; }
+inline simd_mask operator>=(simd_real a, simd_real b) { return { RT_SIMD(cmp)(a.v, b.v, _CMP_GE_OQ) }; }
+inline simd_mask operator&(simd_mask a, simd_mask b) { return { RT_SIMD(and)(a.m, b.m) }; }
+inline simd_mask operator|(simd_mask a, simd_mask b) { return { RT_SIMD(or)(a.m, b.m) }; }
+inline simd_real select(simd_mask mask, simd_real a, simd_real b) { return RT_SIMD(blendv)(b.v, a.v, mask.m); }
+inline bool any(simd_mask mask) { return RT_SIMD(movemask)(mask.m) != 0; }
+#else
+inline simd_mask operator<(simd_real a, simd_real b) { return { a.v < b.v }; }
+inline simd_mask operator<=(simd_real a, simd_real b) { return { a.v <= b.v }; }
+inline simd_mask operator>=(simd_real a, simd_real b) { return { a.v >= b.v }; }
+inline simd_mask operator&(simd_mask a, simd_mask b) { return { a.m && b.m }; }
+inline simd_mask operator|(simd_mask a, simd_mask b) { return { a.m || b.m }; }
+inline simd_real select(simd_mask mask, simd_real a, simd_real b) { return mask.m ? a.v : b.v; }
+inline bool any(simd_mask mask) { return mask.m; }
+#endif
@@ -1,24 +1,74 @@
 #pragma once
 
 #include "hittable.h"
+#include "stats.h"
 #include "vec3.h"
 
+// Where a ray (origin = center + oc, direction d, a = d.d) crosses the sphere, nearest first.
+// False if it misses (or the sphere is entirely behind it). The robust form of the quadratic (see sphere::intersect) - the SIMD
+// versions in sphere_set.h and packet.h do exactly the same operations, in the same order.
+inline bool sphere_roots(const vec3& oc, const vec3& d, real a, real radius, real& t_near, real& t_far) {
+	real inv_a = 1 / a; // (one divide, instead of three)
+	real half_b = dot(oc, d);
+	real c = dot(oc, oc) - radius * radius;
+	if (c > 0 && half_b > 0) // starts outside, heading away: both roots are behind it (cheap, and most tests are misses)
+		return false;
+	vec3 l = oc - (half_b * inv_a) * d; // center -> closest point on the line
+	real discriminant = a * (radius * radius - dot(l, l));
+	if (discriminant < 0)
+		return false;
+
+	real sqrtd = std::sqrt(discriminant);
+	real q = half_b >= 0 ? -(half_b + sqrtd) : sqrtd - half_b; // never a cancellation
+	real t0 = q * inv_a, t1 = c / q;
+	t_near = t0 < t1 ? t0 : t1;
+	t_far = t0 > t1 ? t0 : t1;
+	return true;
+}
+
+// Fills in rec for a hit at t. The hit point gets pushed back onto the surface (r.at(t) can be
+// off by however far t is off), so the error that's left only depends on the sphere's own
+// numbers - and spawn_offset covers that (hittable.h).
+inline void set_sphere_hit(
+	const ray& r, real t, const point3& center, real radius, material_id mat_id, uint32_t object_id, hit_record& rec
+) {
+	rec.t = t; // intercept time
+	vec3 n = unit_vector(r.at(t) - center);
+	rec.p = center + std::abs(radius) * n; // intercept point
+	vec3 outward_normal = radius < 0 ? -n : n; // (a negative radius turns the sphere inside out)
+	rec.set_face_normal(r, outward_normal); // normal (unit vector pointing straight out of surface)
+	rec.spawn_offset = surface_error(center, radius);
+	rec.mat_id = mat_id;
+	rec.object_id = object_id;
+}
+
 class sphere : public hittable {
 public:
 	sphere() {}
-	sphere(point3 cen, double r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m){};
+	sphere(point3 cen, real r, material_id m) : center(cen), radius(r), mat_id(m){};
+
+	virtual bool intersect(const ray& r, real t_min, ray_hit& hit) const override;
+
+	virtual void fill_hit_record(const ray& r, const ray_hit& hit, hit_record& rec) const override {
+		set_sphere_hit(r, hit.t, center, radius, mat_id, 0, rec); // (a lone sphere doesn't know where it sits in the scene)
+	}
 
-	virtual bool hit(
-		const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		// abs, since a negative radius is used to make hollow glass spheres
+		vec3 extent(std::abs(radius), std::abs(radius), std::abs(radius));
+		output_box = aabb(center - extent, center + extent);
+		return true;
+	}
 
 public:
 	point3 center;
-	double radius;
-	shared_ptr<material> mat_ptr;
+	real radius;
+	material_id mat_id;
 };
 
-
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool sphere::intersect(const ray& r, real t_min, ray_hit& hit) const {
 	// Purpose: Check if/where an intersection occurs
 	// I'm going to include a quick-ish derivation as well...
 	// Equation for a sphere of radius r, centered at C: 
@@ -42,35 +92,45 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
 	// representing the ray entering and exiting the sphere
 
 
-	// Solve for discriminant (are there intercepts?)
-	vec3 oc = r.origin() - center;
-	auto a = r.direction().length_squared();
-	auto half_b = dot(oc, r.direction());
-	auto c = oc.length_squared() - radius * radius;
-	auto discriminant = half_b * half_b - a * c; // the part of the quadratic formula under the sqrt()
-		
-	if (discriminant < 0) { // meaning sphere is hit
+	// That's the textbook version, and it falls apart in a couple of places (Ray Tracing Gems, ch. 7):
+	//	- half_b^2 - a*c subtracts two huge, nearly equal numbers when the sphere is far away or
+	//	huge (the radius 1000 ground), so the discriminant is mostly rounding error. Instead, take
+	//	l = the vector from the center to the closest point on the ray's line; then
+	//	discriminant = a*(r^2 - l.l), which only involves numbers the size of the sphere.
+	//	- -half_b + sqrtd cancels when the two are close (a ray grazing, or starting right on the
+	//	surface - ie: every bounce). So only take the root where they add, and get the other one
+	//	from t0*t1 = c/a.
+	// Floats have 29 fewer bits to lose, so this is what makes the float build (RT_USE_FLOAT) work.
+
+	RT_COUNT_TESTS(1);
+
+	real t_near, t_far;
+	if (!sphere_roots(r.origin() - center, r.direction(), r.direction().length_squared(), radius, t_near, t_far))
 		return false;
-	}
 
 	// Find the roots/intercepts (one is where the ray hits first (enters) the sphere, and the other is the exit; we want the entry ray)
 	// The solution that hits first, is the smallest value (as t increases, the ray advances, so lower t hits first).
-	auto sqrtd = sqrt(discriminant);
-	auto root = (-half_b - sqrtd) / a; 
-	if (t_max < root || root < t_min) {	// Is the ENTERING ray intersection within the specified distance
-		root = (-half_b + sqrtd) / a; // Exiting ray - not sure how we see this...maybe if we are inside a sphere?
-		if (t_max < root || root < t_min) {	// Is the EXITING ray intersection within the specified distance
+	auto root = t_near;
+	if (hit.t < root || root < t_min) {	// Is the ENTERING ray intersection within the specified distance
+		root = t_far; // Exiting ray - not sure how we see this...maybe if we are inside a sphere?
+		if (hit.t < root || root < t_min) {	// Is the EXITING ray intersection within the specified distance
 			return false;
 		}
 	}
 
-	// rec is a hit_record; passed in by reference, so we don't need an explicit return
-	rec.t = root; // intercept time
-	rec.p = r.at(rec.t); // intercept point
-	vec3 outward_normal = (rec.p - center) / radius;
-	rec.set_face_normal(r, outward_normal); // normal (unit vector pointing straight out of surface)
+	// Just remember where and what - the point/normal/material only get worked out
+	// (in fill_hit_record) if this is still the closest hit once the traversal is done
+	hit.t = root;
+	hit.primitive = 0;
+	hit.object = this;
+	return true;
+}
 
-	rec.mat_ptr = mat_ptr;
+bool sphere::occluded(const ray& r, real t_min, real t_max) const {
+	RT_COUNT_TESTS(1);
 
-	return true;
+	real t_near, t_far;
+	if (!sphere_roots(r.origin() - center, r.direction(), r.direction().length_squared(), radius, t_near, t_far))
+		return false;
+	return (t_near >= t_min && t_near <= t_max) || (t_far >= t_min && t_far <= t_max);
 }
\ No newline at end of file
@@ -0,0 +1,324 @@
+/******************************************************************************
+Trevor's thoughts:
+Every sphere used to be its own heap allocation, reached through a virtual call,
+and tested one at a time. sphere_set packs all of them into one
+structure-of-arrays (all the x's together, all the y's together, ...), which is
+exactly the layout SIMD wants: one instruction can load 4 (AVX) or 8 (AVX-512)
+centers at once (twice that in the float build), and run the quadratic from
+sphere::intersect on all of them together. The kernel is written once, against the
+wrapper in simd.h.
+
+The spheres are sorted into a BVH (bvh.h) whose leaves hold up to 8 spheres each
+(or one register's worth, if that's more), so a leaf is one or two SIMD batches.
+Each lane keeps its own nearest t, and we only do a (short) min-reduction across
+the lanes at the end of the leaf.
+The full hit_record (point, normal, material) is only built for the final winner.
+Shadow rays (occluded) use the same kernel, but stop at the first leaf with any
+lane in range, without the reduction.
+
+The arrays are all there is to a sphere: 4 reals and a 32 bit material id, so 20
+bytes each in the float build (36 in double), plus its share of the BVH. Big
+procedural scenes (add_sphere_field in scene.h) get generated straight into them,
+and the tree gets built on several threads.
+
+Build with /arch:AVX2 (MSVC) or -mavx2 / -march=native (gcc/clang) to get the
+vector kernel; otherwise it falls back to a plain scalar loop over the same arrays.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "simd.h"
+#include "sphere.h"
+
+#include <iostream>
+#include <vector>
+
+const int sphere_lanes = simd_lanes;
+// A leaf tests sphere_lanes spheres at once, so each one costs the tree that much less
+const double sphere_primitive_cost = 1.0 / sphere_lanes;
+
+class sphere_set : public hittable {
+public:
+	sphere_set() {}
+
+	// Pulls every sphere out of a list (anything else gets left behind, with a warning)
+	sphere_set(const hittable_list& list) {
+		add(list);
+		build();
+	}
+
+	void add(const point3& center, real r, material_id m) {
+		cx.push_back(center.x());
+		cy.push_back(center.y());
+		cz.push_back(center.z());
+		radius.push_back(r);
+		mat_id.push_back(m);
+	}
+
+	void add(const hittable_list& list) {
+		for (const auto& object : list.objects) {
+			auto s = dynamic_cast<const sphere*>(object.get());
+			if (s)
+				add(s->center, s->radius, s->mat_id);
+			else
+				std::cerr << "sphere_set can only hold spheres - skipping an object.\n";
+		}
+	}
+
+	// Makes room for count more spheres (all zeros), and returns the index of the first one. For
+	// generating lots of spheres at once: fill them in through the arrays' writable_data().
+	size_t add_uninitialized(size_t count) {
+		size_t first = mat_id.size();
+		cx.resize(first + count);
+		cy.resize(first + count);
+		cz.resize(first + count);
+		radius.resize(first + count);
+		mat_id.resize(first + count);
+		return first;
+	}
+
+	size_t size() const { return num_spheres; }
+
+	// Everything a built sphere_set keeps in memory: the sphere arrays (with their padding) and the tree
+	size_t memory_bytes() const {
+		return (cx.size() + cy.size() + cz.size() + radius.size()) * sizeof(real)
+			+ mat_id.size() * sizeof(material_id) + nodes.size() * sizeof(bvh_node);
+	}
+
+	// Sorts the spheres into leaf order, and builds the tree over them. Call after the last add().
+	// threads: for the tree and the sorting (0 -> one per hardware thread). The result is the same
+	// for any number of them.
+	void build(int threads = 0, int max_leaf_size = sphere_lanes > 8 ? sphere_lanes : 8) {
+		// strip any padding left over from a previous build
+		cx.resize(mat_id.size());
+		cy.resize(mat_id.size());
+		cz.resize(mat_id.size());
+		radius.resize(mat_id.size());
+		num_spheres = mat_id.size();
+
+		// The builder reads the boxes straight off the arrays, rather than needing a copy of each one
+		std::vector<bvh_node> tree;
+		std::vector<uint32_t> order;
+		sphere_bounds bounds = { cx.data(), cy.data(), cz.data(), radius.data(), num_spheres };
+		basic_bvh_builder<sphere_bounds>(bounds, max_leaf_size, sphere_primitive_cost).build(tree, order, setup_thread_count(threads));
+		nodes = std::move(tree);
+
+		// One array at a time, so there's only ever one extra array's worth in memory
+		reorder(cx, order, threads);
+		reorder(cy, order, threads);
+		reorder(cz, order, threads);
+		reorder(radius, order, threads);
+		reorder(mat_id, order, threads);
+
+		// Pad the arrays, so a SIMD load that starts in the last leaf never runs off the end.
+		// (The lanes past the end of a leaf get masked out, so these values are never used.)
+		cx.resize(num_spheres + sphere_lanes, 0);
+		cy.resize(num_spheres + sphere_lanes, 0);
+		cz.resize(num_spheres + sphere_lanes, 0);
+		radius.resize(num_spheres + sphere_lanes, 0);
+	}
+
+	// After moving spheres around (through the arrays' writable_data()), fixes up the tree's boxes
+	// without rebuilding it. The spheres stay in the same order, and in the same leaves.
+	void refit(int threads = 0) {
+		sphere_bounds bounds = { cx.data(), cy.data(), cz.data(), radius.data(), num_spheres };
+		refit_bvh(nodes.writable_data(), nodes.size(), bounds, setup_thread_count(threads));
+	}
+
+	// How good the tree is (bvh_sah_cost) - goes up as refits stretch it out of shape
+	double sah_cost() const {
+		return bvh_sah_cost(nodes.data(), nodes.size(), sphere_primitive_cost);
+	}
+
+	virtual bool intersect(const ray& r, real t_min, ray_hit& hit) const override;
+
+	virtual void fill_hit_record(const ray& r, const ray_hit& hit, hit_record& rec) const override {
+		fill_hit_record(r, hit.primitive, hit.t, rec);
+	}
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		if (nodes.empty())
+			return false;
+		output_box = nodes[0].box;
+		return true;
+	}
+
+	// Nearest hit among spheres [first, first+count). Only updates closest/hit_index if it finds
+	// something closer than closest.
+	bool hit_range(
+		const ray& r, uint32_t first, uint32_t count, real t_min, real& closest, uint32_t& hit_index
+	) const;
+
+	// Is any sphere in [first, first+count) hit in [t_min, t_max]?
+	bool any_hit_range(const ray& r, uint32_t first, uint32_t count, real t_min, real t_max) const;
+
+	// Fills in the full hit_record for sphere k, hit at t
+	void fill_hit_record(const ray& r, uint32_t k, real t, hit_record& rec) const {
+		set_sphere_hit(r, t, point3(cx[k], cy[k], cz[k]), radius[k], mat_id[k], k, rec);
+	}
+
+private:
+	// The ray, broadcast across the lanes
+	struct simd_ray {
+		simd_real ox, oy, oz, dx, dy, dz, a, inv_a;
+
+		simd_ray(const ray& r)
+			: ox(r.origin().x()), oy(r.origin().y()), oz(r.origin().z()),
+			dx(r.direction().x()), dy(r.direction().y()), dz(r.direction().z()),
+			a(r.direction().length_squared()), inv_a(1 / r.direction().length_squared()) {}
+	};
+
+	// sphere_roots for spheres [k, k+sphere_lanes). Lanes that miss come back false.
+	simd_mask lane_roots(const simd_ray& sr, uint32_t k, simd_real& near_root, simd_real& far_root) const;
+
+	// What the BVH builder sees of the spheres (see box_list in bvh.h)
+	struct sphere_bounds {
+		const real *x, *y, *z, *r;
+		size_t count;
+
+		size_t size() const { return count; }
+		aabb box(uint32_t k) const {
+			vec3 extent(std::abs(r[k]), std::abs(r[k]), std::abs(r[k]));
+			point3 center(x[k], y[k], z[k]);
+			return aabb(center - extent, center + extent);
+		}
+	};
+
+	template <typename T>
+	static void reorder(mapped_array<T>& values, const std::vector<uint32_t>& order, int threads) {
+		std::vector<T> sorted(order.size());
+		parallel_for(order.size(), threads, [&](size_t begin, size_t end) {
+			for (size_t k = begin; k < end; ++k)
+				sorted[k] = values[order[k]];
+		});
+		values = std::move(sorted);
+	}
+
+public:
+	// Structure of arrays - sphere k is (cx[k], cy[k], cz[k], radius[k], mat_id[k]). Built by
+	// add()/build(), or pointing straight into a scene cache (scene_cache.h).
+	mapped_array<real> cx, cy, cz, radius;
+	mapped_array<material_id> mat_id; // into the scene's material_table
+	mapped_array<bvh_node> nodes;
+	size_t num_spheres = 0;
+};
+
+bool sphere_set::intersect(const ray& r, real t_min, ray_hit& hit) const {
+	if (nodes.empty())
+		return false;
+
+	uint32_t hit_index = 0;
+	if (!traverse_bvh(nodes.data(), r, t_min, hit.t,
+		[&](uint32_t first, uint32_t count, real& closest_so_far) {
+			return hit_range(r, first, count, t_min, closest_so_far, hit_index);
+		}))
+		return false;
+
+	hit.primitive = hit_index;
+	hit.object = this;
+	return true;
+}
+
+bool sphere_set::occluded(const ray& r, real t_min, real t_max) const {
+	if (nodes.empty())
+		return false;
+
+	return any_hit_bvh(nodes.data(), r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+		return any_hit_range(r, first, count, t_min, t_max);
+	});
+}
+
+// Same math as sphere_roots (sphere.h), just sphere_lanes spheres at a time
+inline simd_mask sphere_set::lane_roots(const simd_ray& sr, uint32_t k, simd_real& near_root, simd_real& far_root) const {
+	const simd_real zero(0);
+	simd_real ocx = sr.ox - simd_real::load(&cx[k]);
+	simd_real ocy = sr.oy - simd_real::load(&cy[k]);
+	simd_real ocz = sr.oz - simd_real::load(&cz[k]);
+	simd_real rad = simd_real::load(&radius[k]);
+	simd_real r2 = rad * rad;
+
+	simd_real half_b = ocx * sr.dx + ocy * sr.dy + ocz * sr.dz;
+	simd_real c = (ocx * ocx + ocy * ocy + ocz * ocz) - r2;
+	simd_real s = half_b * sr.inv_a;
+	simd_real lx = ocx - s * sr.dx, ly = ocy - s * sr.dy, lz = ocz - s * sr.dz;
+	simd_real discriminant = sr.a * (r2 - (lx * lx + ly * ly + lz * lz));
+
+	simd_real sqrtd = simd_sqrt(simd_max(discriminant, zero));
+	simd_real q = select(half_b >= zero, zero - (half_b + sqrtd), sqrtd - half_b);
+	simd_real t0 = q * sr.inv_a, t1 = c / q;
+	near_root = simd_min(t0, t1);
+	far_root = simd_max(t0, t1);
+	return discriminant >= zero;
+}
+
+// Nearest hit in the leaf: each lane keeps its own nearest t, then a min-reduction at the end
+bool sphere_set::hit_range(
+	const ray& r, uint32_t first, uint32_t count, real t_min, real& closest, uint32_t& hit_index
+) const {
+	RT_COUNT_TESTS(count);
+
+	const simd_ray sr(r);
+	const simd_real vt_min(t_min);
+	const simd_real vcount = simd_real(real(count));
+	simd_real best_t(closest);
+	simd_real best_k(-1);
+
+	// Lanes are numbered from the start of the leaf (not the whole array), so a float can hold them exactly
+	for (uint32_t offset = 0; offset < count; offset += sphere_lanes) {
+		simd_real lane_k = simd_real(real(offset)) + simd_real::load(simd_lane_offsets);
+		simd_real near_root, far_root;
+		simd_mask valid = (lane_k < vcount) & lane_roots(sr, first + offset, near_root, far_root);
+
+		// entering root if it's in range, otherwise the exiting root
+		simd_mask near_ok = (near_root >= vt_min) & (near_root <= best_t);
+		simd_mask far_ok = (far_root >= vt_min) & (far_root <= best_t);
+		simd_real root = select(near_ok, near_root, far_root);
+		simd_mask take = valid & (near_ok | far_ok);
+
+		best_t = select(take, root, best_t);
+		best_k = select(take, lane_k, best_k);
+	}
+
+	real lane_t[sphere_lanes], lane_index[sphere_lanes];
+	best_t.store(lane_t);
+	best_k.store(lane_index);
+
+	// min-reduction across the lanes
+	bool hit_anything = false;
+	for (int lane = 0; lane < sphere_lanes; ++lane) {
+		if (lane_index[lane] >= 0 && lane_t[lane] <= closest) {
+			closest = lane_t[lane];
+			hit_index = first + uint32_t(lane_index[lane]);
+			hit_anything = true;
+		}
+	}
+	return hit_anything;
+}
+
+bool sphere_set::any_hit_range(const ray& r, uint32_t first, uint32_t count, real t_min, real t_max) const {
+	RT_COUNT_TESTS(count);
+
+	const simd_ray sr(r);
+	const simd_real vt_min(t_min), vt_max(t_max);
+	const simd_real vcount = simd_real(real(count));
+
+	for (uint32_t offset = 0; offset < count; offset += sphere_lanes) {
+		simd_real lane_k = simd_real(real(offset)) + simd_real::load(simd_lane_offsets);
+		simd_real near_root, far_root;
+		simd_mask valid = (lane_k < vcount) & lane_roots(sr, first + offset, near_root, far_root);
+
+		simd_mask near_ok = (near_root >= vt_min) & (near_root <= vt_max);
+		simd_mask far_ok = (far_root >= vt_min) & (far_root <= vt_max);
+		if (any(valid & (near_ok | far_ok)))
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,227 @@
+/******************************************************************************
+Trevor's thoughts:
+Where does the time actually go? Build with RT_ENABLE_STATS=1 (cmake
+-DRT_ENABLE_STATS=ON) and the hot paths count what they do:
+	- rays traced, per bounce (0 = camera rays)
+	- sphere and triangle intersection tests and BVH nodes visited, in total and per ray
+	- hittable_list::hit calls, and scatter calls per material
+	- how long every tile took (-> a heatmap of where the expensive pixels are)
+How paths ended (escaped, absorbed, roulette, max_depth) was already being
+counted by path_stats (integrator.h), so the report just includes that.
+
+Every thread counts into its own render_stats (plain adds, no atomics or locks
+on the hot path), and they're all added up once the render is done. With
+RT_ENABLE_STATS off (the default), the RT_COUNT... macros expand to nothing, so
+there's no cost at all - not even a branch.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef RT_ENABLE_STATS
+#define RT_ENABLE_STATS 0
+#endif
+
+///////////////// Per-thread stats, merged at the end /////////////////
+// Stats is anything with merge(const Stats&). Each thread counts into its own copy
+// (no locking on the hot path). They all sign up here, and a thread that exits adds
+// its counts to retired on the way out.
+template <typename Stats>
+struct stats_registry {
+	std::mutex m;
+	std::vector<const Stats*> live;
+	Stats retired;
+
+	static stats_registry& global() {
+		static stats_registry registry;
+		return registry;
+	}
+};
+
+template <typename Stats>
+struct thread_stats_slot {
+	Stats stats;
+
+	thread_stats_slot() {
+		auto& registry = stats_registry<Stats>::global();
+		std::lock_guard<std::mutex> lock(registry.m);
+		registry.live.push_back(&stats);
+	}
+
+	~thread_stats_slot() {
+		auto& registry = stats_registry<Stats>::global();
+		std::lock_guard<std::mutex> lock(registry.m);
+		registry.retired.merge(stats);
+		registry.live.erase(std::find(registry.live.begin(), registry.live.end(), &stats));
+	}
+};
+
+template <typename Stats>
+Stats& thread_stats() {
+	thread_local thread_stats_slot<Stats> slot;
+	return slot.stats;
+}
+
+// Everybody's counts added up (call it once the render threads are done)
+template <typename Stats>
+Stats total_stats() {
+	auto& registry = stats_registry<Stats>::global();
+	std::lock_guard<std::mutex> lock(registry.m);
+	Stats total = registry.retired;
+	for (auto stats : registry.live)
+		total.merge(*stats);
+	return total;
+}
+
+///////////////// What gets counted /////////////////
+enum class stat_counter {
+	list_hits,           // hittable_list::intersect calls
+	sphere_tests,        // ray/sphere tests (sphere::intersect/occluded, sphere_set leaves, packet leaves count every lane)
+	triangle_tests,      // ray/triangle tests (triangle_mesh leaves count every triangle)
+	bvh_nodes,           // BVH nodes visited
+	shadow_rays,         // occluded() queries toward a light sample (integrator.h)
+	scatter_lambertian,  // scatter calls, per material
+	scatter_metal,
+	scatter_dielectric
+};
+const int num_stat_counters = 8;
+
+struct tile_time {
+	int x0, y0, x1, y1; // same as tile (render.h)
+	double seconds;
+};
+
+class render_stats {
+public:
+	void end_ray(int bounces) {
+		if (bounces >= int(rays_per_depth.size()))
+			rays_per_depth.resize(bounces + 1, 0);
+		++rays_per_depth[bounces];
+		// bucket 0: no tests, bucket b: 2^(b-1) .. 2^b - 1 tests
+		int bucket = 0;
+		while (ray_tests >> bucket)
+			++bucket;
+		++tests_per_ray[std::min(bucket, num_test_buckets - 1)];
+		ray_tests = 0;
+	}
+
+	// A packet traces several rays in one traversal, so its tests can't go into any one ray's bucket
+	void end_packet(int rays) {
+		if (rays_per_depth.empty())
+			rays_per_depth.resize(1, 0);
+		rays_per_depth[0] += rays;
+		ray_tests = 0;
+	}
+
+	void merge(const render_stats& other) {
+		for (int c = 0; c < num_stat_counters; ++c)
+			counters[c] += other.counters[c];
+		if (other.rays_per_depth.size() > rays_per_depth.size())
+			rays_per_depth.resize(other.rays_per_depth.size(), 0);
+		for (size_t b = 0; b < other.rays_per_depth.size(); ++b)
+			rays_per_depth[b] += other.rays_per_depth[b];
+		for (int b = 0; b < num_test_buckets; ++b)
+			tests_per_ray[b] += other.tests_per_ray[b];
+		tile_times.insert(tile_times.end(), other.tile_times.begin(), other.tile_times.end());
+	}
+
+	uint64_t rays() const {
+		uint64_t total = 0;
+		for (auto n : rays_per_depth)
+			total += n;
+		return total;
+	}
+
+public:
+	static const int num_test_buckets = 16;
+	std::array<uint64_t, num_stat_counters> counters = {};
+	std::vector<uint64_t> rays_per_depth; // [bounces]
+	std::array<uint64_t, num_test_buckets> tests_per_ray = {}; // log2 buckets, see end_ray
+	uint64_t ray_tests = 0; // sphere and triangle tests for the ray that's being traced right now
+	std::vector<tile_time> tile_times;
+};
+
+inline render_stats& thread_render_stats() { return thread_stats<render_stats>(); }
+
+#if RT_ENABLE_STATS
+#define RT_COUNT(name) (++thread_render_stats().counters[int(stat_counter::name)])
+#define RT_COUNT_TESTS(n) do { render_stats& rt_stats_ = thread_render_stats(); \
+	rt_stats_.counters[int(stat_counter::sphere_tests)] += (n); rt_stats_.ray_tests += (n); } while (0)
+#define RT_COUNT_TRIANGLE_TESTS(n) do { render_stats& rt_stats_ = thread_render_stats(); \
+	rt_stats_.counters[int(stat_counter::triangle_tests)] += (n); rt_stats_.ray_tests += (n); } while (0)
+#define RT_END_RAY(bounces) thread_render_stats().end_ray(bounces)
+#define RT_END_PACKET(rays) thread_render_stats().end_packet(rays)
+#define RT_STATS_ONLY(code) code
+#else
+#define RT_COUNT(name) ((void)0)
+#define RT_COUNT_TESTS(n) ((void)0)
+#define RT_COUNT_TRIANGLE_TESTS(n) ((void)0)
+#define RT_END_RAY(bounces) ((void)0)
+#define RT_END_PACKET(rays) ((void)0)
+#define RT_STATS_ONLY(code)
+#endif
+
+///////////////// Reports /////////////////
+// path_ends: from path_stats::totals() (integrator.h) - how many paths ended each way
+inline std::string stats_json(const render_stats& stats, const std::array<uint64_t, 4>& path_ends) {
+	const char* counter_names[num_stat_counters] = {
+		"hittable_list_calls", "sphere_tests", "triangle_tests", "bvh_nodes", "shadow_rays", "lambertian", "metal", "dielectric"
+	};
+	const uint64_t rays = stats.rays();
+	std::ostringstream out;
+	out << "{\n  \"rays\": " << rays << ",\n  \"rays_per_depth\": [";
+	for (size_t b = 0; b < stats.rays_per_depth.size(); ++b)
+		out << (b ? ", " : "") << stats.rays_per_depth[b];
+	out << "],\n";
+	const int first_scatter = int(stat_counter::scatter_lambertian);
+	for (int c = 0; c < first_scatter; ++c)
+		out << "  \"" << counter_names[c] << "\": " << stats.counters[c] << ",\n";
+	out << "  \"sphere_tests_per_ray\": " << (rays ? double(stats.counters[int(stat_counter::sphere_tests)]) / rays : 0.0) << ",\n";
+	out << "  \"triangle_tests_per_ray\": " << (rays ? double(stats.counters[int(stat_counter::triangle_tests)]) / rays : 0.0) << ",\n";
+	out << "  \"bvh_nodes_per_ray\": " << (rays ? double(stats.counters[int(stat_counter::bvh_nodes)]) / rays : 0.0) << ",\n";
+	out << "  \"tests_per_ray_log2_histogram\": [";
+	for (int b = 0; b < render_stats::num_test_buckets; ++b)
+		out << (b ? ", " : "") << stats.tests_per_ray[b];
+	out << "],\n  \"scatter\": {";
+	for (int c = first_scatter; c < num_stat_counters; ++c)
+		out << (c > first_scatter ? ", " : "") << '"' << counter_names[c] << "\": " << stats.counters[c];
+	out << "},\n  \"path_ends\": {\"escaped\": " << path_ends[0] << ", \"absorbed\": " << path_ends[1]
+		<< ", \"roulette\": " << path_ends[2] << ", \"max_depth\": " << path_ends[3] << "},\n";
+
+	std::vector<double> times;
+	for (const auto& t : stats.tile_times)
+		times.push_back(t.seconds);
+	std::sort(times.begin(), times.end());
+	double total = 0;
+	for (double t : times)
+		total += t;
+	out << "  \"tiles\": {\"count\": " << times.size();
+	if (!times.empty()) {
+		out << ", \"total_ms\": " << 1e3 * total << ", \"min_ms\": " << 1e3 * times.front()
+			<< ", \"p50_ms\": " << 1e3 * times[times.size() / 2] << ", \"max_ms\": " << 1e3 * times.back();
+	}
+	out << "}\n}\n";
+	return out.str();
+}
+
+// Milliseconds each pixel's tile took, spread evenly over the tile's pixels (so partial tiles
+// at the edges compare fairly). Bottom row first, like the framebuffer. Tiles rendered more
+// than once (progressive passes) add up.
+inline std::vector<double> tile_cost_per_pixel(const render_stats& stats, int width, int height) {
+	std::vector<double> cost(size_t(width) * height, 0.0);
+	for (const auto& t : stats.tile_times) {
+		double per_pixel = 1e3 * t.seconds / (double(t.x1 - t.x0) * (t.y1 - t.y0));
+		for (int j = t.y0; j < std::min(t.y1, height); ++j)
+			for (int i = t.x0; i < std::min(t.x1, width); ++i)
+				cost[size_t(j) * width + i] += per_pixel;
+	}
+	return cost;
+}
@@ -0,0 +1,329 @@
+/******************************************************************************
+Trevor's thoughts:
+Triangles, finally. A mesh is the usual indexed layout: one array of vertex
+positions (and normals, if the model has them), and 3 indices per triangle into
+them. Neighboring triangles share their vertices, so a closed mesh is about half
+a vertex per triangle - nothing per triangle but its 3 indices and its share of
+the BVH. Each mesh builds its own BVH (bvh.h) over its triangles, with the
+triangles reordered into leaf order, same as sphere_set does for spheres.
+
+The ray/triangle test is the watertight one (Woop, Benthin & Wald, "Watertight
+Ray/Triangle Intersection", JCGT 2013). The common test (Moller-Trumbore) can
+let a ray slip through the crack between two triangles that share an edge,
+since each one rounds its edge test differently. This one shears the triangle
+into the ray's own coordinate system (ray along +z, through the origin), and
+then the edge tests are 2D cross products of the sheared vertices: a shared edge
+gets exactly the same numbers from both triangles, so every ray lands on one
+side or the other. (The paper redoes the edge test in double when it comes out
+exactly 0. We skip that: a ray exactly on an edge just counts for both sides,
+which never leaves a hole.)
+The per-ray part (which axis is "z", the shear) only gets worked out once per
+ray, and the per-triangle part is branch-free, so a leaf gets tested a SIMD
+register's worth of triangles at a time (simd.h), same as sphere_set - the
+vertices get gathered into the lanes first, since they're indexed.
+
+Which side is the front: counter-clockwise vertices (looking at it) face you,
+which is what OBJ files use. set_face_normal gets that winding normal as the
+"outward" one, so front_face works for glass meshes the same as for spheres.
+If the model has vertex normals, the shading normal is interpolated from those
+(flipped onto the same side as the face normal).
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "parallel.h"
+#include "simd.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <vector>
+
+// The ray's part of the watertight test, worked out once per ray
+struct watertight_ray {
+	int kx, ky, kz;     // kz: the axis the ray's mostly along. kx, ky: the other two (in an order that keeps the winding)
+	real sx, sy, sz;    // shear that lines the ray up with +z
+	point3 origin;
+
+	watertight_ray(const ray& r) : origin(r.origin()) {
+		vec3 d = r.direction();
+		real ax = std::abs(d.x()), ay = std::abs(d.y()), az = std::abs(d.z());
+		kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+		kx = kz == 2 ? 0 : kz + 1;
+		ky = kx == 2 ? 0 : kx + 1;
+		if (d[kz] < 0)
+			std::swap(kx, ky);
+		sx = d[kx] / d[kz];
+		sy = d[ky] / d[kz];
+		sz = 1 / d[kz];
+	}
+};
+
+// One triangle, through the watertight test. Returns false for a miss (or a triangle seen edge on).
+// On a hit, t is where along the ray, and b0/b1/b2 are the barycentric weights of v0/v1/v2.
+// (triangle_mesh's SIMD kernel does exactly the same operations, in the same order.)
+inline bool watertight_hit(
+	const watertight_ray& wr, const point3& v0, const point3& v1, const point3& v2,
+	real& t, real& b0, real& b1, real& b2
+) {
+	vec3 a = v0 - wr.origin, b = v1 - wr.origin, c = v2 - wr.origin;
+	// Shear and scale the vertices, so the ray runs along +z from (0,0,0)
+	real ax = a[wr.kx] - wr.sx * a[wr.kz], ay = a[wr.ky] - wr.sy * a[wr.kz];
+	real bx = b[wr.kx] - wr.sx * b[wr.kz], by = b[wr.ky] - wr.sy * b[wr.kz];
+	real cx = c[wr.kx] - wr.sx * c[wr.kz], cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+	// Edge tests: which side of each edge (0,0) is on
+	real u = cx * by - cy * bx;
+	real v = ax * cy - ay * cx;
+	real w = bx * ay - by * ax;
+	if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+		return false;
+	real det = u + v + w;
+	if (det == 0)
+		return false;
+
+	real scaled_t = u * (wr.sz * a[wr.kz]) + v * (wr.sz * b[wr.kz]) + w * (wr.sz * c[wr.kz]);
+	real inv_det = 1 / det;
+	t = scaled_t * inv_det;
+	b0 = u * inv_det;
+	b1 = v * inv_det;
+	b2 = w * inv_det;
+	return true;
+}
+
+class triangle_mesh : public hittable {
+public:
+	triangle_mesh() {}
+
+	size_t num_triangles() const { return indices.size() / 3; }
+	size_t num_vertices() const { return positions.size(); }
+
+	// Everything the mesh keeps in memory: vertices, normals, indices and the tree
+	size_t memory_bytes() const {
+		return positions.size() * sizeof(point3) + normals.size() * sizeof(vec3)
+			+ indices.size() * sizeof(uint32_t) + nodes.size() * sizeof(bvh_node);
+	}
+
+	// Applies a scale, then a translation, to every vertex (normals don't change). Call before build().
+	// A negative scale mirrors the mesh through its origin, which turns it inside out: the winding
+	// and the normals stay as they were, so a closed mesh ends up facing inwards, like a negative
+	// radius sphere (eg: the inside surface of a hollow glass ball).
+	void transform(real scale, const vec3& translate) {
+		for (auto& p : positions)
+			p = scale * p + translate;
+	}
+
+	// Sorts the triangles into leaf order, and builds the tree over them. Call once everything's loaded.
+	void build(int threads = 0, int max_leaf_size = simd_lanes > 4 ? simd_lanes : 4) {
+		std::vector<bvh_node> tree;
+		std::vector<uint32_t> order;
+		triangle_bounds bounds = { positions.data(), indices.data(), num_triangles() };
+		// Gathering the vertices makes a lane cost more than a sphere lane does
+		basic_bvh_builder<triangle_bounds>(bounds, max_leaf_size, 2.0 / simd_lanes).build(tree, order, setup_thread_count(threads));
+		nodes = std::move(tree);
+
+		std::vector<uint32_t> sorted(indices.size());
+		parallel_for(order.size(), threads, [&](size_t begin, size_t end) {
+			for (size_t k = begin; k < end; ++k) {
+				for (int corner = 0; corner < 3; ++corner)
+					sorted[3 * k + corner] = indices[3 * size_t(order[k]) + corner];
+			}
+		});
+		indices = std::move(sorted);
+	}
+
+	virtual bool intersect(const ray& r, real t_min, ray_hit& hit) const override;
+
+	virtual void fill_hit_record(const ray& r, const ray_hit& hit, hit_record& rec) const override;
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		if (nodes.empty())
+			return false;
+		output_box = nodes[0].box;
+		return true;
+	}
+
+private:
+	// What the BVH builder sees of the triangles (see box_list in bvh.h)
+	struct triangle_bounds {
+		const point3* positions;
+		const uint32_t* indices;
+		size_t count;
+
+		size_t size() const { return count; }
+		aabb box(uint32_t k) const {
+			aabb b;
+			for (int corner = 0; corner < 3; ++corner)
+				b.expand(positions[indices[3 * size_t(k) + corner]]);
+			return b;
+		}
+	};
+
+	// The ray's watertight setup, broadcast across the lanes
+	struct simd_watertight_ray {
+		simd_real ox, oy, oz, sx, sy, sz; // origin in the ray's own axis order (x, y, z = kx, ky, kz)
+
+		simd_watertight_ray(const watertight_ray& wr)
+			: ox(wr.origin[wr.kx]), oy(wr.origin[wr.ky]), oz(wr.origin[wr.kz]), sx(wr.sx), sy(wr.sy), sz(wr.sz) {}
+	};
+
+	// watertight_hit for triangles [k, k+simd_lanes) of a leaf with `count` left in it. Lanes that
+	// miss (or run past the leaf) come back false.
+	simd_mask lane_hits(const watertight_ray& wr, const simd_watertight_ray& sr, uint32_t k, uint32_t count, simd_real& t) const;
+
+	// Nearest hit among triangles [first, first+count). Only updates closest/hit_index if it finds
+	// something closer than closest.
+	bool hit_range(
+		const watertight_ray& wr, uint32_t first, uint32_t count, real t_min, real& closest, uint32_t& hit_index
+	) const;
+
+public:
+	std::vector<point3> positions;
+	std::vector<vec3> normals;     // one per vertex (same indices as positions), or empty for flat shading
+	std::vector<uint32_t> indices; // 3 per triangle, counter-clockwise from the front
+	std::vector<bvh_node> nodes;
+	material_id mat_id = 0;        // one material for the whole mesh
+	uint32_t object_id = 0;        // hit_record::object_id for every triangle (main numbers the meshes after the spheres)
+};
+
+// Same math as watertight_hit, simd_lanes triangles at a time
+inline simd_mask triangle_mesh::lane_hits(
+	const watertight_ray& wr, const simd_watertight_ray& sr, uint32_t k, uint32_t count, simd_real& t
+) const {
+	// Gather the (indexed) vertices into lanes, already in the ray's axis order. Lanes past the
+	// end of the leaf get an all-zero triangle, which can't be hit (det = 0).
+	alignas(64) real lane[9][simd_lanes]; // [corner * 3 + axis][lane]
+	const int n = count < uint32_t(simd_lanes) ? int(count) : simd_lanes;
+	for (int l = 0; l < n; ++l) {
+		const uint32_t* corner = &indices[3 * size_t(k + l)];
+		for (int c = 0; c < 3; ++c) {
+			const point3& p = positions[corner[c]];
+			lane[3 * c + 0][l] = p[wr.kx];
+			lane[3 * c + 1][l] = p[wr.ky];
+			lane[3 * c + 2][l] = p[wr.kz];
+		}
+	}
+	for (int l = n; l < simd_lanes; ++l) {
+		for (int c = 0; c < 9; ++c)
+			lane[c][l] = 0;
+	}
+
+	const simd_real zero(0);
+	simd_real az = simd_real::load(lane[2]) - sr.oz, bz = simd_real::load(lane[5]) - sr.oz, cz = simd_real::load(lane[8]) - sr.oz;
+	simd_real ax = (simd_real::load(lane[0]) - sr.ox) - sr.sx * az, ay = (simd_real::load(lane[1]) - sr.oy) - sr.sy * az;
+	simd_real bx = (simd_real::load(lane[3]) - sr.ox) - sr.sx * bz, by = (simd_real::load(lane[4]) - sr.oy) - sr.sy * bz;
+	simd_real cx = (simd_real::load(lane[6]) - sr.ox) - sr.sx * cz, cy = (simd_real::load(lane[7]) - sr.oy) - sr.sy * cz;
+
+	simd_real u = cx * by - cy * bx;
+	simd_real v = ax * cy - ay * cx;
+	simd_real w = bx * ay - by * ax;
+	simd_real det = u + v + w;
+
+	simd_real scaled_t = u * (sr.sz * az) + v * (sr.sz * bz) + w * (sr.sz * cz);
+	simd_real inv_det = simd_real(1) / det;
+	t = scaled_t * inv_det;
+	// Inside: the edge tests all agree (none negative, or none positive), and it isn't edge on (det != 0)
+	simd_mask inside = ((zero <= u) & (zero <= v) & (zero <= w)) | ((u <= zero) & (v <= zero) & (w <= zero));
+	return inside & ((det < zero) | (zero < det));
+}
+
+bool triangle_mesh::intersect(const ray& r, real t_min, ray_hit& hit) const {
+	if (nodes.empty())
+		return false;
+
+	const watertight_ray wr(r);
+	uint32_t hit_index = 0;
+	if (!traverse_bvh(nodes.data(), r, t_min, hit.t,
+		[&](uint32_t first, uint32_t count, real& closest_so_far) {
+			return hit_range(wr, first, count, t_min, closest_so_far, hit_index);
+		}))
+		return false;
+
+	hit.primitive = hit_index;
+	hit.object = this;
+	return true;
+}
+
+// Nearest hit in the leaf: each lane keeps its own nearest t, then a min-reduction at the end
+bool triangle_mesh::hit_range(
+	const watertight_ray& wr, uint32_t first, uint32_t count, real t_min, real& closest, uint32_t& hit_index
+) const {
+	RT_COUNT_TRIANGLE_TESTS(count);
+
+	const simd_watertight_ray sr(wr);
+	const simd_real vt_min(t_min);
+	simd_real best_t(closest);
+	simd_real best_k(-1);
+
+	for (uint32_t offset = 0; offset < count; offset += simd_lanes) {
+		simd_real lane_k = simd_real(real(offset)) + simd_real::load(simd_lane_offsets);
+		simd_real t;
+		simd_mask hits = lane_hits(wr, sr, first + offset, count - offset, t); // (before anything reads t)
+		simd_mask take = hits & (vt_min <= t) & (t <= best_t);
+		best_t = select(take, t, best_t);
+		best_k = select(take, lane_k, best_k);
+	}
+
+	real lane_t[simd_lanes], lane_index[simd_lanes];
+	best_t.store(lane_t);
+	best_k.store(lane_index);
+
+	bool hit_anything = false;
+	for (int lane = 0; lane < simd_lanes; ++lane) {
+		if (lane_index[lane] >= 0 && lane_t[lane] <= closest) {
+			closest = lane_t[lane];
+			hit_index = first + uint32_t(lane_index[lane]);
+			hit_anything = true;
+		}
+	}
+	return hit_anything;
+}
+
+bool triangle_mesh::occluded(const ray& r, real t_min, real t_max) const {
+	if (nodes.empty())
+		return false;
+
+	const watertight_ray wr(r);
+	const simd_watertight_ray sr(wr);
+	const simd_real vt_min(t_min), vt_max(t_max);
+	return any_hit_bvh(nodes.data(), r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+		RT_COUNT_TRIANGLE_TESTS(count);
+		for (uint32_t offset = 0; offset < count; offset += simd_lanes) {
+			simd_real t;
+			simd_mask hits = lane_hits(wr, sr, first + offset, count - offset, t);
+			if (any(hits & (vt_min <= t) & (t <= vt_max)))
+				return true;
+		}
+		return false;
+	});
+}
+
+void triangle_mesh::fill_hit_record(const ray& r, const ray_hit& hit, hit_record& rec) const {
+	const uint32_t* corner = &indices[3 * size_t(hit.primitive)];
+	const point3& v0 = positions[corner[0]];
+	const point3& v1 = positions[corner[1]];
+	const point3& v2 = positions[corner[2]];
+
+	// The same test again, for the barycentrics (t comes out the same as it did in the kernel)
+	real t, b0, b1, b2;
+	watertight_hit(watertight_ray(r), v0, v1, v2, t, b0, b1, b2);
+
+	rec.t = hit.t;
+	rec.p = b0 * v0 + b1 * v1 + b2 * v2; // (on the triangle's plane, unlike r.at(t))
+	rec.set_face_normal(r, unit_vector(cross(v1 - v0, v2 - v0)));
+	if (!normals.empty()) {
+		vec3 n = b0 * normals[corner[0]] + b1 * normals[corner[1]] + b2 * normals[corner[2]];
+		if (n.length_squared() > 0) {
+			n = unit_vector(n);
+			rec.normal = dot(n, rec.normal) < 0 ? -n : n;
+		}
+	}
+	rec.spawn_offset = surface_error_scale
+		* std::max(max_abs_component(v0), std::max(max_abs_component(v1), max_abs_component(v2)));
+	rec.mat_id = mat_id;
+	rec.object_id = object_id;
+}
@@ -17,99 +17,121 @@ avoiding calls...might be fun to explore how big an impact that makes.
 
 #pragma once
 
+#include "rtweekend.h"
+
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
 using std::sqrt;
 
-class vec3 {
+// Templated on the scalar, so the same code does float or double math (see real in rtweekend.h).
+// Everything uses vec3 = vec3_t<real>.
+template <typename T>
+class vec3_t {
 public:
-	vec3() : e{ 0, 0, 0 } {}
-	vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+	using value_type = T;
+
+	vec3_t() : e{ 0, 0, 0 } {}
+	vec3_t(T e0, T e1, T e2) : e{ e0, e1, e2 } {}
 
-	double x() const { return e[0]; }
-	double y() const { return e[1]; }
-	double z() const { return e[2]; }
+	T x() const { return e[0]; }
+	T y() const { return e[1]; }
+	T z() const { return e[2]; }
 
-	vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-	double operator[](int i) const { return e[i]; }
-	double& operator[](int i) { return  e[i];  }
+	vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+	T operator[](int i) const { return e[i]; }
+	T& operator[](int i) { return  e[i];  }
 
-	vec3& operator+=(const vec3 &v) {
+	vec3_t& operator+=(const vec3_t &v) {
 		e[0] += v.e[0];
 		e[1] += v.e[1];
 		e[2] += v.e[2];
 		return *this;
 	}
 
-	vec3& operator*=(const double t) {
+	vec3_t& operator*=(const T t) {
 		e[0] *= t;
 		e[1] *= t;
 		e[2] *= t;
 		return *this;
 	}
 
-	vec3& operator/=(const double t) {
+	vec3_t& operator/=(const T t) {
 		return *this *= 1 / t;
 	}
 
-	double length() const {
-		return sqrt(length_squared());
+	T length() const {
+		return std::sqrt(length_squared()); // std::sqrt(float) is sqrtf - no trip through double
 	}
 
 	bool near_zero() const {
 		// Return true if the vector is close to zero in every dimension
-		const auto small = 1e-8; // Threhsold for a small number
-		return (fabs(e[0]) < small) && (fabs(e[1]) < small) && (fabs(e[2]) < small);
+		const T small = T(1e-8); // Threhsold for a small number
+		return (std::abs(e[0]) < small) && (std::abs(e[1]) < small) && (std::abs(e[2]) < small);
 	}
 
 	// This is actually redundant, since we define dot down below, which is a more general form
 	// Leaving for consistency
-	double length_squared() const {
+	T length_squared() const {
 		return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
 	}
 
-	inline static vec3 random() {
-		return vec3(random_double(), random_double(), random_double());
+	template <typename Generator>
+	inline static vec3_t random(Generator& gen) {
+		return vec3_t(T(random_double(gen)), T(random_double(gen)), T(random_double(gen)));
 	}
 
-	inline static vec3 random(double min, double max) {
-		return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+	template <typename Generator>
+	inline static vec3_t random(Generator& gen, double min, double max) {
+		return vec3_t(T(random_double(gen, min, max)), T(random_double(gen, min, max)), T(random_double(gen, min, max)));
 	}
 
 public:
-	double e[3];
+	T e[3];
 
 };
 
 // Type aliases for vec3
+using vec3 = vec3_t<real>;
 using point3 = vec3; // 3D point
 using color = vec3;
 
+// The scalar arguments below aren't used to work out T (only the vectors are), so 2 * v
+// or v / 2.0 still work on a vec3_t<float>, with the constant converted to float
+template <typename T>
+using scalar_t = typename vec3_t<T>::value_type;
+
 
 // vec3 Utility Functions
 
-inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream &out, const vec3_t<T> &v) {
 	return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
-	return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T> &u, const vec3_t<T> &v) {
+	return vec3_t<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
-	return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T> &u, const vec3_t<T> &v) {
+	return vec3_t<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
-	return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &u, const vec3_t<T> &v) {
+	return vec3_t<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3 &v) {
-	return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+template <typename T>
+inline vec3_t<T> operator*(scalar_t<T> t, const vec3_t<T> &v) {
+	return vec3_t<T>(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &v, double t) {
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &v, scalar_t<T> t) {
 	return t * v; // uses definition above
 }
 
@@ -117,7 +139,8 @@ inline vec3 operator*(const vec3 &v, double t) {
 // TODO: Figure out why this one isn't passed as ref...
 // Initially I made it a ref, since everything else was, but it throws an error
 // When I look back at the tutorial, this one is not a reference...why not???
-inline vec3 operator/(vec3 v, double t) {
+template <typename T>
+inline vec3_t<T> operator/(vec3_t<T> v, scalar_t<T> t) {
 	return (1 / t) * v;
 }
 
@@ -127,49 +150,63 @@ inline vec3 operator/(vec3 v, double t) {
  //	return vec3(t / v.e[0], t / v.e[1], t / v.e[2])
  //}
 
-inline double dot(const vec3 &u, const vec3 &v) {
+template <typename T>
+inline T dot(const vec3_t<T> &u, const vec3_t<T> &v) {
 	return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-	return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T> &u, const vec3_t<T> &v) {
+	return vec3_t<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
 				u.e[2] * v.e[0] - u.e[0] * v.e[2],
 				u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline vec3 unit_vector(vec3 v) {
+template <typename T>
+inline vec3_t<T> unit_vector(vec3_t<T> v) {
 	return v / v.length();
 }
 
+// Biggest |component| - how big the numbers around a point are (for error bounds)
+template <typename T>
+inline T max_abs_component(const vec3_t<T>& v) {
+	return std::max(std::abs(v.e[0]), std::max(std::abs(v.e[1]), std::abs(v.e[2])));
+}
+
 
 
 
-vec3 random_in_unit_sphere() {
+template <typename Generator>
+vec3 random_in_unit_sphere(Generator& gen) {
 	while (true) {
-		vec3 pt = vec3::random(-1, 1);
+		vec3 pt = vec3::random(gen, -1, 1);
 		if (pt.length_squared() < 1)
 			return pt;
 	}
 }
 
-vec3 random_unit_vector() { // with a very unique/particular distribution
-	return unit_vector(random_in_unit_sphere());
+template <typename Generator>
+vec3 random_unit_vector(Generator& gen) { // with a very unique/particular distribution
+	return unit_vector(random_in_unit_sphere(gen));
 }
 
-vec3 random_in_hemisphere(const vec3& normal) {
-	vec3 in_unit_sphere = random_in_unit_sphere();
-	if (dot(in_unit_sphere, normal) > 0.0) // In the same hemisphere as the normal
+template <typename Generator>
+vec3 random_in_hemisphere(const vec3& normal, Generator& gen) {
+	vec3 in_unit_sphere = random_in_unit_sphere(gen);
+	if (dot(in_unit_sphere, normal) > 0) // In the same hemisphere as the normal
 		return in_unit_sphere;
 	else
 		return -in_unit_sphere;
 }
 
-vec3 reflect(const vec3& v, const vec3& n) {
+template <typename T>
+vec3_t<T> reflect(const vec3_t<T>& v, const vec3_t<T>& n) {
 	return v - 2 * dot(v, n)*n;
 }
 
 
-vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
+template <typename T>
+vec3_t<T> refract(const vec3_t<T>& uv, const vec3_t<T>& n, scalar_t<T> etai_over_etat) {
 	// This method basically computes snell's law, though a little re-arranging has been done
 	// I'm going to use n = eta (even though technically eta is a greek letter that just looks like an n)
 	// Snell's Law: n*sin(theta)=n'*sin(theta') 
@@ -187,16 +224,17 @@ vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
 	// Return:
 	//  - refracted ray
 	// where eta is the greek letter that looks like n, used in snell's law of refaction
-	auto cos_theta = fmin(dot(-uv, n), 1.0);
-	vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
-	vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+	auto cos_theta = std::min(dot(-uv, n), T(1));
+	vec3_t<T> r_out_perp = etai_over_etat * (uv + cos_theta * n);
+	vec3_t<T> r_out_parallel = -std::sqrt(std::abs(1 - r_out_perp.length_squared())) * n;
 	return r_out_perp + r_out_parallel;
 
 }
 
-vec3 random_in_unit_disk() {
+template <typename Generator>
+vec3 random_in_unit_disk(Generator& gen) {
 	while (true) {
-		auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+		auto p = vec3(real(random_double(gen, -1, 1)), real(random_double(gen, -1, 1)), 0);
 		if (p.length_squared() >= 1) continue;
 		return p;
 	}
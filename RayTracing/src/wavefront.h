@@ -0,0 +1,288 @@
+/******************************************************************************
+Trevor's thoughts:
+ray_color follows one path at a time, depth first. Every bounce jumps into
+whichever material's scatter() the ray happened to hit, so the CPU is constantly
+switching between lambertian/metal/dielectric code (branch predictor and
+instruction cache both hate that).
+
+The wavefront tracer flips it around and goes breadth first. For each tile:
+	1) generate: make a big batch of camera rays (a "wave")
+	2) intersect: find the first hit for every ray in the wave. Misses pick up
+	the background color and get dropped (compacted out of the wave).
+	3) sort: counting-sort the survivors by material type, so all the lambertian
+	hits sit next to each other, then all the metal, then all the glass
+	4) scatter: run each material's scatter over its whole contiguous batch (no
+	virtual calls - we already know the type). Absorbed rays get dropped, and the
+	rest become the next generation. Lights' batch adds their glow, and the
+	lambertian batch does its next event estimation (lights.h) right there.
+	5) repeat 2-4 until the wave is empty (max_depth and Russian roulette drop paths
+	in step 4, same as they do in shade())
+It's the same math as ray_color (a path's color is the light it picks up along
+the way, times the product of its attenuations up to there), and since the
+sample dimensions are keyed by (pixel, sample, bounce) rather than drawn in
+order (sampler.h), every path even makes the same choices it would have made in
+ray_color.
+******************************************************************************/
+
+#pragma once
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "material.h"
+#include "render.h"
+
+#include <algorithm>
+#include <vector>
+
+struct wavefront_path {
+	ray r;
+	color throughput; // product of all the attenuations so far
+	uint32_t pixel;   // index into the tile (row-major)
+	uint32_t sample;  // which sample of that pixel (picks the random stream)
+	uint32_t slot;    // where its color goes in wave_samples
+	path_vertex from; // where it last bounced (for weighting any light it hits - see shade())
+};
+
+class wavefront_tracer {
+public:
+	// wave_size: roughly how many paths to keep in flight at once
+	wavefront_tracer(size_t wave_size = 1 << 16) : wave_size(wave_size) {}
+
+	void render_tile(
+		const tile& t, const camera& cam, const hittable& world, const material_table& materials, const light_list& lights,
+		const render_settings& settings, framebuffer& image
+	) {
+		const int tile_width = t.x1 - t.x0;
+		const int tile_pixels = tile_width * (t.y1 - t.y0);
+		tile_sum.assign(tile_pixels, color(0, 0, 0));
+		aovs = image.has_aovs();
+		tile_aovs.assign(aovs ? tile_pixels : 0, aov_sample());
+		stats.assign(tile_pixels, pixel_stats());
+		taken.assign(tile_pixels, settings.first_sample);
+		current_tile = t;
+		image_width = settings.image_width;
+		gen = make_sampler(settings);
+		path_counts = &thread_path_stats();
+		this->materials = &materials;
+		this->lights = &lights;
+		this->world = &world;
+
+		// Each round, every pixel that isn't done yet asks for more samples (there's only
+		// one round, with all of the samples, unless settings.adaptive)
+		while (true) {
+			jobs.clear();
+			for (int p = 0; p < tile_pixels; ++p) {
+				int end = next_round_end(settings, taken[p], stats[p]);
+				if (end > taken[p])
+					jobs.push_back({ uint32_t(p), taken[p], end });
+			}
+			if (jobs.empty())
+				break;
+
+			// Trace the round a wave at a time
+			size_t job = 0;
+			int next_sample = jobs[0].begin;
+			while (job < jobs.size()) {
+				generate(cam, settings, job, next_sample);
+				for (int bounces = 0; !paths.empty(); ++bounces) {
+					intersect(world, bounces);
+					sort_by_material();
+					scatter_all(settings.max_depth - bounces, bounces); // = the depth ray_color would be at
+				}
+
+				// Samples come back in the order they were generated (sample order within each
+				// pixel), so the running stats come out the same as ray_color's
+				for (size_t k = 0; k < wave_samples.size(); ++k) {
+					const wave_sample& sample = wave_samples[k];
+					tile_sum[sample.pixel] += sample.value;
+					stats[sample.pixel].add(sample.value);
+					if (aovs) {
+						wave_aovs[k].luminance_sq = luminance(sample.value) * luminance(sample.value);
+						tile_aovs[sample.pixel] += wave_aovs[k];
+					}
+				}
+			}
+			for (const auto& j : jobs)
+				taken[j.pixel] = j.end;
+		}
+
+		for (int j = t.y0; j < t.y1; ++j) {
+			for (int i = t.x0; i < t.x1; ++i) {
+				int p = (j - t.y0) * tile_width + (i - t.x0);
+				image.add(i, j, tile_sum[p], taken[p] - settings.first_sample);
+				if (aovs)
+					image.add_aovs(i, j, tile_aovs[p]);
+			}
+		}
+	}
+
+private:
+	struct pixel_job {
+		uint32_t pixel; // index into the tile
+		int begin, end; // samples to take this round
+	};
+
+	struct wave_sample {
+		uint32_t pixel;
+		color value;
+	};
+
+	// Makes camera rays for the next wave_size samples, starting at jobs[job], sample next_sample
+	// (and moves those along to wherever the next wave should start)
+	void generate(const camera& cam, const render_settings& settings, size_t& job, int& next_sample) {
+		const tile& t = current_tile;
+		const int tile_width = t.x1 - t.x0;
+		paths.clear();
+		wave_samples.clear();
+		wave_aovs.clear();
+		while (job < jobs.size() && paths.size() < wave_size) {
+			const pixel_job& pj = jobs[job];
+			int i = t.x0 + int(pj.pixel) % tile_width;
+			int j = t.y0 + int(pj.pixel) / tile_width;
+			for (; next_sample < pj.end && paths.size() < wave_size; ++next_sample) {
+				gen->start_path(pixel_index(settings, i, j), next_sample);
+				point2 jitter = gen->get_2d();
+				auto v = (real(j) + jitter.v) / real(settings.image_height - 1);
+				auto u = (real(i) + jitter.u) / real(settings.image_width - 1);
+				uint32_t slot = uint32_t(wave_samples.size());
+				wave_samples.push_back({ pj.pixel, color(0, 0, 0) });
+				if (aovs)
+					wave_aovs.resize(wave_samples.size());
+				paths.push_back({ cam.get_ray(u, v, *gen), color(1, 1, 1), pj.pixel, uint32_t(next_sample), slot, path_vertex() });
+			}
+			if (next_sample >= pj.end && ++job < jobs.size())
+				next_sample = jobs[job].begin;
+		}
+	}
+
+	// Picks a path's random stream back up at the given bounce
+	void resume_path(const wavefront_path& path, int depth) {
+		const tile& t = current_tile;
+		int tile_width = t.x1 - t.x0;
+		int i = t.x0 + int(path.pixel) % tile_width;
+		int j = t.y0 + int(path.pixel) / tile_width;
+		gen->start_path(uint64_t(j) * image_width + i, path.sample);
+		gen->start_bounce(depth);
+	}
+
+	// Finds the first hit for every path, and compacts the misses away
+	void intersect(const hittable& world, int bounces) {
+		hits.resize(paths.size());
+		size_t live = 0;
+		for (size_t k = 0; k < paths.size(); ++k) {
+			bool hit = world.hit(paths[k].r, 0, infinity, hits[live]); // t_min = 0: see "shadow acne" in ray_color
+			RT_END_RAY(bounces);
+			if (aovs && bounces == 0) // (camera rays)
+				wave_aovs[paths[k].slot] = first_hit_aovs(paths[k].r, hit ? &hits[live] : nullptr, *materials, *lights);
+			if (hit) {
+				paths[live++] = paths[k];
+			}
+			else {
+				wave_samples[paths[k].slot].value += paths[k].throughput * (lights->sky * background(paths[k].r));
+				path_counts->record(path_end::escaped, bounces);
+			}
+		}
+		paths.resize(live);
+		hits.resize(live);
+	}
+
+	// Counting sort on material type -> batch_begin[type] .. batch_begin[type+1]
+	void sort_by_material() {
+		size_t counts[num_material_types] = {};
+		for (const auto& h : hits)
+			++counts[int((*materials)[h.mat_id].type())];
+
+		size_t next[num_material_types];
+		batch_begin[0] = 0;
+		for (int m = 0; m < num_material_types; ++m) {
+			next[m] = batch_begin[m];
+			batch_begin[m + 1] = batch_begin[m] + counts[m];
+		}
+
+		sorted_paths.resize(paths.size());
+		sorted_hits.resize(hits.size());
+		for (size_t k = 0; k < paths.size(); ++k) {
+			size_t dest = next[int((*materials)[hits[k].mat_id].type())]++;
+			sorted_paths[dest] = paths[k];
+			sorted_hits[dest] = hits[k];
+		}
+	}
+
+	void scatter_all(int depth, int bounces) {
+		paths.clear();
+		scatter_batch<lambertian>(material_type::lambertian, depth, bounces);
+		scatter_batch<metal>(material_type::metal, depth, bounces);
+		scatter_batch<dielectric>(material_type::dielectric, depth, bounces);
+		scatter_batch<diffuse_light>(material_type::diffuse_light, depth, bounces);
+	}
+
+	// Runs one material's scatter over its whole batch. The survivors become the next generation.
+	// Same bookkeeping as shade(): the light's glow, then next event estimation, max_depth cap,
+	// and Russian roulette.
+	template <typename Material>
+	void scatter_batch(material_type type, int depth, int bounces) {
+		for (size_t k = batch_begin[int(type)]; k < batch_begin[int(type) + 1]; ++k) {
+			const wavefront_path& path = sorted_paths[k];
+			const hit_record& rec = sorted_hits[k];
+			const material& m = (*materials)[rec.mat_id];
+			const Material& mat = m.get<Material>();
+			color& value = wave_samples[path.slot].value;
+			if (type == material_type::diffuse_light)
+				value += path.throughput * emitted_light(path.r, rec, path.from, m, *lights);
+
+			ray scattered;
+			color attenuation;
+			resume_path(path, depth);
+			// The kind is known here, so this skips material::scatter's switch (and can be inlined)
+			if (!mat.scatter(path.r, rec, attenuation, scattered, *gen)) {
+				path_counts->record(path_end::absorbed, bounces + 1);
+				continue;
+			}
+			path_vertex from;
+			if (!lights->empty()) {
+				if (type == material_type::lambertian)
+					value += path.throughput * sample_direct_light(rec, attenuation, *world, *lights, *gen);
+				from = bounce_vertex(rec, m, scattered);
+			}
+			color throughput = path.throughput * attenuation;
+			if (depth - 1 <= 0)
+				path_counts->record(path_end::max_depth, bounces + 1);
+			else if (!survive_roulette(throughput, bounces + 1, *gen))
+				path_counts->record(path_end::roulette, bounces + 1);
+			else
+				paths.push_back({ scattered, throughput, path.pixel, path.sample, path.slot, from });
+		}
+	}
+
+private:
+	size_t wave_size;
+	std::vector<wavefront_path> paths, sorted_paths;
+	std::vector<hit_record> hits, sorted_hits;
+	size_t batch_begin[num_material_types + 1];
+	std::vector<pixel_job> jobs;
+	std::vector<wave_sample> wave_samples;
+	std::vector<aov_sample> wave_aovs; // the first hit of each wave_samples entry (only if the image keeps AOVs)
+	std::vector<color> tile_sum;
+	std::vector<aov_sample> tile_aovs;
+	bool aovs = false;
+	std::vector<pixel_stats> stats;
+	std::vector<int> taken; // samples each pixel of the tile has so far
+	tile current_tile;
+	int image_width = 0;
+	std::unique_ptr<sampler> gen;
+	path_stats* path_counts = nullptr; // this thread's (see integrator.h)
+	const material_table* materials = nullptr; // the scene's (for the render_tile call in progress)
+	const light_list* lights = nullptr;
+	const hittable* world = nullptr;           // (for shadow rays)
+};
+
+// Each thread keeps its own tracer, so the wave buffers get reused from tile to tile
+inline void render_tile_wavefront(
+	const tile& t, const camera& cam, const hittable& world, const material_table& materials, const light_list& lights,
+	const render_settings& settings, framebuffer& image
+) {
+	thread_local wavefront_tracer tracer;
+	tracer.render_tile(t, cam, world, materials, lights, settings, image);
+}